@@ -114,7 +114,10 @@ projects = {
     "image_viewer",
     "frustum_culling",
     "tp1",
-    "tp2"
+    "tp2",
+    "bvh_bench",
+    "sampler_bench",
+    "mesh_bench"
 }
 
 for i, name in ipairs(projects) do
@@ -126,6 +129,12 @@ for i, name in ipairs(projects) do
         files { gkit_dir .. "/src/" .. name..'.cpp' }
 end
 
+-- bvh_bench verifie que les noyaux simd calculent exactement les memes intersections que Triangle::intersect(), les multiplications et les additions ne sont pas fusionnees
+project("bvh_bench")
+    configuration "gmake"
+        buildoptions { "-ffp-contract=off" }
+    configuration {}
+
  -- description des tutos
 tutos = {
     "tuto1",
@@ -0,0 +1,91 @@
+#ifndef _BRDF_H
+#define _BRDF_H
+
+#include <cmath>
+#include <algorithm>
+
+#include "vec.h"
+#include "color.h"
+#include "materials.h"
+#include "sampler.h"
+
+/* brdf des matieres wavefront : diffuse + reflet blinn-phong normalise, cf Material::diffuse, specular et ns.
+    les directions sont exprimees dans le repere local de la surface, la normale est l'axe z, cf World dans tp2.cpp.
+    les directions sont choisies sur l'un des 2 lobes, proportionnellement a leur luminance, et pdf() renvoie la densite du melange,
+    pour ponderer les chemins, cf path() dans tp2.cpp.
+
+    cf "physically based rendering", M. Pharr, W. Jakob, G. Humphreys, chapitre 8
+    et "using the modified phong reflectance model for physically based rendering", E. Lafortune, Y. Willems, 1994
+ */
+struct Brdf
+{
+    Color kd;
+    Color ks;
+    float ns;
+    float specular;     // probabilite de choisir le reflet
+
+    Brdf( const Material& material ) : kd(material.diffuse), ks(material.specular), ns(std::max(material.ns, 1.f)), specular(0)
+    {
+        // conservation d'energie, kd + ks <= 1, sinon les chemins ne convergent pas dans une scene fermee.
+        // les 2 termes sont reduits ensemble, pour garder la teinte de la matiere
+        float s= std::max(kd.r + ks.r, std::max(kd.g + ks.g, kd.b + ks.b));
+        if(s > 1)
+        {
+            kd= kd / s;
+            ks= ks / s;
+        }
+
+        float d= (kd.r + kd.g + kd.b) / 3;
+        float r= (ks.r + ks.g + ks.b) / 3;
+        if(d + r > 0)
+            specular= r / (d + r);
+    }
+
+    // evalue la brdf pour les directions wo, vers la camera, et wi, vers la lumiere
+    Color f( const Vector& wo, const Vector& wi ) const
+    {
+        if(wo.z <= 0 || wi.z <= 0)
+            return Black();
+
+        Color color= kd / float(M_PI);
+        if(specular > 0)
+        {
+            Vector h= normalize(wo + wi);
+            color= color + ks * (ns + 8) / float(8 * M_PI) * std::pow(std::max(h.z, 0.f), ns);
+        }
+        return color;
+    }
+
+    // densite de proba de choisir wi, connaissant wo, cf sample()
+    float pdf( const Vector& wo, const Vector& wi ) const
+    {
+        if(wo.z <= 0 || wi.z <= 0)
+            return 0;
+
+        float p= (1 - specular) * pdf35(wi);
+        if(specular > 0)
+        {
+            Vector h= normalize(wo + wi);
+            float cos_h= std::max(h.z, 0.f);
+            // densite de h, puis changement de variable h -> wi
+            p+= specular * (ns + 1) / float(2 * M_PI) * std::pow(cos_h, ns) / (4 * dot(wo, h));
+        }
+        return p;
+    }
+
+    // choisit une direction wi, connaissant wo : u0 choisit le lobe, u1 et u2 la direction
+    Vector sample( const float u0, const float u1, const float u2, const Vector& wo ) const
+    {
+        if(u0 >= specular)
+            return sample35(u1, u2);
+
+        // choisit h autour de la normale, proportionnellement a cos^ns, puis le reflet de wo
+        float cos_theta= std::pow(u1, 1 / (ns + 1));
+        float sin_theta= std::sqrt(std::max(0.f, 1 - cos_theta*cos_theta));
+        float phi= float(2 * M_PI) * u2;
+        Vector h(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta);
+        return 2 * dot(wo, h) * h - wo;
+    }
+};
+
+#endif
@@ -0,0 +1,938 @@
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <cfloat>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "vec.h"
+#include "mesh.h"
+#include "wavefront_fast.h"
+#include "ray_stats.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+// allocateur pour std::vector, aligne les elements sur A octets, cf Node
+// (std::allocator ne respecte pas alignas() au dela de 16 octets, avant c++17)
+template< typename T, int A >
+struct aligned_allocator
+{
+    typedef T value_type;
+    template< typename U > struct rebind { typedef aligned_allocator<U, A> other; };
+
+    aligned_allocator( ) {}
+    template< typename U > aligned_allocator( const aligned_allocator<U, A>& ) {}
+
+    T *allocate( const std::size_t n )
+    {
+    #ifdef _WIN32
+        void *p= _aligned_malloc(n * sizeof(T), A);
+    #else
+        void *p= nullptr;
+        if(posix_memalign(&p, A, n * sizeof(T)) != 0)
+            p= nullptr;
+    #endif
+        if(p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate( T *p, const std::size_t )
+    {
+    #ifdef _WIN32
+        _aligned_free(p);
+    #else
+        free(p);
+    #endif
+    }
+
+    template< typename U > bool operator== ( const aligned_allocator<U, A>& ) const { return true; }
+    template< typename U > bool operator!= ( const aligned_allocator<U, A>& ) const { return false; }
+};
+
+
+// extremite des rayons d'ombre, cf BVH::occluded( origin, target ) : le point vise n'est pas teste
+const float SHADOW_TMAX= 1 - 1e-4f;
+
+struct Ray
+{
+    Point o;            // origine
+    Vector d;           // direction
+    float tmax;             // intervalle [0 tmax]
+
+    Ray( const Point& _o, const Point& _e ) :  o(_o), d(Vector(_o, _e)), tmax(1) {}
+
+    Ray( const Point& origine, const Vector& direction ) : o(origine), d(direction), tmax(FLT_MAX) {}
+};
+
+struct Hit
+{
+    float t;            // p(t)= o + td, position du point d'intersection sur le rayon
+    float u, v;         // p(u, v), position du point d'intersection sur le triangle
+    int triangle_id;    // indice du triangle dans le mesh
+
+    Hit( ) : t(FLT_MAX), u(), v(), triangle_id(-1) {}
+    Hit( const float _t, const float _u, const float _v, const int _id ) : t(_t), u(_u), v(_v), triangle_id(_id) {}
+    operator bool ( ) const { return (triangle_id != -1); }
+};
+
+struct RayHit
+{
+    Point o;            // origine
+    float t;            // p(t)= o + td, position du point d'intersection sur le rayon
+    Vector d;           // direction
+    int triangle_id;    // indice du triangle dans le mesh
+    float u, v;
+    int x, y;
+
+    RayHit( const Point& _o, const Point& _e ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(), y() {}
+    RayHit( const Point& _o, const Point& _e, const int _x, const int _y ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(_x), y(_y) {}
+    operator bool ( ) { return (triangle_id != -1); }
+};
+
+struct BBoxHit
+{
+    float tmin, tmax;
+
+    BBoxHit() : tmin(FLT_MAX), tmax(-FLT_MAX) {}
+    BBoxHit( const float _tmin, const float _tmax ) : tmin(_tmin), tmax(_tmax) {}
+    float centroid( ) const { return (tmin + tmax) / 2; }
+    operator bool( ) const { return tmin <= tmax; }
+};
+
+
+struct BBox
+{
+    Point pmin, pmax;
+
+    BBox( ) : pmin(), pmax() {}
+
+    BBox( const Point& p ) : pmin(p), pmax(p) {}
+
+    BBox& insert( const Point& p ) { pmin= min(pmin, p); pmax= max(pmax, p); return *this; }
+    BBox& insert( const BBox& box ) { pmin= min(pmin, box.pmin); pmax= max(pmax, box.pmax); return *this; }
+
+    float centroid( const int axis ) const { return (pmin(axis) + pmax(axis)) / 2; }
+    Point centroid( ) const { return center(pmin, pmax); }
+
+    // aire de la surface de l'englobant, 0 pour un englobant vide
+    float area( ) const
+    {
+        Vector d= Vector(pmin, pmax);
+        if(d.x < 0 || d.y < 0 || d.z < 0) return 0;
+        return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+
+    // englobant vide, insert() le remplace par le premier point / englobant
+    static BBox empty( )
+    {
+        BBox box;
+        box.pmin= Point(FLT_MAX, FLT_MAX, FLT_MAX);
+        box.pmax= Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        return box;
+    }
+
+    BBoxHit intersect( const RayHit& ray ) const
+    {
+        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+        return intersect(ray, invd);
+    }
+
+    BBoxHit intersect( const RayHit& ray, const Vector& invd ) const
+    {
+        return intersect(ray.o, ray.d, invd, ray.t);
+    }
+
+    // intersection avec un rayon, limitee a l'intervalle [0 htmax], htmax est la plus proche intersection deja trouvee
+    BBoxHit intersect( const Ray& ray, const Vector& invd, const float htmax ) const
+    {
+        return intersect(ray.o, ray.d, invd, htmax);
+    }
+
+    BBoxHit intersect( const Point& o, const Vector& d, const Vector& invd, const float htmax ) const
+    {
+        Point rmin= pmin;
+        Point rmax= pmax;
+        if(d.x < 0) std::swap(rmin.x, rmax.x);
+        if(d.y < 0) std::swap(rmin.y, rmax.y);
+        if(d.z < 0) std::swap(rmin.z, rmax.z);
+        Vector dmin= (rmin - o) * invd;
+        Vector dmax= (rmax - o) * invd;
+
+        float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
+        float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, htmax)));
+        return BBoxHit(tmin, tmax);
+    }
+};
+
+struct Triangle
+{
+    Point p;            // sommet a du triangle
+    Vector e1, e2;      // aretes ab, ac du triangle
+    int id;
+
+    float aire;
+
+    Triangle( const TriangleData& data, const int _id ) : p(data.a), e1(Vector(data.a, data.b)), e2(Vector(data.a, data.c)), id(_id) {
+        float ab = length(e1);
+        float ac = length(e2);
+        float bc = length((p+e2) - (p+e1));
+        float p = (ab + ac + bc)/ 2.f;
+        aire = sqrt(p * (p - ab) * (p - bc) * (p - ac));
+    }
+
+    /* calcule l'intersection ray/triangle
+        cf "fast, minimum storage ray-triangle intersection"
+
+        renvoie faux s'il n'y a pas d'intersection valide (une intersection peut exister mais peut ne pas se trouver dans l'intervalle [0 tmax] du rayon.)
+        renvoie vrai + les coordonnees barycentriques (u, v) du point d'intersection + sa position le long du rayon (t).
+        convention barycentrique : p(u, v)= (1 - u - v) * a + u * b + v * c
+    */
+    Hit intersect( const Ray &ray, const float tmax ) const
+    {
+        Vector pvec= cross(ray.d, e2);
+        float det= dot(e1, pvec);
+
+        float inv_det= 1 / det;
+        Vector tvec(p, ray.o);
+
+        float u= dot(tvec, pvec) * inv_det;
+        if(u < 0 || u > 1) return Hit();
+
+        Vector qvec= cross(tvec, e1);
+        float v= dot(ray.d, qvec) * inv_det;
+        if(v < 0 || u + v > 1) return Hit();
+
+        // ecrit pour rejeter aussi t == nan, cas d'un triangle degenere
+        float t= dot(e2, qvec) * inv_det;
+        if(!(t >= 0 && t <= tmax)) return Hit();
+
+        return Hit(t, u, v, id);           // p(u, v)= (1 - u - v) * a + u * b + v * c
+    }
+
+    //GI compemdium eq 18
+    Point sample18(const float u1, const float u2) const
+    {
+        float r1 = std::sqrt(u1);
+        float a = 1 - r1;
+        float b = (1 - u2) * r1;
+        float g = u2 * r1;
+        return a * p + b * (p + e1) + g * (p + e2);
+    }
+
+    float pdf18(const Point& p) const
+    {
+        return 1.0 / aire;
+    }
+
+    void intersect( RayHit &ray ) const
+    {
+        Vector pvec= cross(ray.d, e2);
+        float det= dot(e1, pvec);
+
+        float inv_det= 1 / det;
+        Vector tvec(p, ray.o);
+
+        float u= dot(tvec, pvec) * inv_det;
+        if(u < 0 || u > 1) return;
+
+        Vector qvec= cross(tvec, e1);
+        float v= dot(ray.d, qvec) * inv_det;
+        if(v < 0 || u + v > 1) return;
+
+        float t= dot(e2, qvec) * inv_det;
+        if(!(t >= 0 && t <= ray.t)) return;
+
+        // touche !!
+        ray.t= t;
+        ray.triangle_id= id;
+        ray.u= u;
+        ray.v= v;
+    }
+
+    BBox bounds( ) const
+    {
+        BBox box(p);
+        return box.insert(p+e1).insert(p+e2);
+    }
+};
+
+
+// construction de l'arbre / BVH
+// 32 octets : l'englobant et 2 indices. alignes sur 32 octets, un noeud n'est jamais a cheval sur 2 lignes de cache.
+struct alignas(32) Node
+{
+    BBox bounds;
+    int left;
+    int right;
+
+    bool internal( ) const { return right > 0; }                        // renvoie vrai si le noeud est un noeud interne
+    int internal_left( ) const { assert(internal()); return left; }     // renvoie le fils gauche du noeud interne
+    int internal_right( ) const { assert(internal()); return right; }   // renvoie le fils droit
+
+    bool leaf( ) const { return right < 0; }                            // renvoie vrai si le noeud est une feuille
+    int leaf_begin( ) const { assert(leaf()); return -left; }           // renvoie le premier objet de la feuille
+    int leaf_end( ) const { assert(leaf()); return -right; }            // renvoie le dernier objet
+};
+
+static_assert(sizeof(Node) == 32, "Node layout");
+
+// creation d'un noeud interne
+inline Node make_node( const BBox& bounds, const int left, const int right )
+{
+    Node node { bounds, left, right };
+    assert(node.internal());    // verifie que c'est bien un noeud...
+    return node;
+}
+
+// creation d'une feuille
+inline Node make_leaf( const BBox& bounds, const int begin, const int end )
+{
+    Node node { bounds, -begin, -end };
+    assert(node.leaf());        // verifie que c'est bien une feuille...
+    return node;
+}
+
+
+// repartition des triangles dans les intervalles / bins, le long d'un axe
+struct triangle_bin
+{
+    int axis;
+    int bins;
+    float cmin;     // debut de l'intervalle, sur l'axe
+    float scale;    // bins / longueur de l'intervalle
+
+    triangle_bin( const int _axis, const int _bins, const float _cmin, const float _cmax ) : axis(_axis), bins(_bins), cmin(_cmin), scale(_bins / (_cmax - _cmin)) {}
+
+    int operator() ( const float centroid ) const
+    {
+        int b= int((centroid - cmin) * scale);
+        return std::max(0, std::min(b, bins -1));
+    }
+
+    int operator() ( const Triangle& triangle ) const
+    {
+        // re-construit l'englobant du triangle
+        BBox bounds= triangle.bounds();
+        return (*this)(bounds.centroid(axis));
+    }
+};
+
+struct triangle_less_bin
+{
+    triangle_bin bin;
+    int split;
+
+    triangle_less_bin( const triangle_bin& _bin, const int _split ) : bin(_bin), split(_split) {}
+
+    bool operator() ( const Triangle& triangle ) const { return bin(triangle) < split; }
+};
+
+
+struct triangle_less_centroid
+{
+    int axis;
+
+    triangle_less_centroid( const int _axis ) : axis(_axis) {}
+
+    bool operator() ( const Triangle& a, const Triangle& b ) const
+    {
+        return a.bounds().centroid(axis) < b.bounds().centroid(axis);
+    }
+};
+
+
+// statistiques sur l'arbre, cf BVH::stats()
+struct BVHStats
+{
+    int nodes;
+    int leaves;
+    int depth;              // profondeur max
+    float leaf_triangles;   // nombre moyen de triangles par feuille
+    float sah_cost;         // cout SAH de l'arbre, relatif a l'englobant de la racine
+    float node_tests;       // estimation du nombre d'englobants testes par rayon
+    float triangle_tests;   // estimation du nombre de triangles testes par rayon
+
+    void print( ) const
+    {
+        printf("  %d nodes, %d leaves, %.1f triangles/leaf, depth %d\n", nodes, leaves, leaf_triangles, depth);
+        printf("  sah cost %.2f: %.1f nodes, %.1f triangles tested per ray\n", sah_cost, node_tests, triangle_tests);
+    }
+};
+
+
+struct BVH
+{
+    std::vector<Node, aligned_allocator<Node, 32> > nodes;
+    std::vector<Triangle> triangles;
+    int root;
+
+    int bins;           // nombre d'intervalles testes par axe pour evaluer le cout SAH d'un decoupage
+    int leaf_size;      // nombre max de triangles dans une feuille
+
+    // couts relatifs d'un test rayon/englobant et d'un test rayon/triangle, utilises par l'heuristique SAH
+    static float traversal_cost( ) { return 1; }
+    static float intersection_cost( ) { return 1; }
+
+    BVH( const int _bins= 16, const int _leaf_size= 4 ) : nodes(), triangles(), root(-1), bins(_bins), leaf_size(_leaf_size) {}
+
+    // construit un bvh pour l'ensemble de triangles
+    int build( const BBox& _bounds, const std::vector<Triangle>& _triangles )
+    {
+        triangles= _triangles;  // copie les triangles pour les trier
+        return build_nodes(_bounds);
+    }
+
+    // construit l'arbre des triangles deja ranges dans triangles
+    int build_nodes( const BBox& _bounds )
+    {
+        nodes.clear();          // efface les noeuds
+        root= -1;
+        if(triangles.empty())
+            return root;
+
+        // un sous arbre construit sur n triangles contient au plus 2n -1 noeuds.
+        // chaque sous arbre ecrit ses noeuds dans un intervalle reserve, l'indice d'un noeud ne depend pas de l'ordre d'execution des taches,
+        // et l'arbre construit en parallele est identique a l'arbre construit sequentiellement.
+        nodes.resize(2 * triangles.size() -1);
+
+        // construit l'arbre...
+        root= 0;
+        #pragma omp parallel
+        #pragma omp single
+        build(root, _bounds, 0, triangles.size(), 0);
+
+        // re-ordonne les noeuds pour le parcours
+        flatten();
+
+        // et renvoie la racine
+        return root;
+    }
+
+    // construit un bvh pour tous les triangles du mesh, Triangle::id est l'indice du triangle dans le mesh
+    int build( const Mesh& mesh )
+    {
+        BBox bounds;
+        mesh.bounds(bounds.pmin, bounds.pmax);
+
+        std::vector<Triangle> _triangles;
+        int n= mesh.triangle_count();
+        _triangles.reserve(n);
+        for(int i= 0; i < n; i++)
+            _triangles.emplace_back(mesh.triangle(i), i);
+
+        return build(bounds, _triangles);
+    }
+
+    // construit un bvh en lisant les triangles par lots, sans construire le mesh complet, Triangle::id est l'indice du triangle dans le fichier.
+    // le bvh ne garde que ses triangles, sans normales ni texcoords, les lots ne sont pas conserves
+    int build( MeshStream& stream )
+    {
+        BBox bounds= BBox::empty();
+        triangles.clear();
+        MeshBatch batch;
+        while(stream.next(batch))
+        {
+            for(int i= 0; i < int(batch.triangles.size()); i++)
+            {
+                const TriangleData& data= batch.triangles[i];
+                triangles.emplace_back(data, batch.first + i);
+                bounds.insert(Point(data.a)).insert(Point(data.b)).insert(Point(data.c));
+            }
+        }
+
+        return build_nodes(bounds);
+    }
+
+    void intersect( RayHit& ray ) const
+    {
+        Ray r(ray.o, ray.d);
+        r.tmax= ray.t;
+        if(Hit hit= intersect(r))
+        {
+            ray.t= hit.t;
+            ray.triangle_id= hit.triangle_id;
+            ray.u= hit.u;
+            ray.v= hit.v;
+        }
+    }
+
+    /* re-ordonne les noeuds en profondeur d'abord, et supprime les noeuds inutilises, cf build().
+        le fils gauche d'un noeud interne est toujours le noeud suivant, le parcours le visite souvent juste apres son pere,
+        et les noeuds visites par un rayon sont proches les uns des autres.
+     */
+    void flatten( )
+    {
+        if(root < 0) return;
+
+        std::vector<Node, aligned_allocator<Node, 32> > flat;
+        flat.reserve(nodes.size());
+        flatten(root, flat);
+
+        nodes.swap(flat);
+        root= 0;
+    }
+
+    // parcours l'arbre et estime le cout SAH et le nombre de tests par rayon
+    BVHStats stats( ) const
+    {
+        BVHStats stats= { };
+        if(root < 0) return stats;
+
+        float area= nodes[root].bounds.area();
+        stats_node(root, 1, area > 0 ? 1 / area : 0, stats);
+
+        stats.leaf_triangles= float(triangles.size()) / std::max(1, stats.leaves);
+        return stats;
+    }
+
+    // profondeur max de l'arbre, cf build(), et taille de la pile de parcours
+    enum { MAX_DEPTH= 64 };
+
+    // renvoie l'intersection la plus proche de l'origine du rayon, dans l'intervalle [0 ray.tmax]
+    Hit intersect( const Ray& ray ) const
+    {
+        Hit hit;
+        hit.t= ray.tmax;
+        RAY_STAT(closest, 1);
+        if(root < 0) return hit;
+
+        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+        RAY_STAT(nodes, 1);
+        if(!nodes[root].bounds.intersect(ray, invd, hit.t))
+            return hit;
+
+        // pile des noeuds a visiter, et distance a leur englobant
+        struct { int index; float tmin; } stack[MAX_DEPTH];
+        int top= 0;
+
+        int index= root;
+        for(;;)
+        {
+            const Node& node= nodes[index];
+            if(node.internal())
+            {
+                RAY_STAT(nodes, 2);
+                BBoxHit left= nodes[node.left].bounds.intersect(ray, invd, hit.t);
+                BBoxHit right= nodes[node.right].bounds.intersect(ray, invd, hit.t);
+                if(left && right)
+                {
+                    // visite d'abord le fils le plus proche, l'autre sera peut etre elimine par une intersection plus proche
+                    assert(top < MAX_DEPTH);
+                    if(left.tmin <= right.tmin)
+                    {
+                        stack[top].index= node.right;
+                        stack[top].tmin= right.tmin;
+                        index= node.left;
+                    }
+                    else
+                    {
+                        stack[top].index= node.left;
+                        stack[top].tmin= left.tmin;
+                        index= node.right;
+                    }
+                    top++;
+                    continue;
+                }
+                else if(left)
+                {
+                    index= node.left;
+                    continue;
+                }
+                else if(right)
+                {
+                    index= node.right;
+                    continue;
+                }
+            }
+            else
+            {
+                RAY_STAT(triangles, node.leaf_end() - node.leaf_begin());
+                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
+                    if(Hit h= triangles[i].intersect(ray, hit.t))
+                        hit= h;
+            }
+
+            // reprend le parcours avec le prochain noeud de la pile, s'il est plus proche que l'intersection trouvee
+            for(;;)
+            {
+                if(top == 0)
+                {
+                    RAY_STAT(hits, bool(hit));
+                    return hit;
+                }
+
+                top--;
+                if(stack[top].tmin <= hit.t)
+                    break;
+            }
+            index= stack[top].index;
+        }
+    }
+
+    // renvoie vrai des qu'une intersection est trouvee dans l'intervalle [0 ray.tmax], sans chercher la plus proche
+    bool occluded( const Ray& ray ) const
+    {
+        RAY_STAT(occluded, 1);
+        if(root < 0) return false;
+
+        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+        RAY_STAT(nodes, 1);
+        if(!nodes[root].bounds.intersect(ray, invd, ray.tmax))
+            return false;
+
+        // pile des noeuds a visiter. comme intersect(), teste les 2 fils, ignore ceux que le rayon ne touche pas, et visite d'abord le plus proche :
+        // il cache plus souvent l'extremite du rayon, et le parcours s'arrete des la premiere intersection
+        int stack[MAX_DEPTH];
+        int top= 0;
+
+        int index= root;
+        for(;;)
+        {
+            const Node& node= nodes[index];
+            if(node.internal())
+            {
+                RAY_STAT(nodes, 2);
+                BBoxHit left= nodes[node.left].bounds.intersect(ray, invd, ray.tmax);
+                BBoxHit right= nodes[node.right].bounds.intersect(ray, invd, ray.tmax);
+                if(left && right)
+                {
+                    assert(top < MAX_DEPTH);
+                    if(left.tmin <= right.tmin)
+                    {
+                        stack[top++]= node.right;
+                        index= node.left;
+                    }
+                    else
+                    {
+                        stack[top++]= node.left;
+                        index= node.right;
+                    }
+                    continue;
+                }
+                else if(left)
+                {
+                    index= node.left;
+                    continue;
+                }
+                else if(right)
+                {
+                    index= node.right;
+                    continue;
+                }
+            }
+            else
+            {
+                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
+                {
+                    RAY_STAT(triangles, 1);
+                    if(triangles[i].intersect(ray, ray.tmax))
+                    {
+                        RAY_STAT(hits, 1);
+                        return true;
+                    }
+                }
+            }
+
+            if(top == 0)
+                return false;
+            index= stack[--top];
+        }
+    }
+
+    // renvoie vrai des qu'une intersection est trouvee dans l'intervalle [0 tmax] du rayon
+    bool occluded( const Ray& ray, const float tmax ) const
+    {
+        Ray r= ray;
+        r.tmax= tmax;
+        return occluded(r);
+    }
+
+    // renvoie vrai si le segment [origin target] est occulte. le rayon s'arrete juste avant target, qui se trouve souvent sur une source
+    bool occluded( const Point& origin, const Point& target ) const
+    {
+        return occluded(Ray(origin, target), SHADOW_TMAX);
+    }
+
+    // rayons d'ombre depuis le meme point : hidden[i]= 1 si le segment [origin targets[i]] est occulte. renvoie le nombre de segments occultes
+    int occluded( const Point& origin, const std::vector<Point>& targets, std::vector<int>& hidden ) const
+    {
+        hidden.resize(targets.size());
+
+        int n= 0;
+        for(int i= 0; i < int(targets.size()); i++)
+        {
+            hidden[i]= occluded(origin, targets[i]);
+            n+= hidden[i];
+        }
+        return n;
+    }
+
+protected:
+    // construction du noeud index, et de son sous arbre dans les noeuds [index .. index + 2*(end - begin) -1)
+    void build( const int index, const BBox& bounds, const int begin, const int end, const int depth )
+    {
+        // cherche le meilleur decoupage des triangles, ou construit une feuille.
+        // au dela de MAX_DEPTH/2, les triangles sont repartis en 2 moities pour borner la profondeur de l'arbre, cf la pile de intersect()
+        BBox bounds_left, bounds_right;
+        int m;
+        if(depth < MAX_DEPTH / 2)
+            m= split(bounds, begin, end, bounds_left, bounds_right);
+        else
+            m= split_median(begin, end, bounds_left, bounds_right);
+        if(m < 0)
+        {
+            // inserer une feuille
+            nodes[index]= make_leaf(bounds, begin, end);
+            return;
+        }
+        assert(m != begin);
+        assert(m != end);
+
+        // le fils gauche suit le noeud, le fils droit suit le sous arbre gauche
+        int left= index +1;
+        int right= index + 2 * (m - begin);
+        nodes[index]= make_node(bounds, left, right);
+
+        // les gros sous arbres sont construits par des taches independantes, les triangles et les noeuds des 2 fils sont disjoints.
+        // la fin de la region parallele dans build() attend la fin de toutes les taches.
+        if(end - begin > 4096)
+        {
+            // construire le fils gauche
+            // les triangles se trouvent dans [begin .. m)
+            #pragma omp task
+            build(left, bounds_left, begin, m, depth +1);
+        }
+        else
+            build(left, bounds_left, begin, m, depth +1);
+
+        // on recommence pour le fils droit
+        // les triangles se trouvent dans [m .. end)
+        build(right, bounds_right, m, end, depth +1);
+    }
+
+    /* repartit les triangles [begin .. end) en 2 ensembles, renvoie l'indice du premier triangle du 2ieme ensemble et les englobants des 2 ensembles,
+        ou -1 si une feuille est moins chere que le meilleur decoupage.
+
+        cf "on fast construction of SAH based bounding volume hierarchies", I. Wald, 2007
+        les triangles sont repartis dans des intervalles / bins le long de chaque axe, en fonction du centre de leur englobant,
+        le cout SAH des decoupages entre 2 intervalles est evalue en balayant les intervalles dans les 2 sens.
+     */
+    int split( const BBox& bounds, const int begin, const int end, BBox& bounds_left, BBox& bounds_right )
+    {
+        const int n= end - begin;
+        if(n <= 1)
+            return -1;
+
+        // englobant des centres des triangles
+        BBox cbounds= BBox::empty();
+        for(int i= begin; i < end; i++)
+            cbounds.insert(triangles[i].bounds().centroid());
+
+        const int MAX_BINS= 64;
+        const int nbins= std::max(2, std::min(bins, MAX_BINS));
+
+        // repartit les triangles dans les intervalles des 3 axes
+        BBox bin_bounds[3][MAX_BINS];
+        int bin_count[3][MAX_BINS];
+        for(int axis= 0; axis < 3; axis++)
+        for(int b= 0; b < nbins; b++)
+        {
+            bin_bounds[axis][b]= BBox::empty();
+            bin_count[axis][b]= 0;
+        }
+
+        bool valid[3];
+        triangle_bin bin[3]= {
+            triangle_bin(0, nbins, cbounds.pmin.x, cbounds.pmax.x),
+            triangle_bin(1, nbins, cbounds.pmin.y, cbounds.pmax.y),
+            triangle_bin(2, nbins, cbounds.pmin.z, cbounds.pmax.z) };
+        for(int axis= 0; axis < 3; axis++)
+            // tous les centres sont au meme endroit, pas de decoupage possible sur cet axe
+            valid[axis]= cbounds.pmax(axis) > cbounds.pmin(axis);
+
+        for(int i= begin; i < end; i++)
+        {
+            BBox box= triangles[i].bounds();
+            Point c= box.centroid();
+            for(int axis= 0; axis < 3; axis++)
+            {
+                if(!valid[axis]) continue;
+
+                int b= bin[axis](c(axis));
+                bin_bounds[axis][b].insert(box);
+                bin_count[axis][b]++;
+            }
+        }
+
+        float best_cost= FLT_MAX;
+        int best_axis= -1;
+        int best_split= -1;
+        for(int axis= 0; axis < 3; axis++)
+        {
+            if(!valid[axis]) continue;
+
+            // balaye les intervalles de droite a gauche, aire et nombre de triangles a droite de chaque decoupage
+            float right_area[MAX_BINS];
+            int right_count[MAX_BINS];
+            BBox right= BBox::empty();
+            int count= 0;
+            for(int b= nbins -1; b > 0; b--)
+            {
+                right.insert(bin_bounds[axis][b]);
+                count+= bin_count[axis][b];
+                right_area[b]= right.area();
+                right_count[b]= count;
+            }
+
+            // puis de gauche a droite, et evalue le cout de chaque decoupage
+            BBox left= BBox::empty();
+            count= 0;
+            for(int b= 1; b < nbins; b++)
+            {
+                left.insert(bin_bounds[axis][b -1]);
+                count+= bin_count[axis][b -1];
+                if(count == 0 || right_count[b] == 0)
+                    continue;
+
+                float cost= left.area() * count + right_area[b] * right_count[b];
+                if(cost < best_cost)
+                {
+                    best_cost= cost;
+                    best_axis= axis;
+                    best_split= b;
+                }
+            }
+        }
+
+        if(best_axis < 0)
+        {
+            // pas de decoupage possible, tous les centres sont confondus...
+            // forcer quand meme un decoupage en 2 ensembles, si la feuille est trop grosse
+            if(n <= leaf_size)
+                return -1;
+
+            int m= (begin + end) / 2;
+            bounds_left= triangle_bounds(begin, m);
+            bounds_right= triangle_bounds(m, end);
+            return m;
+        }
+
+        // cout du decoupage, relatif a l'aire du noeud
+        float area= bounds.area();
+        float leaf_cost= intersection_cost() * n;
+        float split_cost= traversal_cost() + intersection_cost() * (area > 0 ? best_cost / area : n);
+        if(n <= leaf_size && leaf_cost <= split_cost)
+            return -1;
+
+        // englobants des 2 ensembles
+        bounds_left= BBox::empty();
+        bounds_right= BBox::empty();
+        for(int b= 0; b < nbins; b++)
+        {
+            if(b < best_split)
+                bounds_left.insert(bin_bounds[best_axis][b]);
+            else
+                bounds_right.insert(bin_bounds[best_axis][b]);
+        }
+
+        // repartit les triangles
+        Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less_bin(bin[best_axis], best_split));
+        int m= std::distance(triangles.data(), pm);
+        assert(m != begin);
+        assert(m != end);
+        return m;
+    }
+
+    // repartit les triangles [begin .. end) en 2 moities, le long de l'axe le plus etire, ou -1 si une feuille suffit
+    int split_median( const int begin, const int end, BBox& bounds_left, BBox& bounds_right )
+    {
+        if(end - begin <= leaf_size)
+            return -1;
+
+        // englobant des centres des triangles
+        BBox cbounds= BBox::empty();
+        for(int i= begin; i < end; i++)
+            cbounds.insert(triangles[i].bounds().centroid());
+
+        // axe le plus etire de l'englobant
+        Vector d= Vector(cbounds.pmin, cbounds.pmax);
+        int axis;
+        if(d.x > d.y && d.x > d.z)  // x plus grand que y et z ?
+            axis= 0;
+        else if(d.y > d.z)          // y plus grand que z ? (et que x implicitement)
+            axis= 1;
+        else                        // x et y ne sont pas les plus grands...
+            axis= 2;
+
+        int m= (begin + end) / 2;
+        std::nth_element(triangles.data() + begin, triangles.data() + m, triangles.data() + end, triangle_less_centroid(axis));
+
+        bounds_left= triangle_bounds(begin, m);
+        bounds_right= triangle_bounds(m, end);
+        return m;
+    }
+
+    // copie le sous arbre dans flat, en profondeur d'abord, et renvoie l'indice du noeud
+    int flatten( const int index, std::vector<Node, aligned_allocator<Node, 32> >& flat ) const
+    {
+        int id= flat.size();
+        flat.push_back(nodes[index]);
+
+        const Node& node= nodes[index];
+        if(node.internal())
+        {
+            int left= flatten(node.internal_left(), flat);
+            int right= flatten(node.internal_right(), flat);
+            assert(left == id +1);
+
+            flat[id].left= left;
+            flat[id].right= right;
+        }
+        return id;
+    }
+
+    // accumule les statistiques du sous arbre, inv_area est l'inverse de l'aire de l'englobant de la racine
+    void stats_node( const int index, const int depth, const float inv_area, BVHStats& stats ) const
+    {
+        const Node& node= nodes[index];
+        // probabilite qu'un rayon qui touche la racine, touche aussi ce noeud
+        float p= node.bounds.area() * inv_area;
+
+        stats.nodes++;
+        stats.depth= std::max(stats.depth, depth);
+        stats.node_tests+= p;
+        if(node.leaf())
+        {
+            int n= node.leaf_end() - node.leaf_begin();
+            stats.leaves++;
+            stats.triangle_tests+= p * n;
+            stats.sah_cost+= intersection_cost() * p * n;
+        }
+        else
+        {
+            stats.sah_cost+= traversal_cost() * p;
+            stats_node(node.internal_left(), depth +1, inv_area, stats);
+            stats_node(node.internal_right(), depth +1, inv_area, stats);
+        }
+    }
+
+    BBox triangle_bounds( const int begin, const int end )
+    {
+        BBox bbox= triangles[begin].bounds();
+        for(int i= begin +1; i < end; i++)
+            bbox.insert(triangles[i].bounds());
+
+        return bbox;
+    }
+};
+
+#endif
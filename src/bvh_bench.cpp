@@ -0,0 +1,540 @@
+
+//! \file bvh_bench.cpp mesure les performances du bvh de tp2, cf bvh.h
+
+#include <vector>
+#include <deque>
+#include <cfloat>
+#include <chrono>
+#include <random>
+
+#include "vec.h"
+#include "mat.h"
+#include "orbiter.h"
+#include "mesh.h"
+#include "wavefront_fast.h"
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "bvh_packet.h"
+
+
+// re-ordonne les noeuds du bvh, order[i] est l'indice du noeud a placer en i
+void relayout( BVH& bvh, const std::vector<int>& order )
+{
+    std::vector<int> remap(bvh.nodes.size(), -1);
+    for(int i= 0; i < int(order.size()); i++)
+        remap[order[i]]= i;
+
+    std::vector<Node, aligned_allocator<Node, 32> > nodes;
+    for(int i= 0; i < int(order.size()); i++)
+    {
+        Node node= bvh.nodes[order[i]];
+        if(node.internal())
+        {
+            node.left= remap[node.left];
+            node.right= remap[node.right];
+        }
+        nodes.push_back(node);
+    }
+
+    bvh.nodes.swap(nodes);
+    bvh.root= remap[bvh.root];
+}
+
+// ordre de construction initial : les fils sont places avant leur pere
+void postorder( const BVH& bvh, const int index, std::vector<int>& order )
+{
+    const Node& node= bvh.nodes[index];
+    if(node.internal())
+    {
+        postorder(bvh, node.internal_left(), order);
+        postorder(bvh, node.internal_right(), order);
+    }
+    order.push_back(index);
+}
+
+// ordre en largeur d'abord : les 2 fils sont voisins, mais loin de leur pere
+void breadthfirst( const BVH& bvh, std::vector<int>& order )
+{
+    std::deque<int> queue;
+    queue.push_back(bvh.root);
+    while(!queue.empty())
+    {
+        int index= queue.front();
+        queue.pop_front();
+        order.push_back(index);
+
+        const Node& node= bvh.nodes[index];
+        if(node.internal())
+        {
+            queue.push_back(node.internal_left());
+            queue.push_back(node.internal_right());
+        }
+    }
+}
+
+
+struct Result
+{
+    int hits;
+    double t;
+};
+
+// intersection la plus proche pour tous les rayons, avec un BVH ou un WideBVH
+template< typename T >
+Result closest( const T& bvh, const std::vector<Ray>& rays, std::vector<Hit>& hits )
+{
+    hits.resize(rays.size());
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    const int n= int(rays.size());
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(int i= 0; i < n; i++)
+        hits[i]= bvh.intersect(rays[i]);
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    double cpu= std::chrono::duration<double, std::milli>(stop - start).count();
+
+    Result result= { 0, cpu };
+    for(int i= 0; i < n; i++)
+        if(hits[i]) result.hits++;
+    return result;
+}
+
+// intersection quelconque pour tous les rayons
+template< typename T >
+Result occluded( const T& bvh, const std::vector<Ray>& rays, std::vector<int>& occluded )
+{
+    occluded.resize(rays.size());
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    const int n= int(rays.size());
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(int i= 0; i < n; i++)
+        occluded[i]= bvh.occluded(rays[i]);
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    double cpu= std::chrono::duration<double, std::milli>(stop - start).count();
+
+    Result result= { 0, cpu };
+    for(int i= 0; i < n; i++)
+        result.hits+= occluded[i];
+    return result;
+}
+
+template< typename T >
+Result occluded( const T& bvh, const std::vector<Ray>& rays )
+{
+    std::vector<int> occluded;
+    return ::occluded(bvh, rays, occluded);
+}
+
+void print( const char *name, const Result& result, const int n )
+{
+    printf("  %-24s %8.1fms %6.2f Mrays/s, %d hits\n", name, result.t, n / result.t / 1000, result.hits);
+}
+
+/* compare les intersections de chaque rayon avec celles du bvh binaire : meme triangle, a la meme distance, cf -ffp-contract=off et check_blocks().
+    renvoie le nombre de differences.
+ */
+int compare( const std::vector<Hit>& hits, const std::vector<Hit>& reference )
+{
+    int mismatch= 0;
+    for(int i= 0; i < int(reference.size()); i++)
+        if(hits[i].triangle_id != reference[i].triangle_id || hits[i].t != reference[i].t)
+            mismatch++;
+    return mismatch;
+}
+
+int compare( const std::vector<int>& occluded, const std::vector<int>& reference )
+{
+    int mismatch= 0;
+    for(int i= 0; i < int(reference.size()); i++)
+        if(bool(occluded[i]) != bool(reference[i]))
+            mismatch++;
+    return mismatch;
+}
+
+// affiche les performances d'un parcours et le nombre de rayons dont le resultat differe du bvh binaire
+void print( const char *name, const Result& result, const int n, const int mismatch )
+{
+    printf("  %-24s %8.1fms %6.2f Mrays/s, %d hits, %d mismatches\n", name, result.t, n / result.t / 1000, result.hits, mismatch);
+}
+
+/* compare les noyaux de test des englobants avec wide_box_scalar, avec un rayon vers le centre de chaque fils, et un rayon parallele a un axe,
+    dont l'origine est sur un plan de l'englobant : (pmin - o) * 1/d est nan, les noyaux doivent l'ignorer de la meme maniere.
+    renvoie le nombre de differences.
+ */
+template< typename K, int W, int B >
+int check_boxes( const char *name, const WideBVH<W, B>& wide, const Point& o )
+{
+    std::default_random_engine random(1);
+    std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+    int mismatch= 0;
+    for(int n= 0; n < int(wide.nodes.size()); n++)
+    {
+        const WideNode<W>& node= wide.nodes[n];
+        for(int i= 0; i < W; i++)
+        {
+            if(node.child[i] == -1)
+                continue;
+
+            Point pmin(node.bounds[0][0][i], node.bounds[0][1][i], node.bounds[0][2][i]);
+            Point pmax(node.bounds[1][0][i], node.bounds[1][1][i], node.bounds[1][2][i]);
+            Point center= pmin + (pmax - pmin) / 2;
+
+            // origine sur le plan pmin de l'axe, direction nulle sur cet axe
+            int axis= n % 3;
+            Point origin= center;
+            origin(axis)= pmin(axis);
+            Vector d(2 * u01(random) - 1, 2 * u01(random) - 1, 2 * u01(random) - 1);
+            d(axis)= 0;
+
+            Ray rays[]= { Ray(o, center), Ray(origin, d) };
+            for(const Ray& ray : rays)
+            {
+                WideRay wray(ray);
+                float scalar_tmin[W], tmin[W];
+                int scalar_mask= wide_box_scalar<W>::intersect(node, wray, FLT_MAX, scalar_tmin);
+                int mask= K::intersect(node, wray, FLT_MAX, tmin);
+
+                bool same= (mask == scalar_mask);
+                for(int k= 0; same && k < W; k++)
+                    same= !(mask & (1 << k)) || tmin[k] == scalar_tmin[k];
+                if(!same)
+                    mismatch++;
+            }
+        }
+    }
+
+    printf("  %-24s %d mismatches\n", name, mismatch);
+    return mismatch;
+}
+
+/* compare les noyaux de test des blocs de triangles avec Triangle::intersect(), avec un rayon vers un point de chaque triangle.
+    les resultats doivent etre identiques au bit pres : bvh_bench est compile sans fusionner les multiplications et les additions, cf -ffp-contract=off dans premake4.lua,
+    sinon Triangle::intersect(), cross() et dot() n'arrondissent pas les calculs comme les noyaux simd.
+    renvoie le nombre de rayons qui ne touchent pas le meme triangle, ou pas au meme point.
+ */
+template< typename T, int W, int B >
+int check_blocks( const char *name, const WideBVH<W, B>& wide, const Point& o )
+{
+    typedef WideBVH<W, B> Tree;
+    std::default_random_engine random(1);
+    std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+    int mismatch= 0;
+    float error= 0;
+    for(int b= 0; b < int(wide.blocks.size()); b++)
+    {
+        for(int r= 0; r < Tree::BLOCK; r++)
+        {
+            const Triangle& triangle= wide.triangles[b * Tree::BLOCK + r];
+            if(triangle.id == -1)
+                continue;
+
+            float u= u01(random);
+            float v= u01(random) * (1 - u);
+            Ray ray(o, triangle.p + u * triangle.e1 + v * triangle.e2);
+            ray.tmax= FLT_MAX;
+
+            Hit hit;
+            hit.t= ray.tmax;
+            for(int k= 0; k < Tree::BLOCK; k++)
+                if(Hit h= wide.triangles[b * Tree::BLOCK + k].intersect(ray, hit.t))
+                    hit= h;
+
+            Hit block;
+            block.t= ray.tmax;
+            T::intersect(wide.blocks[b], ray, block);
+
+            if(hit.triangle_id != block.triangle_id)
+                mismatch++;
+            else if(hit)
+            {
+                error= std::max(error, std::abs(hit.t - block.t));
+                if(hit.t != block.t || hit.u != block.u || hit.v != block.v)
+                    mismatch++;
+            }
+        }
+    }
+
+    printf("  %-24s %d mismatches, max error %g\n", name, mismatch, error);
+    return mismatch;
+}
+
+// resultats du bvh binaire, pour verifier les autres parcours
+struct Reference
+{
+    std::vector<Hit> primary;
+    std::vector<Hit> secondary;
+    std::vector<int> occluded;
+};
+
+// arbre a W fils et blocs de B triangles. renvoie le nombre de differences entre les noyaux, et avec le bvh binaire
+template< int W, int B >
+int bench_wide( const BVH& bvh, const std::vector<Ray>& primary, const std::vector<Ray>& secondary, const Reference& reference )
+{
+    typedef WideBVH<W, B> Tree;
+    Tree wide;
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+        wide.build(bvh);
+
+        auto stop= std::chrono::high_resolution_clock::now();
+        int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        printf("bvh%d, blocks of %d triangles, collapse %dms: %d nodes, %.2f children/node, %d triangles with padding, %s kernel\n", W, B, cpu,
+            int(wide.nodes.size()), wide.children(), int(wide.triangles.size()), wide.kernel_name(wide.best_kernel()));
+    }
+
+    int mismatch= 0;
+#ifdef WIDE_SIMD
+    printf("bvh%d boxes:\n", W);
+    if(wide.supported(Tree::SSE))
+        mismatch+= check_boxes<wide_box_sse<W> >("sse", wide, primary[0].o);
+    if(wide.supported(Tree::AVX))
+        mismatch+= check_boxes<wide_box_avx<W> >("avx", wide, primary[0].o);
+#endif
+
+    printf("bvh%d triangle blocks of %d:\n", W, B);
+    mismatch+= check_blocks<triangle_block_scalar<B> >("scalar", wide, primary[0].o);
+#ifdef WIDE_SIMD
+    if(wide.supported(Tree::SSE))
+        mismatch+= check_blocks<triangle_block_sse<B> >("sse", wide, primary[0].o);
+    if(wide.supported(Tree::AVX))
+        mismatch+= check_blocks<triangle_block_avx<B> >("avx", wide, primary[0].o);
+#endif
+
+    for(int k= Tree::SCALAR; k <= Tree::AVX; k++)
+    {
+        if(!wide.supported(k))
+            continue;
+
+        wide.kernel= k;
+        printf("bvh%d blocks of %d, %s:\n", W, B, wide.kernel_name(k));
+        std::vector<Hit> hits;
+        std::vector<int> hidden;
+        Result result= closest(wide, primary, hits);
+        int n= compare(hits, reference.primary);
+        print("primary closest", result, primary.size(), n);
+        mismatch+= n;
+
+        result= closest(wide, secondary, hits);
+        n= compare(hits, reference.secondary);
+        print("secondary closest", result, secondary.size(), n);
+        mismatch+= n;
+
+        result= occluded(wide, secondary, hidden);
+        n= compare(hidden, reference.occluded);
+        print("secondary occluded", result, secondary.size(), n);
+        mismatch+= n;
+    }
+    return mismatch;
+}
+
+// rayons primaires par paquets de 8, cf bvh_packet.h
+Result closest_packets( const BVH4& bvh, const PacketCamera& packets, std::vector<HitPacket, aligned_allocator<HitPacket, 32> >& hits )
+{
+    hits.resize(size_t(packets.tiles()) * packets.packets());
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    int n= 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+: n)
+    for(int tile= 0; tile < packets.tiles(); tile++)
+    for(int p= 0; p < packets.packets(); p++)
+    {
+        RayPacket packet;
+        packets.generate(tile, p, packet);
+
+        HitPacket& hit= hits[size_t(tile) * packets.packets() + p];
+        intersect(bvh, packet, hit);
+        for(int k= 0; k < RayPacket::SIZE; k++)
+            if(packet.active(k) && hit.triangle_id[k] != -1)
+                n++;
+    }
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    double cpu= std::chrono::duration<double, std::milli>(stop - start).count();
+
+    Result result= { n, cpu };
+    return result;
+}
+
+// compare les intersections des paquets avec celles des memes rayons, un par un. renvoie le nombre de differences
+int compare( const BVH4& bvh, const PacketCamera& packets, const std::vector<HitPacket, aligned_allocator<HitPacket, 32> >& hits )
+{
+    int mismatch= 0;
+    for(int tile= 0; tile < packets.tiles(); tile++)
+    for(int p= 0; p < packets.packets(); p++)
+    {
+        RayPacket packet;
+        packets.generate(tile, p, packet);
+
+        const HitPacket& hit= hits[size_t(tile) * packets.packets() + p];
+        for(int k= 0; k < RayPacket::SIZE; k++)
+        {
+            Hit reference= packet.active(k) ? bvh.intersect(packet.ray(k)) : Hit();
+            if(hit.triangle_id[k] != reference.triangle_id || hit.t[k] != reference.t)
+                mismatch++;
+        }
+    }
+    return mismatch;
+}
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    if(argc > 1)
+        mesh_filename= argv[1];
+
+    const char *orbiter_filename= "data/cornell_orbiter.txt";
+    if(argc > 2)
+        orbiter_filename= argv[2];
+
+    Orbiter camera;
+    if(camera.read_orbiter(orbiter_filename) < 0)
+        return 1;
+
+    Mesh mesh= read_mesh_fast(mesh_filename);
+    if(mesh == Mesh::error())
+        return 1;
+
+    BVH bvh;
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+        bvh.build(mesh);
+
+        auto stop= std::chrono::high_resolution_clock::now();
+        int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        printf("bvh build %dms: %d triangles\n", cpu, int(bvh.triangles.size()));
+        bvh.stats().print();
+    }
+
+    // meme arbre, construit en lisant le fichier par lots de triangles, sans le mesh, cf MeshStream
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+        MeshStream stream(mesh_filename);
+        BVH streamed;
+        streamed.build(stream);
+
+        auto stop= std::chrono::high_resolution_clock::now();
+        int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+
+        bool same= streamed.nodes.size() == bvh.nodes.size() && streamed.triangles.size() == bvh.triangles.size();
+        for(int i= 0; same && i < int(bvh.triangles.size()); i++)
+            same= streamed.triangles[i].id == bvh.triangles[i].id;
+        printf("bvh build from stream %dms (read + build), stream %.1fMB: %s\n", cpu, stream.memory() / float(1024*1024), same ? "same tree" : "[error] different trees");
+    }
+
+    // rayons primaires, coherents
+    const int width= 1024;
+    const int height= 768;
+    camera.projection(width, height, 45);
+    Transform inv= Inverse(camera.viewport() * camera.projection() * camera.view());
+
+    std::vector<Ray> primary;
+    for(int y= 0; y < height; y++)
+    for(int x= 0; x < width; x++)
+    {
+        Point origine= inv(Point(x + .5f, y + .5f, 0));
+        Point extremite= inv(Point(x + .5f, y + .5f, 1));
+        primary.push_back( Ray(origine, extremite) );
+    }
+
+    // rayons secondaires, incoherents : une direction aleatoire autour de la normale de chaque point visible.
+    // et rayons d'ombre : un segment entre chaque point visible et un point de l'englobant de la scene, comme vers une source
+    std::vector<Ray> secondary;
+    std::vector<Ray> shadow;
+    {
+        std::vector<Hit> hits;
+        closest(bvh, primary, hits);
+
+        Point pmin, pmax;
+        mesh.bounds(pmin, pmax);
+        std::default_random_engine shadow_random(2);
+        std::default_random_engine random(1);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+        for(int i= 0; i < int(hits.size()); i++)
+        {
+            if(!hits[i]) continue;
+
+            const TriangleData& data= mesh.triangle(hits[i].triangle_id);
+            Vector n= normalize(cross(Vector(data.a, data.b), Vector(data.a, data.c)));
+            if(dot(n, primary[i].d) > 0) n= -n;
+
+            Point p= primary[i].o + hits[i].t * primary[i].d + 0.001f * n;
+            // direction uniforme sur la sphere, retournee du cote de la normale
+            float z= 2 * u01(random) - 1;
+            float phi= float(2 * M_PI) * u01(random);
+            float r= std::sqrt(std::max(0.f, 1 - z*z));
+            Vector d(r * std::cos(phi), r * std::sin(phi), z);
+            if(dot(d, n) < 0) d= -d;
+
+            secondary.push_back( Ray(p, d) );
+
+            Point q= pmin + Vector(u01(shadow_random) * (pmax.x - pmin.x), u01(shadow_random) * (pmax.y - pmin.y), u01(shadow_random) * (pmax.z - pmin.z));
+            shadow.push_back( Ray(p, q) );
+            shadow.back().tmax= SHADOW_TMAX;
+        }
+    }
+    printf("%d primary rays, %d secondary rays, %d shadow rays\n", int(primary.size()), int(secondary.size()), int(shadow.size()));
+
+    // compare plusieurs organisations des noeuds, les arbres sont identiques, seul l'ordre des noeuds en memoire change
+    const char *names[]= { "depth first (flatten)", "post order (build)", "breadth first" };
+    for(int layout= 0; layout < 3; layout++)
+    {
+        BVH tree= bvh;
+        if(layout == 1)
+        {
+            std::vector<int> order;
+            postorder(bvh, bvh.root, order);
+            relayout(tree, order);
+        }
+        else if(layout == 2)
+        {
+            std::vector<int> order;
+            breadthfirst(bvh, order);
+            relayout(tree, order);
+        }
+
+        printf("%s:\n", names[layout]);
+        std::vector<Hit> hits;
+        print("primary closest", closest(tree, primary, hits), primary.size());
+        print("secondary closest", closest(tree, secondary, hits), secondary.size());
+        print("secondary occluded", occluded(tree, secondary), secondary.size());
+        print("shadow occluded", occluded(tree, shadow), shadow.size());
+    }
+
+    // arbres a 4 et 8 fils, blocs de 4 et 8 triangles, avec chaque noyau disponible sur ce processeur
+    Reference reference;
+    closest(bvh, primary, reference.primary);
+    closest(bvh, secondary, reference.secondary);
+    occluded(bvh, secondary, reference.occluded);
+
+    int mismatch= 0;
+    mismatch+= bench_wide<4, 4>(bvh, primary, secondary, reference);
+    mismatch+= bench_wide<4, 8>(bvh, primary, secondary, reference);
+    mismatch+= bench_wide<8, 4>(bvh, primary, secondary, reference);
+    mismatch+= bench_wide<8, 8>(bvh, primary, secondary, reference);
+
+    {
+        BVH4 wide;
+        wide.build(bvh);
+
+        PacketCamera packets(camera, width, height);
+        printf("bvh4 packets:\n");
+        std::vector<HitPacket, aligned_allocator<HitPacket, 32> > packet_hits;
+        Result result= closest_packets(wide, packets, packet_hits);
+        int n= compare(wide, packets, packet_hits);
+        print("primary closest", result, primary.size(), n);
+        mismatch+= n;
+    }
+
+    if(mismatch > 0)
+        printf("[error] %d mismatches between kernels, or with the binary bvh\n", mismatch);
+    return mismatch > 0 ? 1 : 0;
+}
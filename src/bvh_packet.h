@@ -0,0 +1,428 @@
+#ifndef _BVH_PACKET_H
+#define _BVH_PACKET_H
+
+#include <cfloat>
+#include <cassert>
+#include <algorithm>
+
+#include "mat.h"
+#include "orbiter.h"
+#include "bvh_wide.h"
+
+// paquets de 8 rayons coherents, les rayons primaires d'un bloc de 4x2 pixels, parcourus ensemble dans un WideBVH.
+// cf "interactive rendering with coherent ray tracing", I. Wald, 2001
+// et "large ray packets for real-time whitted ray tracing", R. Overbeck, 2008, pour le test par intervalles
+
+// paquet de rayons, ranges par composante
+struct alignas(32) RayPacket
+{
+    enum { SIZE= 8, WIDTH= 4, HEIGHT= 2 };    // 8 rayons, pour un bloc de 4x2 pixels
+
+    float ox[SIZE], oy[SIZE], oz[SIZE];
+    float dx[SIZE], dy[SIZE], dz[SIZE];
+    float tmax[SIZE];                       // intervalle [0 tmax], tmax < 0 pour un rayon inactif
+
+    void set( const int k, const Ray& ray )
+    {
+        ox[k]= ray.o.x; oy[k]= ray.o.y; oz[k]= ray.o.z;
+        dx[k]= ray.d.x; dy[k]= ray.d.y; dz[k]= ray.d.z;
+        tmax[k]= ray.tmax;
+    }
+
+    Ray ray( const int k ) const
+    {
+        Ray ray(Point(ox[k], oy[k], oz[k]), Vector(dx[k], dy[k], dz[k]));
+        ray.tmax= tmax[k];
+        return ray;
+    }
+
+    bool active( const int k ) const { return tmax[k] >= 0; }
+
+    // renvoie vrai si les directions des rayons ont le meme signe sur chaque axe, cf le test par intervalles
+    bool coherent( ) const
+    {
+        const float *d[3]= { dx, dy, dz };
+        for(int axis= 0; axis < 3; axis++)
+        for(int k= 0; k < SIZE; k++)
+        {
+            if(d[axis][k] == 0)
+                return false;
+            if((d[axis][k] < 0) != (d[axis][0] < 0))
+                return false;
+        }
+        return true;
+    }
+};
+
+// intersections des rayons d'un paquet
+struct alignas(32) HitPacket
+{
+    float t[RayPacket::SIZE];
+    float u[RayPacket::SIZE], v[RayPacket::SIZE];
+    int triangle_id[RayPacket::SIZE];
+
+    void set( const int k, const Hit& hit )
+    {
+        t[k]= hit.t;
+        u[k]= hit.u;
+        v[k]= hit.v;
+        triangle_id[k]= hit.triangle_id;
+    }
+
+    Hit hit( const int k ) const { return Hit(t[k], u[k], v[k], triangle_id[k]); }
+};
+
+
+// genere les paquets de rayons primaires d'une image, par tuiles de pixels
+struct PacketCamera
+{
+    Transform inv;      // passage du repere image vers le repere du monde
+    int width, height;
+    int tile;           // taille des tuiles, en pixels, un multiple de RayPacket::WIDTH et HEIGHT
+
+    enum { TILE= 16 };  // taille par defaut des tuiles
+
+    // la projection de la camera doit etre initialisee, cf Orbiter::projection(width, height, fov)
+    PacketCamera( const Orbiter& camera, const int _width, const int _height, const int _tile= TILE ) :
+        inv(Inverse(camera.viewport() * camera.projection() * camera.view())), width(_width), height(_height), tile(_tile)
+    {
+        assert(tile % RayPacket::WIDTH == 0 && tile % RayPacket::HEIGHT == 0);
+    }
+
+    // nombre de tuiles de l'image
+    int tiles( ) const { return tiles_x() * tiles_y(); }
+    int tiles_x( ) const { return (width + tile -1) / tile; }
+    int tiles_y( ) const { return (height + tile -1) / tile; }
+
+    // nombre de paquets d'une tuile
+    int packets( ) const { return (tile / RayPacket::WIDTH) * (tile / RayPacket::HEIGHT); }
+
+    // pixel du rayon k du paquet p de la tuile t
+    int x( const int t, const int p, const int k ) const
+    {
+        return (t % tiles_x()) * tile + (p % (tile / RayPacket::WIDTH)) * RayPacket::WIDTH + k % RayPacket::WIDTH;
+    }
+    int y( const int t, const int p, const int k ) const
+    {
+        return (t / tiles_x()) * tile + (p / (tile / RayPacket::WIDTH)) * RayPacket::HEIGHT + k / RayPacket::WIDTH;
+    }
+
+    // genere le paquet p de la tuile t, les rayons des pixels en dehors de l'image sont inactifs
+    void generate( const int t, const int p, RayPacket& packet ) const
+    {
+        for(int k= 0; k < RayPacket::SIZE; k++)
+        {
+            int px= x(t, p, k);
+            int py= y(t, p, k);
+            Point origine= inv(Point(px + .5f, py + .5f, 0));
+            Point extremite= inv(Point(px + .5f, py + .5f, 1));
+            packet.set(k, Ray(origine, extremite));
+
+            if(px >= width || py >= height)
+                packet.tmax[k]= -1;
+        }
+    }
+};
+
+
+#ifdef WIDE_SIMD
+/* test par intervalles : englobe les origines et les inverses des directions des rayons du paquet dans des intervalles,
+    et elimine les fils du noeud qui ne sont touches par aucun rayon, sans tester les rayons un par un.
+    les directions ont le meme signe, cf RayPacket::coherent(), le plan d'entree dans l'englobant est le meme pour tous les rayons.
+ */
+struct PacketInterval
+{
+    float omin[3], omax[3];
+    float imin[3], imax[3];
+    int near[3];
+    int far[3];
+
+    PacketInterval( const RayPacket& packet, const int mask )
+    {
+        const float *o[3]= { packet.ox, packet.oy, packet.oz };
+        const float *d[3]= { packet.dx, packet.dy, packet.dz };
+        for(int axis= 0; axis < 3; axis++)
+        {
+            omin[axis]= FLT_MAX; omax[axis]= -FLT_MAX;
+            imin[axis]= FLT_MAX; imax[axis]= -FLT_MAX;
+            for(int k= 0; k < RayPacket::SIZE; k++)
+            {
+                if(!(mask & (1 << k))) continue;
+
+                float invd= 1 / d[axis][k];
+                omin[axis]= std::min(omin[axis], o[axis][k]);
+                omax[axis]= std::max(omax[axis], o[axis][k]);
+                imin[axis]= std::min(imin[axis], invd);
+                imax[axis]= std::max(imax[axis], invd);
+            }
+
+            near[axis]= d[axis][0] < 0 ? 1 : 0;
+            far[axis]= 1 - near[axis];
+        }
+    }
+
+    // renvoie le masque des fils touches par au moins un rayon dans [0 htmax], htmax est la plus grande distance des rayons du paquet, cf intersect_packet_avx()
+    template< int W >
+    static inline WIDE_TARGET("avx") int intersect( const WideNode<W>& node, const PacketInterval& ray, const float htmax )
+    {
+        int mask= 0;
+        for(int i= 0; i < W; i+= 4)
+        {
+            __m128 t0= _mm_setzero_ps();
+            __m128 t1= _mm_set1_ps(htmax);
+            for(int axis= 0; axis < 3; axis++)
+            {
+                __m128 imin= _mm_set1_ps(ray.imin[axis]);
+                __m128 imax= _mm_set1_ps(ray.imax[axis]);
+
+                // produit d'intervalles : borne inf de la distance au plan d'entree, borne sup de la distance au plan de sortie
+                __m128 b= _mm_load_ps(&node.bounds[ray.near[axis]][axis][i]);
+                __m128 lo= _mm_sub_ps(b, _mm_set1_ps(ray.omax[axis]));
+                __m128 hi= _mm_sub_ps(b, _mm_set1_ps(ray.omin[axis]));
+                __m128 tnear= _mm_min_ps(_mm_min_ps(_mm_mul_ps(lo, imin), _mm_mul_ps(lo, imax)), _mm_min_ps(_mm_mul_ps(hi, imin), _mm_mul_ps(hi, imax)));
+
+                b= _mm_load_ps(&node.bounds[ray.far[axis]][axis][i]);
+                lo= _mm_sub_ps(b, _mm_set1_ps(ray.omax[axis]));
+                hi= _mm_sub_ps(b, _mm_set1_ps(ray.omin[axis]));
+                __m128 tfar= _mm_max_ps(_mm_max_ps(_mm_mul_ps(lo, imin), _mm_mul_ps(lo, imax)), _mm_max_ps(_mm_mul_ps(hi, imin), _mm_mul_ps(hi, imax)));
+
+                t0= _mm_max_ps(tnear, t0);
+                t1= _mm_min_ps(tfar, t1);
+            }
+
+            mask|= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+        }
+        return mask;
+    }
+};
+
+// rayons du paquet dans des registres avx
+struct PacketRays
+{
+    __m256 o[3];
+    __m256 d[3];
+    __m256 invd[3];
+    int near[3];
+    int far[3];
+
+    WIDE_TARGET("avx") PacketRays( const RayPacket& packet )
+    {
+        o[0]= _mm256_load_ps(packet.ox); o[1]= _mm256_load_ps(packet.oy); o[2]= _mm256_load_ps(packet.oz);
+        d[0]= _mm256_load_ps(packet.dx); d[1]= _mm256_load_ps(packet.dy); d[2]= _mm256_load_ps(packet.dz);
+        for(int axis= 0; axis < 3; axis++)
+        {
+            invd[axis]= _mm256_div_ps(_mm256_set1_ps(1), d[axis]);
+            near[axis]= packet.ray(0).d(axis) < 0 ? 1 : 0;
+            far[axis]= 1 - near[axis];
+        }
+    }
+};
+
+// teste les 8 rayons avec l'englobant du fils i, renvoie le masque des rayons qui le touchent et la plus petite distance d'entree
+template< int W >
+inline WIDE_TARGET("avx") int packet_box( const WideNode<W>& node, const int i, const PacketRays& rays, const float *t, const int active, float& tmin )
+{
+    __m256 t0= _mm256_setzero_ps();
+    __m256 t1= _mm256_load_ps(t);
+    for(int axis= 0; axis < 3; axis++)
+    {
+        __m256 tnear= _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[rays.near[axis]][axis][i]), rays.o[axis]), rays.invd[axis]);
+        __m256 tfar= _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bounds[rays.far[axis]][axis][i]), rays.o[axis]), rays.invd[axis]);
+        t0= _mm256_max_ps(tnear, t0);
+        t1= _mm256_min_ps(tfar, t1);
+    }
+
+    int mask= _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & active;
+
+    alignas(32) float tnear[RayPacket::SIZE];
+    _mm256_store_ps(tnear, t0);
+    tmin= FLT_MAX;
+    for(int k= 0; k < RayPacket::SIZE; k++)
+        if(mask & (1 << k))
+            tmin= std::min(tmin, tnear[k]);
+
+    return mask;
+}
+
+// teste les 8 rayons avec le triangle, cf Triangle::intersect(), et conserve les intersections plus proches
+inline WIDE_TARGET("avx") void packet_triangle( const Triangle& triangle, const PacketRays& rays, const int active, HitPacket& hits )
+{
+    __m256 e1[3]= { _mm256_set1_ps(triangle.e1.x), _mm256_set1_ps(triangle.e1.y), _mm256_set1_ps(triangle.e1.z) };
+    __m256 e2[3]= { _mm256_set1_ps(triangle.e2.x), _mm256_set1_ps(triangle.e2.y), _mm256_set1_ps(triangle.e2.z) };
+
+    // pvec= cross(d, e2)
+    __m256 pvec[3];
+    pvec[0]= _mm256_sub_ps(_mm256_mul_ps(rays.d[1], e2[2]), _mm256_mul_ps(rays.d[2], e2[1]));
+    pvec[1]= _mm256_sub_ps(_mm256_mul_ps(rays.d[2], e2[0]), _mm256_mul_ps(rays.d[0], e2[2]));
+    pvec[2]= _mm256_sub_ps(_mm256_mul_ps(rays.d[0], e2[1]), _mm256_mul_ps(rays.d[1], e2[0]));
+
+    __m256 det= _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], pvec[0]), _mm256_mul_ps(e1[1], pvec[1])), _mm256_mul_ps(e1[2], pvec[2]));
+    __m256 inv_det= _mm256_div_ps(_mm256_set1_ps(1), det);
+
+    // tvec= o - p
+    __m256 tvec[3]= {
+        _mm256_sub_ps(rays.o[0], _mm256_set1_ps(triangle.p.x)),
+        _mm256_sub_ps(rays.o[1], _mm256_set1_ps(triangle.p.y)),
+        _mm256_sub_ps(rays.o[2], _mm256_set1_ps(triangle.p.z)) };
+
+    __m256 u= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvec[0], pvec[0]), _mm256_mul_ps(tvec[1], pvec[1])), _mm256_mul_ps(tvec[2], pvec[2])), inv_det);
+
+    // qvec= cross(tvec, e1)
+    __m256 qvec[3];
+    qvec[0]= _mm256_sub_ps(_mm256_mul_ps(tvec[1], e1[2]), _mm256_mul_ps(tvec[2], e1[1]));
+    qvec[1]= _mm256_sub_ps(_mm256_mul_ps(tvec[2], e1[0]), _mm256_mul_ps(tvec[0], e1[2]));
+    qvec[2]= _mm256_sub_ps(_mm256_mul_ps(tvec[0], e1[1]), _mm256_mul_ps(tvec[1], e1[0]));
+
+    __m256 v= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rays.d[0], qvec[0]), _mm256_mul_ps(rays.d[1], qvec[1])), _mm256_mul_ps(rays.d[2], qvec[2])), inv_det);
+    __m256 t= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qvec[0]), _mm256_mul_ps(e2[1], qvec[1])), _mm256_mul_ps(e2[2], qvec[2])), inv_det);
+
+    // les comparaisons ordonnees rejettent aussi les nan, cas d'un triangle degenere
+    __m256 zero= _mm256_setzero_ps();
+    __m256 one= _mm256_set1_ps(1);
+    __m256 valid= _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+    valid= _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    valid= _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+    valid= _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+    valid= _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_load_ps(hits.t), _CMP_LE_OQ));
+
+    int mask= _mm256_movemask_ps(valid) & active;
+    if(mask == 0)
+        return;
+
+    alignas(32) float tt[RayPacket::SIZE], uu[RayPacket::SIZE], vv[RayPacket::SIZE];
+    _mm256_store_ps(tt, t);
+    _mm256_store_ps(uu, u);
+    _mm256_store_ps(vv, v);
+    for(int k= 0; k < RayPacket::SIZE; k++)
+        if(mask & (1 << k))
+            hits.set(k, Hit(tt[k], uu[k], vv[k], triangle.id));
+}
+
+// parcours du paquet dans l'arbre, les rayons sont coherents, cf RayPacket::coherent()
+template< int W, int B >
+WIDE_TARGET("avx") void intersect_packet_avx( const WideBVH<W, B>& bvh, const RayPacket& packet, HitPacket& hits )
+{
+    // en dessous de ce nombre de rayons actifs, les rayons parcourent le sous arbre un par un
+    const int min_rays= 2;
+
+    // comme WideBVH::intersect(), un rayon sans intersection renvoie t= tmax, et un rayon inactif renvoie Hit()
+    int active= 0;
+    for(int k= 0; k < RayPacket::SIZE; k++)
+    {
+        hits.set(k, Hit());
+        if(packet.active(k))
+        {
+            hits.t[k]= packet.tmax[k];
+            active|= 1 << k;
+        }
+    }
+    if(active == 0 || bvh.root < 0)
+        return;
+
+    PacketRays rays(packet);
+    PacketInterval interval(packet, active);
+
+    // fils en attente de visite, masque des rayons qui touchent son englobant, et plus petite distance d'entree
+    struct Entry
+    {
+        int child;
+        int count;
+        int mask;
+        float tmin;
+    };
+
+    enum { STACK_SIZE= WideBVH<W, B>::STACK_SIZE };
+    Entry stack[STACK_SIZE];
+    int top= 0;
+
+    stack[top++]= { bvh.root, 0, active, 0 };
+    while(top > 0)
+    {
+        Entry entry= stack[--top];
+
+        // plus grande distance des intersections deja trouvees, ou tmax des rayons sans intersection : limite le test des fils, cf PacketInterval::intersect()
+        float tmax= 0;
+        for(int k= 0; k < RayPacket::SIZE; k++)
+            if(entry.mask & (1 << k))
+                tmax= std::max(tmax, hits.t[k]);
+        if(entry.tmin > tmax)
+            continue;
+
+        if(entry.count > 0)
+        {
+            for(int i= entry.child; i < entry.child + entry.count; i++)
+                packet_triangle(bvh.triangles[i], rays, entry.mask, hits);
+            RAY_STAT(triangles, entry.count);
+            continue;
+        }
+
+        if(__builtin_popcount(entry.mask) < min_rays)
+        {
+            // le paquet diverge, termine le parcours du sous arbre rayon par rayon
+            for(int k= 0; k < RayPacket::SIZE; k++)
+            {
+                if(!(entry.mask & (1 << k))) continue;
+
+                Ray ray= packet.ray(k);
+                ray.tmax= hits.t[k];
+                if(Hit hit= bvh.intersect(ray, entry.child))
+                    hits.set(k, hit);
+            }
+            continue;
+        }
+
+        const WideNode<W>& node= bvh.nodes[entry.child];
+        RAY_STAT(nodes, 1);
+        // elimine les fils qui ne sont touches par aucun rayon, puis teste les rayons un par un, en parallele
+        int children= PacketInterval::intersect(node, interval, tmax);
+        int first= top;
+        for(int i= 0; i < W; i++)
+        {
+            if(!(children & (1 << i)) || node.child[i] == -1)
+                continue;
+
+            float tmin;
+            int mask= packet_box(node, i, rays, hits.t, entry.mask, tmin);
+            if(mask == 0)
+                continue;
+
+            // empile les fils tries par distance decroissante
+            Entry child= { node.child[i], node.count[i], mask, tmin };
+            int k= top++;
+            assert(top <= STACK_SIZE);
+            for(; k > first && stack[k -1].tmin < child.tmin; k--)
+                stack[k]= stack[k -1];
+            stack[k]= child;
+        }
+    }
+}
+#endif
+
+// intersections les plus proches des rayons du paquet.
+// le parcours en paquet utilise avx, les paquets incoherents et les processeurs sans avx utilisent le parcours rayon par rayon.
+template< int W, int B >
+void intersect( const WideBVH<W, B>& bvh, const RayPacket& packet, HitPacket& hits )
+{
+#ifdef WIDE_SIMD
+    if(__builtin_cpu_supports("avx") && packet.coherent())
+        intersect_packet_avx(bvh, packet, hits);
+    else
+#endif
+    for(int k= 0; k < RayPacket::SIZE; k++)
+    {
+        if(packet.active(k))
+            hits.set(k, bvh.intersect(packet.ray(k), bvh.root));
+        else
+            hits.set(k, Hit());
+    }
+
+#ifdef RAY_STATS
+    for(int k= 0; k < RayPacket::SIZE; k++)
+    {
+        RAY_STAT(packets, packet.active(k) ? 1 : 0);
+        RAY_STAT(hits, bool(hits.hit(k)));
+    }
+#endif
+}
+
+#endif
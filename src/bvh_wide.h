@@ -0,0 +1,775 @@
+#ifndef _BVH_WIDE_H
+#define _BVH_WIDE_H
+
+#include <vector>
+#include <cfloat>
+#include <cassert>
+
+#include "bvh.h"
+
+// bvh a 4 ou 8 fils par noeud, construit en aplatissant un BVH binaire, cf WideBVH::build()
+// les englobants des fils sont testes ensemble, avec les instructions sse ou avx, le noyau est choisi a l'execution en fonction du processeur.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define WIDE_SIMD
+    #define WIDE_TARGET(isa) __attribute__((target(isa)))
+    // le parcours et le noyau sont inline dans les fonctions compilees pour sse / avx, cf WideBVH::intersect_avx()
+    #define WIDE_FLATTEN __attribute__((flatten))
+#endif
+
+
+// noeud a W fils : les englobants des fils sont ranges par axe, bounds[0][axis][i] est le min du fils i sur l'axe, bounds[1][axis][i] le max
+template< int W >
+struct alignas(32) WideNode
+{
+    float bounds[2][3][W];
+    int child[W];       // indice du noeud fils, ou du premier triangle d'une feuille
+    int count[W];       // nombre de triangles de la feuille, 0 pour un noeud interne
+
+    // fils absent : englobant vide, jamais touche par un rayon
+    void clear( const int i )
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            bounds[0][axis][i]= FLT_MAX;
+            bounds[1][axis][i]= -FLT_MAX;
+        }
+        child[i]= -1;
+        count[i]= 0;
+    }
+
+    void set( const int i, const BBox& box, const int _child, const int _count )
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            bounds[0][axis][i]= box.pmin(axis);
+            bounds[1][axis][i]= box.pmax(axis);
+        }
+        child[i]= _child;
+        count[i]= _count;
+    }
+};
+
+static_assert(sizeof(WideNode<4>) == 128, "WideNode<4> layout");
+static_assert(sizeof(WideNode<8>) == 256, "WideNode<8> layout");
+
+
+// N triangles ranges par composante, cf Triangle. les triangles absents ont des aretes nulles et ne sont jamais touches
+template< int N >
+struct alignas(32) TriangleBlock
+{
+    float p[3][N];
+    float e1[3][N];
+    float e2[3][N];
+    int id[N];
+
+    void set( const int k, const Triangle& triangle )
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            p[axis][k]= triangle.p(axis);
+            e1[axis][k]= triangle.e1(axis);
+            e2[axis][k]= triangle.e2(axis);
+        }
+        id[k]= triangle.id;
+    }
+
+    void clear( const int k )
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            p[axis][k]= 0;
+            e1[axis][k]= 0;
+            e2[axis][k]= 0;
+        }
+        id[k]= -1;
+    }
+};
+
+static_assert(sizeof(TriangleBlock<4>) == 160, "TriangleBlock<4> layout");
+static_assert(sizeof(TriangleBlock<8>) == 320, "TriangleBlock<8> layout");
+
+
+// rayon prepare pour les tests d'englobants
+struct WideRay
+{
+    float o[3];
+    float invd[3];
+    int near[3];        // 0 ou 1, selon le signe de la direction : plan d'entree dans l'englobant, cf WideNode::bounds
+    int far[3];
+
+    WideRay( const Ray& ray )
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            o[axis]= ray.o(axis);
+            invd[axis]= 1 / ray.d(axis);
+            near[axis]= ray.d(axis) < 0 ? 1 : 0;
+            far[axis]= 1 - near[axis];
+        }
+    }
+};
+
+
+/* noyaux de test des englobants des fils d'un noeud.
+    renvoie un masque, le bit i est a 1 si le rayon touche l'englobant du fils i dans l'intervalle [0 htmax],
+    et tmin[i] la distance d'entree dans l'englobant.
+ */
+template< int W >
+struct wide_box_scalar
+{
+    static inline int intersect( const WideNode<W>& node, const WideRay& ray, const float htmax, float *tmin )
+    {
+        int mask= 0;
+        for(int i= 0; i < W; i++)
+        {
+            float t0= 0;
+            float t1= htmax;
+            for(int axis= 0; axis < 3; axis++)
+            {
+                float tnear= (node.bounds[ray.near[axis]][axis][i] - ray.o[axis]) * ray.invd[axis];
+                float tfar= (node.bounds[ray.far[axis]][axis][i] - ray.o[axis]) * ray.invd[axis];
+                // meme ordre des operandes que _mm_max_ps() / _mm_min_ps() : garde t0 / t1 si tnear / tfar est nan,
+                // origine sur un plan de l'englobant et direction nulle. std::max() renverrait le nan.
+                t0= (tnear > t0) ? tnear : t0;
+                t1= (tfar < t1) ? tfar : t1;
+            }
+
+            tmin[i]= t0;
+            if(t0 <= t1)
+                mask|= 1 << i;
+        }
+        return mask;
+    }
+};
+
+/* noyaux de test d'un bloc de triangles, cf Triangle::intersect().
+    les N triangles sont testes sans branchement, puis hit est remplace par l'intersection la plus proche, si elle existe dans [0 hit.t].
+    a distance egale, le dernier triangle du bloc est garde, comme avec un test triangle par triangle.
+ */
+template< int N >
+struct triangle_block_scalar
+{
+    static inline bool intersect( const TriangleBlock<N>& block, const Ray& ray, Hit& hit )
+    {
+        bool touch= false;
+        for(int k= 0; k < N; k++)
+        {
+            Vector e1(block.e1[0][k], block.e1[1][k], block.e1[2][k]);
+            Vector e2(block.e2[0][k], block.e2[1][k], block.e2[2][k]);
+            Vector pvec= cross(ray.d, e2);
+            float inv_det= 1 / dot(e1, pvec);
+
+            Vector tvec(Point(block.p[0][k], block.p[1][k], block.p[2][k]), ray.o);
+            Vector qvec= cross(tvec, e1);
+            float u= dot(tvec, pvec) * inv_det;
+            float v= dot(ray.d, qvec) * inv_det;
+            float t= dot(e2, qvec) * inv_det;
+
+            // ecrit pour rejeter aussi les nan
+            bool valid= (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1) & (t >= 0) & (t <= hit.t);
+            if(valid)
+                hit= Hit(t, u, v, block.id[k]);
+            touch|= valid;
+        }
+        return touch;
+    }
+};
+
+#ifdef WIDE_SIMD
+// 4 triangles a la fois
+template< int N >
+struct triangle_block_sse
+{
+    static_assert(N % 4 == 0, "triangle_block_sse");
+
+    static inline WIDE_TARGET("sse2") bool intersect( const TriangleBlock<N>& block, const Ray& ray, Hit& hit )
+    {
+        bool touch= false;
+        for(int i= 0; i < N; i+= 4)
+        {
+            __m128 d[3]= { _mm_set1_ps(ray.d.x), _mm_set1_ps(ray.d.y), _mm_set1_ps(ray.d.z) };
+            __m128 e1[3]= { _mm_load_ps(&block.e1[0][i]), _mm_load_ps(&block.e1[1][i]), _mm_load_ps(&block.e1[2][i]) };
+            __m128 e2[3]= { _mm_load_ps(&block.e2[0][i]), _mm_load_ps(&block.e2[1][i]), _mm_load_ps(&block.e2[2][i]) };
+
+            // pvec= cross(d, e2)
+            __m128 pvec[3]= {
+                _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+                _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+                _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0])) };
+            __m128 det= _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], pvec[0]), _mm_mul_ps(e1[1], pvec[1])), _mm_mul_ps(e1[2], pvec[2]));
+            __m128 inv_det= _mm_div_ps(_mm_set1_ps(1), det);
+
+            // tvec= o - p
+            __m128 tvec[3]= {
+                _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_load_ps(&block.p[0][i])),
+                _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_load_ps(&block.p[1][i])),
+                _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_load_ps(&block.p[2][i])) };
+            // qvec= cross(tvec, e1)
+            __m128 qvec[3]= {
+                _mm_sub_ps(_mm_mul_ps(tvec[1], e1[2]), _mm_mul_ps(tvec[2], e1[1])),
+                _mm_sub_ps(_mm_mul_ps(tvec[2], e1[0]), _mm_mul_ps(tvec[0], e1[2])),
+                _mm_sub_ps(_mm_mul_ps(tvec[0], e1[1]), _mm_mul_ps(tvec[1], e1[0])) };
+
+            __m128 u= _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvec[0], pvec[0]), _mm_mul_ps(tvec[1], pvec[1])), _mm_mul_ps(tvec[2], pvec[2])), inv_det);
+            __m128 v= _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qvec[0]), _mm_mul_ps(d[1], qvec[1])), _mm_mul_ps(d[2], qvec[2])), inv_det);
+            __m128 t= _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qvec[0]), _mm_mul_ps(e2[1], qvec[1])), _mm_mul_ps(e2[2], qvec[2])), inv_det);
+
+            // comparaisons ordonnees, fausses pour les nan
+            __m128 zero= _mm_setzero_ps();
+            __m128 one= _mm_set1_ps(1);
+            __m128 valid= _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+            valid= _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+            valid= _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            valid= _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+            valid= _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(hit.t)));
+            int mask= _mm_movemask_ps(valid);
+            if(mask == 0)
+                continue;
+
+            // plus petite distance des triangles touches
+            __m128 tvalid= _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(FLT_MAX)));
+            __m128 tmin= _mm_min_ps(tvalid, _mm_shuffle_ps(tvalid, tvalid, _MM_SHUFFLE(2, 3, 0, 1)));
+            tmin= _mm_min_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+            mask&= _mm_movemask_ps(_mm_cmpeq_ps(tvalid, tmin));
+
+            // dernier triangle a cette distance
+            int k= 3;
+            while(!(mask & (1 << k)))
+                k--;
+
+            alignas(16) float tt[4], uu[4], vv[4];
+            _mm_store_ps(tt, t);
+            _mm_store_ps(uu, u);
+            _mm_store_ps(vv, v);
+            hit= Hit(tt[k], uu[k], vv[k], block.id[i + k]);
+            touch= true;
+        }
+        return touch;
+    }
+};
+
+// 8 triangles a la fois, les blocs de 4 triangles utilisent les instructions sse, encodees en avx, cf WideBVH<W, 8>
+template< int N >
+struct triangle_block_avx
+{
+    static inline WIDE_TARGET("avx") bool intersect( const TriangleBlock<N>& block, const Ray& ray, Hit& hit )
+    {
+        if(N % 8 != 0)
+            return triangle_block_sse<N>::intersect(block, ray, hit);
+
+        bool touch= false;
+        for(int i= 0; i < N; i+= 8)
+        {
+            __m256 d[3]= { _mm256_set1_ps(ray.d.x), _mm256_set1_ps(ray.d.y), _mm256_set1_ps(ray.d.z) };
+            __m256 e1[3]= { _mm256_load_ps(&block.e1[0][i]), _mm256_load_ps(&block.e1[1][i]), _mm256_load_ps(&block.e1[2][i]) };
+            __m256 e2[3]= { _mm256_load_ps(&block.e2[0][i]), _mm256_load_ps(&block.e2[1][i]), _mm256_load_ps(&block.e2[2][i]) };
+
+            __m256 pvec[3]= {
+                _mm256_sub_ps(_mm256_mul_ps(d[1], e2[2]), _mm256_mul_ps(d[2], e2[1])),
+                _mm256_sub_ps(_mm256_mul_ps(d[2], e2[0]), _mm256_mul_ps(d[0], e2[2])),
+                _mm256_sub_ps(_mm256_mul_ps(d[0], e2[1]), _mm256_mul_ps(d[1], e2[0])) };
+            __m256 det= _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], pvec[0]), _mm256_mul_ps(e1[1], pvec[1])), _mm256_mul_ps(e1[2], pvec[2]));
+            __m256 inv_det= _mm256_div_ps(_mm256_set1_ps(1), det);
+
+            __m256 tvec[3]= {
+                _mm256_sub_ps(_mm256_set1_ps(ray.o.x), _mm256_load_ps(&block.p[0][i])),
+                _mm256_sub_ps(_mm256_set1_ps(ray.o.y), _mm256_load_ps(&block.p[1][i])),
+                _mm256_sub_ps(_mm256_set1_ps(ray.o.z), _mm256_load_ps(&block.p[2][i])) };
+            __m256 qvec[3]= {
+                _mm256_sub_ps(_mm256_mul_ps(tvec[1], e1[2]), _mm256_mul_ps(tvec[2], e1[1])),
+                _mm256_sub_ps(_mm256_mul_ps(tvec[2], e1[0]), _mm256_mul_ps(tvec[0], e1[2])),
+                _mm256_sub_ps(_mm256_mul_ps(tvec[0], e1[1]), _mm256_mul_ps(tvec[1], e1[0])) };
+
+            __m256 u= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvec[0], pvec[0]), _mm256_mul_ps(tvec[1], pvec[1])), _mm256_mul_ps(tvec[2], pvec[2])), inv_det);
+            __m256 v= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], qvec[0]), _mm256_mul_ps(d[1], qvec[1])), _mm256_mul_ps(d[2], qvec[2])), inv_det);
+            __m256 t= _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qvec[0]), _mm256_mul_ps(e2[1], qvec[1])), _mm256_mul_ps(e2[2], qvec[2])), inv_det);
+
+            __m256 zero= _mm256_setzero_ps();
+            __m256 one= _mm256_set1_ps(1);
+            __m256 valid= _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+            valid= _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+            valid= _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+            valid= _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+            valid= _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(hit.t), _CMP_LE_OQ));
+            int mask= _mm256_movemask_ps(valid);
+            if(mask == 0)
+                continue;
+
+            __m256 tvalid= _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, valid);
+            __m256 tmin= _mm256_min_ps(tvalid, _mm256_permute2f128_ps(tvalid, tvalid, 1));
+            tmin= _mm256_min_ps(tmin, _mm256_shuffle_ps(tmin, tmin, _MM_SHUFFLE(2, 3, 0, 1)));
+            tmin= _mm256_min_ps(tmin, _mm256_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+            mask&= _mm256_movemask_ps(_mm256_cmp_ps(tvalid, tmin, _CMP_EQ_OQ));
+
+            int k= 7;
+            while(!(mask & (1 << k)))
+                k--;
+
+            alignas(32) float tt[8], uu[8], vv[8];
+            _mm256_store_ps(tt, t);
+            _mm256_store_ps(uu, u);
+            _mm256_store_ps(vv, v);
+            hit= Hit(tt[k], uu[k], vv[k], block.id[i + k]);
+            touch= true;
+        }
+        return touch;
+    }
+};
+
+// 4 englobants a la fois
+template< int W >
+struct wide_box_sse
+{
+    static_assert(W % 4 == 0, "wide_box_sse");
+
+    static inline WIDE_TARGET("sse2") int intersect( const WideNode<W>& node, const WideRay& ray, const float htmax, float *tmin )
+    {
+        int mask= 0;
+        for(int i= 0; i < W; i+= 4)
+        {
+            __m128 t0= _mm_setzero_ps();
+            __m128 t1= _mm_set1_ps(htmax);
+            for(int axis= 0; axis < 3; axis++)
+            {
+                __m128 o= _mm_set1_ps(ray.o[axis]);
+                __m128 invd= _mm_set1_ps(ray.invd[axis]);
+                __m128 tnear= _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[ray.near[axis]][axis][i]), o), invd);
+                __m128 tfar= _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[ray.far[axis]][axis][i]), o), invd);
+                // renvoie le 2ieme operande si le premier est nan : une direction nulle ne limite pas l'intervalle
+                t0= _mm_max_ps(tnear, t0);
+                t1= _mm_min_ps(tfar, t1);
+            }
+
+            _mm_storeu_ps(tmin + i, t0);
+            mask|= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+        }
+        return mask;
+    }
+};
+
+// 8 englobants a la fois, les noeuds a 4 fils utilisent les instructions sse, encodees en avx
+template< int W >
+struct wide_box_avx
+{
+    static inline WIDE_TARGET("avx") int intersect( const WideNode<W>& node, const WideRay& ray, const float htmax, float *tmin )
+    {
+        if(W % 8 != 0)
+            return wide_box_sse<W>::intersect(node, ray, htmax, tmin);
+
+        int mask= 0;
+        for(int i= 0; i < W; i+= 8)
+        {
+            __m256 t0= _mm256_setzero_ps();
+            __m256 t1= _mm256_set1_ps(htmax);
+            for(int axis= 0; axis < 3; axis++)
+            {
+                __m256 o= _mm256_set1_ps(ray.o[axis]);
+                __m256 invd= _mm256_set1_ps(ray.invd[axis]);
+                __m256 tnear= _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&node.bounds[ray.near[axis]][axis][i]), o), invd);
+                __m256 tfar= _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&node.bounds[ray.far[axis]][axis][i]), o), invd);
+                t0= _mm256_max_ps(tnear, t0);
+                t1= _mm256_min_ps(tfar, t1);
+            }
+
+            _mm256_storeu_ps(tmin + i, t0);
+            mask|= _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) << i;
+        }
+        return mask;
+    }
+};
+#endif
+
+
+/* W : nombre de fils par noeud, B : nombre de triangles par bloc, 4 ou 8.
+    les blocs de 8 triangles sont testes en une fois par le noyau avx, mais completent les feuilles avec plus de triangles absents, cf leaf().
+ */
+template< int W, int B= 4 >
+struct WideBVH
+{
+    static_assert(W % 4 == 0, "WideBVH");
+    static_assert(B % 4 == 0, "WideBVH");
+
+    enum { BLOCK= B };  // nombre de triangles par bloc
+
+    std::vector<WideNode<W>, aligned_allocator<WideNode<W>, 32> > nodes;
+    std::vector<Triangle> triangles;    // triangles des feuilles, chaque feuille commence sur un bloc
+    std::vector<TriangleBlock<BLOCK>, aligned_allocator<TriangleBlock<BLOCK>, 32> > blocks;    // les memes triangles, par blocs
+    int root;
+
+    enum { SCALAR= 0, SSE, AVX };
+    int kernel;         // noyau utilise par intersect() et occluded(), cf best_kernel()
+
+    WideBVH( ) : nodes(), triangles(), blocks(), root(-1), kernel(best_kernel()) {}
+
+    // noyau le plus rapide disponible sur ce processeur, pour des noeuds a W fils
+    static int best_kernel( )
+    {
+    #ifdef WIDE_SIMD
+        if(__builtin_cpu_supports("avx"))
+            return AVX;
+        if(__builtin_cpu_supports("sse2"))
+            return SSE;
+    #endif
+        return SCALAR;
+    }
+
+    // renvoie vrai si le noyau peut etre utilise sur ce processeur
+    static bool supported( const int k )
+    {
+        if(k == SCALAR)
+            return true;
+    #ifdef WIDE_SIMD
+        if(k == SSE)
+            return __builtin_cpu_supports("sse2");
+        if(k == AVX)
+            return __builtin_cpu_supports("avx");
+    #endif
+        return false;
+    }
+
+    static const char *kernel_name( const int k )
+    {
+        const char *names[]= { "scalar", "sse", "avx" };
+        return names[k];
+    }
+
+    /* construit l'arbre a partir d'un bvh binaire, les feuilles ne changent pas.
+        les noeuds internes sont regroupes : les fils d'un noeud sont obtenus en remplacant le fils interne avec le plus grand englobant
+        par ses 2 fils, jusqu'a en obtenir W, cf "shallow bounding volume hierarchies for fast simd ray tracing of incoherent rays", H. Dammertz, 2008
+     */
+    int build( const BVH& bvh )
+    {
+        nodes.clear();
+        triangles.clear();
+        blocks.clear();
+        root= -1;
+        if(bvh.root < 0)
+            return root;
+
+        const Node& node= bvh.nodes[bvh.root];
+        if(node.leaf())
+        {
+            // une seule feuille, construit une racine avec un seul fils
+            WideNode<W> wide;
+            for(int i= 0; i < W; i++)
+                wide.clear(i);
+            wide.set(0, node.bounds, leaf(bvh, node), node.leaf_end() - node.leaf_begin());
+            nodes.push_back(wide);
+            root= 0;
+        }
+        else
+            root= build(bvh, bvh.root);
+
+        return root;
+    }
+
+    // nombre moyen de fils par noeud
+    float children( ) const
+    {
+        int n= 0;
+        for(int k= 0; k < int(nodes.size()); k++)
+        for(int i= 0; i < W; i++)
+            if(nodes[k].child[i] != -1)
+                n++;
+
+        return float(n) / std::max(1, int(nodes.size()));
+    }
+
+    // renvoie l'intersection la plus proche de l'origine du rayon, dans l'intervalle [0 ray.tmax]
+    Hit intersect( const Ray& ray ) const
+    {
+        Hit hit= intersect(ray, root);
+        RAY_STAT(closest, 1);
+        RAY_STAT(hits, bool(hit));
+        return hit;
+    }
+
+    // parcours le sous arbre du noeud interne index, cf les paquets de rayons dans bvh_packet.h
+    Hit intersect( const Ray& ray, const int index ) const
+    {
+    #ifdef WIDE_SIMD
+        if(kernel == AVX)
+            return intersect_avx(ray, index);
+        if(kernel == SSE)
+            return intersect_sse(ray, index);
+    #endif
+        return intersect<wide_box_scalar<W>, triangle_block_scalar<BLOCK> >(ray, index);
+    }
+
+    // renvoie vrai des qu'une intersection est trouvee dans l'intervalle [0 ray.tmax], sans chercher la plus proche
+    bool occluded( const Ray& ray ) const
+    {
+        bool hidden= occluded(ray, root);
+        RAY_STAT(occluded, 1);
+        RAY_STAT(hits, hidden);
+        return hidden;
+    }
+
+    // parcours le sous arbre du noeud interne index, cf intersect( ray, index )
+    bool occluded( const Ray& ray, const int index ) const
+    {
+    #ifdef WIDE_SIMD
+        if(kernel == AVX)
+            return occluded_avx(ray, index);
+        if(kernel == SSE)
+            return occluded_sse(ray, index);
+    #endif
+        return occluded<wide_box_scalar<W>, triangle_block_scalar<BLOCK> >(ray, index);
+    }
+
+    // renvoie vrai des qu'une intersection est trouvee dans l'intervalle [0 tmax] du rayon
+    bool occluded( const Ray& ray, const float tmax ) const
+    {
+        Ray r= ray;
+        r.tmax= tmax;
+        return occluded(r);
+    }
+
+    // renvoie vrai si le segment [origin target] est occulte, cf BVH::occluded( origin, target )
+    bool occluded( const Point& origin, const Point& target ) const
+    {
+        return occluded(Ray(origin, target), SHADOW_TMAX);
+    }
+
+    // rayons d'ombre depuis le meme point : hidden[i]= 1 si le segment [origin targets[i]] est occulte. renvoie le nombre de segments occultes.
+    // le noyau n'est choisi qu'une fois pour tous les rayons
+    int occluded( const Point& origin, const std::vector<Point>& targets, std::vector<int>& hidden ) const
+    {
+        hidden.resize(targets.size());
+    #ifdef WIDE_SIMD
+        if(kernel == AVX)
+            return occluded_avx(origin, targets, hidden);
+        if(kernel == SSE)
+            return occluded_sse(origin, targets, hidden);
+    #endif
+        return occluded<wide_box_scalar<W>, triangle_block_scalar<BLOCK> >(origin, targets, hidden);
+    }
+
+    // taille de la pile de parcours : au plus W-1 fils en attente par niveau, cf BVH::MAX_DEPTH
+    enum { STACK_SIZE= BVH::MAX_DEPTH * (W -1) + 1 };
+
+protected:
+    // fils en attente de visite, noeud interne ou feuille, et distance a son englobant
+    struct Entry
+    {
+        int child;
+        int count;
+        float tmin;
+    };
+
+    // copie les triangles de la feuille, a la suite des autres, et complete son dernier bloc. renvoie l'indice du premier triangle.
+    int leaf( const BVH& bvh, const Node& node )
+    {
+        int begin= triangles.size();
+        assert(begin % BLOCK == 0);
+        for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
+        {
+            if(triangles.size() % BLOCK == 0)
+            {
+                blocks.emplace_back();
+                for(int k= 0; k < BLOCK; k++)
+                    blocks.back().clear(k);
+            }
+
+            blocks.back().set(triangles.size() % BLOCK, bvh.triangles[i]);
+            triangles.push_back(bvh.triangles[i]);
+        }
+
+        // triangles absents : aretes nulles, jamais touches, cf TriangleBlock
+        while(triangles.size() % BLOCK)
+        {
+            Triangle triangle= bvh.triangles[node.leaf_begin()];
+            triangle.e1= Vector(0, 0, 0);
+            triangle.e2= Vector(0, 0, 0);
+            triangle.id= -1;
+            triangle.aire= 0;
+            triangles.push_back(triangle);
+        }
+
+        return begin;
+    }
+
+    // regroupe le sous arbre du noeud interne index, et renvoie l'indice du noeud construit. les noeuds sont ranges en profondeur d'abord.
+    int build( const BVH& bvh, const int index )
+    {
+        int children[W];
+        int n= 0;
+        children[n++]= bvh.nodes[index].internal_left();
+        children[n++]= bvh.nodes[index].internal_right();
+        while(n < W)
+        {
+            // remplace le fils interne avec le plus grand englobant par ses 2 fils
+            int best= -1;
+            float best_area= -1;
+            for(int i= 0; i < n; i++)
+            {
+                const Node& node= bvh.nodes[children[i]];
+                if(node.internal() && node.bounds.area() > best_area)
+                {
+                    best= i;
+                    best_area= node.bounds.area();
+                }
+            }
+            if(best < 0)
+                break;      // que des feuilles...
+
+            const Node& node= bvh.nodes[children[best]];
+            children[best]= node.internal_left();
+            children[n++]= node.internal_right();
+        }
+
+        int id= nodes.size();
+        nodes.push_back(WideNode<W>());
+
+        // construit les fils, la construction ajoute des noeuds, nodes[id] n'est ecrit qu'a la fin
+        WideNode<W> wide;
+        for(int i= 0; i < W; i++)
+            wide.clear(i);
+        for(int i= 0; i < n; i++)
+        {
+            const Node& node= bvh.nodes[children[i]];
+            if(node.leaf())
+                wide.set(i, node.bounds, leaf(bvh, node), node.leaf_end() - node.leaf_begin());
+            else
+                wide.set(i, node.bounds, build(bvh, children[i]), 0);
+        }
+
+        nodes[id]= wide;
+        return id;
+    }
+
+    template< typename K, typename T >
+    Hit intersect( const Ray& ray, const int index ) const
+    {
+        Hit hit;
+        hit.t= ray.tmax;
+        if(index < 0) return hit;
+
+        WideRay wray(ray);
+        Entry stack[STACK_SIZE];
+        int top= 0;
+
+        stack[top++]= { index, 0, 0 };
+        while(top > 0)
+        {
+            // reprend le parcours avec le prochain fils de la pile, s'il est plus proche que l'intersection trouvee
+            Entry entry= stack[--top];
+            if(entry.tmin > hit.t)
+                continue;
+
+            if(entry.count > 0)
+            {
+                for(int b= entry.child / BLOCK; b < (entry.child + entry.count + BLOCK -1) / BLOCK; b++)
+                    T::intersect(blocks[b], ray, hit);
+                RAY_STAT(triangles, (entry.count + BLOCK -1) / BLOCK * BLOCK);
+                continue;
+            }
+
+            const WideNode<W>& node= nodes[entry.child];
+            RAY_STAT(nodes, 1);
+            float tmin[W];
+            int mask= K::intersect(node, wray, hit.t, tmin);
+
+            // empile les fils touches, tries par distance decroissante : le plus proche est visite en premier
+            int first= top;
+            for(int i= 0; i < W; i++)
+            {
+                if(!(mask & (1 << i)))
+                    continue;
+
+                Entry child= { node.child[i], node.count[i], tmin[i] };
+                int k= top++;
+                assert(top <= STACK_SIZE);
+                for(; k > first && stack[k -1].tmin < child.tmin; k--)
+                    stack[k]= stack[k -1];
+                stack[k]= child;
+            }
+        }
+
+        return hit;
+    }
+
+    template< typename K, typename T >
+    bool occluded( const Ray& ray, const int index ) const
+    {
+        if(index < 0) return false;
+
+        WideRay wray(ray);
+        int stack[STACK_SIZE];
+        int top= 0;
+
+        stack[top++]= index;
+        while(top > 0)
+        {
+            const WideNode<W>& node= nodes[stack[--top]];
+            RAY_STAT(nodes, 1);
+            float tmin[W];
+            int mask= K::intersect(node, wray, ray.tmax, tmin);
+            for(int i= 0; i < W; i++)
+            {
+                if(!(mask & (1 << i)))
+                    continue;
+
+                // teste directement les feuilles, l'ordre de visite des noeuds n'a pas d'importance
+                if(node.count[i] > 0)
+                {
+                    Hit hit;
+                    hit.t= ray.tmax;
+                    for(int b= node.child[i] / BLOCK; b < (node.child[i] + node.count[i] + BLOCK -1) / BLOCK; b++)
+                    {
+                        RAY_STAT(triangles, BLOCK);
+                        if(T::intersect(blocks[b], ray, hit))
+                            return true;
+                    }
+                }
+                else
+                {
+                    assert(top < STACK_SIZE);
+                    stack[top++]= node.child[i];
+                }
+            }
+        }
+
+        return false;
+    }
+
+    template< typename K, typename T >
+    int occluded( const Point& origin, const std::vector<Point>& targets, std::vector<int>& hidden ) const
+    {
+        int n= 0;
+        for(int i= 0; i < int(targets.size()); i++)
+        {
+            Ray ray(origin, targets[i]);
+            ray.tmax= SHADOW_TMAX;
+            hidden[i]= occluded<K, T>(ray, root);
+            n+= hidden[i];
+            RAY_STAT(occluded, 1);
+            RAY_STAT(hits, hidden[i]);
+        }
+        return n;
+    }
+
+#ifdef WIDE_SIMD
+    // parcours compiles pour sse / avx, utilises seulement si le processeur les supporte, cf best_kernel()
+    WIDE_TARGET("sse2") WIDE_FLATTEN Hit intersect_sse( const Ray& ray, const int index ) const { return intersect<wide_box_sse<W>, triangle_block_sse<BLOCK> >(ray, index); }
+    WIDE_TARGET("sse2") WIDE_FLATTEN bool occluded_sse( const Ray& ray, const int index ) const { return occluded<wide_box_sse<W>, triangle_block_sse<BLOCK> >(ray, index); }
+    WIDE_TARGET("avx") WIDE_FLATTEN Hit intersect_avx( const Ray& ray, const int index ) const { return intersect<wide_box_avx<W>, triangle_block_avx<BLOCK> >(ray, index); }
+    WIDE_TARGET("avx") WIDE_FLATTEN bool occluded_avx( const Ray& ray, const int index ) const { return occluded<wide_box_avx<W>, triangle_block_avx<BLOCK> >(ray, index); }
+
+    WIDE_TARGET("sse2") WIDE_FLATTEN int occluded_sse( const Point& origin, const std::vector<Point>& targets, std::vector<int>& hidden ) const
+    {
+        return occluded<wide_box_sse<W>, triangle_block_sse<BLOCK> >(origin, targets, hidden);
+    }
+    WIDE_TARGET("avx") WIDE_FLATTEN int occluded_avx( const Point& origin, const std::vector<Point>& targets, std::vector<int>& hidden ) const
+    {
+        return occluded<wide_box_avx<W>, triangle_block_avx<BLOCK> >(origin, targets, hidden);
+    }
+#endif
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
+
+#endif
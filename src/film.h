@@ -0,0 +1,210 @@
+#ifndef _FILM_H
+#define _FILM_H
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "color.h"
+#include "image.h"
+
+/* accumulation des passes d'un rendu progressif, cf tp2.cpp
+    chaque passe ajoute une estimation de chaque pixel. la moyenne des passes converge vers l'image, et la variance des passes
+    donne l'erreur de la moyenne, pour arreter le rendu lorsque tous les pixels ont converge.
+    les pixels converges ne recoivent plus de passes, les suivantes sont reparties sur les pixels dont l'erreur est encore trop grande.
+
+    la variance est estimee sur la luminance, de maniere incrementale, cf "note on a method for calculating corrected sums of squares and products", B. Welford, 1962
+ */
+struct Film
+{
+    int width, height;
+    std::vector<Color> sum;     // somme des estimations de chaque pixel
+    std::vector<float> mean;    // moyenne et somme des ecarts au carre des luminances, cf add()
+    std::vector<float> m2;
+    std::vector<int> count;     // nombre de passes de chaque pixel
+    int min_count;              // nombre de passes avant de tester la convergence, la variance de 2 ou 3 passes n'est pas fiable
+
+    Film( const int _width, const int _height, const int _min_count= 4 ) : width(_width), height(_height),
+        sum(_width * _height, Black()), mean(_width * _height, 0), m2(_width * _height, 0), count(_width * _height, 0), min_count(std::max(2, _min_count)) {}
+
+    // ajoute une estimation du pixel (x, y). chaque pixel n'est modifie que par un thread a la fois
+    void add( const int x, const int y, const Color& color )
+    {
+        int i= y * width + x;
+        sum[i]= sum[i] + color;
+
+        float l= (color.r + color.g + color.b) / 3;
+        count[i]++;
+        float delta= l - mean[i];
+        mean[i]+= delta / count[i];
+        m2[i]+= delta * (l - mean[i]);
+    }
+
+    // erreur standard de la moyenne du pixel (x, y), ou -1 sans estimation de la variance
+    float error( const int x, const int y ) const
+    {
+        int i= y * width + x;
+        if(count[i] < 2)
+            return -1;
+        return std::sqrt(m2[i] / (count[i] -1) / count[i]);
+    }
+
+    // renvoie vrai si l'erreur du pixel est inferieure a threshold
+    bool converged( const int x, const int y, const float threshold ) const
+    {
+        if(count[y * width + x] < min_count)
+            return false;
+        return error(x, y) <= threshold;
+    }
+
+    // renvoie vrai si tous les pixels du rectangle [x0 x1) x [y0 y1) ont converge
+    bool converged( const int x0, const int y0, const int x1, const int y1, const float threshold ) const
+    {
+        for(int y= y0; y < std::min(y1, height); y++)
+        for(int x= x0; x < std::min(x1, width); x++)
+            if(!converged(x, y, threshold))
+                return false;
+        return true;
+    }
+
+    // nombre de pixels converges
+    int converged( const float threshold ) const
+    {
+        int n= 0;
+        for(int y= 0; y < height; y++)
+        for(int x= 0; x < width; x++)
+            n+= converged(x, y, threshold);
+        return n;
+    }
+
+    // moyenne des estimations
+    Image image( ) const
+    {
+        Image image(width, height);
+        for(int y= 0; y < height; y++)
+        for(int x= 0; x < width; x++)
+        {
+            int i= y * width + x;
+            if(count[i] > 0)
+            {
+                image(x, y)= sum[i] / float(count[i]);
+                image(x, y).a= 1;
+            }
+        }
+        return image;
+    }
+
+    // nombre de passes de chaque pixel : du bleu, pour le minimum, au rouge, pour max_count
+    Image heatmap( const int max_count ) const
+    {
+        const Color ramp[]= { Color(0, 0, 1), Color(0, 1, 1), Color(0, 1, 0), Color(1, 1, 0), Color(1, 0, 0) };
+
+        Image image(width, height);
+        for(int y= 0; y < height; y++)
+        for(int x= 0; x < width; x++)
+        {
+            float t= float(count[y * width + x] - min_count) / std::max(1, max_count - min_count) * 4;
+            t= std::min(std::max(t, 0.f), 4.f);
+            int i= std::min(int(t), 3);
+            image(x, y)= ramp[i] * (1 - (t - i)) + ramp[i +1] * (t - i);
+            image(x, y).a= 1;
+        }
+        return image;
+    }
+};
+
+
+/* reprise d'un rendu interrompu : le fichier contient l'etat complet du film, et l'etat du rendu, fourni par l'application,
+    cf tp2.cpp : passe suivante, graine, nombre d'echantillons par passe, etc.
+    les nombres aleatoires sont des compteurs, cf rng.h et sampler.h, la passe et la graine suffisent pour reprendre les memes echantillons.
+    le film reste en binaire, sans conversion, et la reprise produit exactement la meme image qu'un rendu sans interruption.
+ */
+const char checkpoint_magic[8]= { 'f', 'i', 'l', 'm', 'c', 'k', 'p', '1' };
+
+// resume une chaine, un nom de fichier par exemple, pour l'etat du rendu. fnv-1a, h permet d'enchainer plusieurs chaines
+inline int checkpoint_hash( const char *string, unsigned h= 2166136261u )
+{
+    for(; *string; string++)
+        h= (h ^ (unsigned char) *string) * 16777619u;
+    return int(h);
+}
+
+// enregistre le film et l'etat du rendu. le fichier est ecrit a cote, puis renomme : un rendu interrompu pendant l'ecriture garde le fichier precedent
+inline int write_checkpoint( const Film& film, const std::vector<int>& state, const char *filename )
+{
+    std::string tmp= std::string(filename) + ".tmp";
+    FILE *out= fopen(tmp.c_str(), "wb");
+    if(out == nullptr)
+    {
+        printf("[error] writing checkpoint '%s'...\n", filename);
+        return -1;
+    }
+
+    const int n= film.width * film.height;
+    int header[]= { film.width, film.height, film.min_count, int(state.size()) };
+    bool errors= false;
+    errors= errors || fwrite(checkpoint_magic, sizeof(checkpoint_magic), 1, out) != 1;
+    errors= errors || fwrite(header, sizeof(header), 1, out) != 1;
+    errors= errors || (!state.empty() && fwrite(state.data(), sizeof(int), state.size(), out) != state.size());
+    errors= errors || fwrite(film.sum.data(), sizeof(Color), n, out) != size_t(n);
+    errors= errors || fwrite(film.mean.data(), sizeof(float), n, out) != size_t(n);
+    errors= errors || fwrite(film.m2.data(), sizeof(float), n, out) != size_t(n);
+    errors= errors || fwrite(film.count.data(), sizeof(int), n, out) != size_t(n);
+    errors= (fclose(out) != 0) || errors;
+
+#ifdef WIN32
+    // windows : rename() ne remplace pas un fichier existant
+    if(!errors)
+        remove(filename);
+#endif
+    if(errors || rename(tmp.c_str(), filename) != 0)
+    {
+        printf("[error] writing checkpoint '%s'...\n", filename);
+        remove(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// relit le film et l'etat du rendu, le film doit avoir les dimensions du rendu interrompu
+inline int read_checkpoint( Film& film, std::vector<int>& state, const char *filename )
+{
+    FILE *in= fopen(filename, "rb");
+    if(in == nullptr)
+        return -1;
+
+    printf("loading checkpoint '%s'...\n", filename);
+
+    const int min_count= film.min_count;
+    char magic[sizeof(checkpoint_magic)];
+    int header[4];
+    bool errors= false;
+    errors= errors || fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0;
+    errors= errors || fread(header, sizeof(header), 1, in) != 1;
+    errors= errors || header[0] != film.width || header[1] != film.height || header[3] < 0 || header[3] > 1024;
+    if(!errors)
+    {
+        const int n= film.width * film.height;
+        film.min_count= header[2];
+        state.resize(header[3]);
+        errors= errors || (!state.empty() && fread(state.data(), sizeof(int), state.size(), in) != state.size());
+        errors= errors || fread(film.sum.data(), sizeof(Color), n, in) != size_t(n);
+        errors= errors || fread(film.mean.data(), sizeof(float), n, in) != size_t(n);
+        errors= errors || fread(film.m2.data(), sizeof(float), n, in) != size_t(n);
+        errors= errors || fread(film.count.data(), sizeof(int), n, in) != size_t(n);
+    }
+    fclose(in);
+
+    if(errors)
+    {
+        printf("[error] loading checkpoint '%s'...\n", filename);
+        film= Film(film.width, film.height, min_count);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
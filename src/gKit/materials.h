@@ -4,6 +4,8 @@
 
 #include <string>
 #include <vector>
+#include <cstring>
+#include <algorithm>
 #include <cassert>
 
 #include "color.h"
@@ -30,6 +32,76 @@ struct Material
 };
 
 
+/*! noms d'un ensemble, chaque nom n'existe qu'une fois, et index des noms : table de hachage, adressage ouvert, qui ne stocke que les indices des noms.
+    les noms sont internes : ils ne sont ajoutes que par insert(), dans l'ordre, et ne sont plus modifies ensuite, l'index ne peut pas devenir invalide.
+    se lit comme un std::vector<std::string>, names[id] et names.size(), cf Materials::names et Materials::texture_filenames.
+*/
+struct NameIndex
+{
+    NameIndex( ) : m_strings(), m_slots() {}
+    
+    //! fnv-1a.
+    static unsigned hash( const char *name )
+    {
+        unsigned h= 2166136261u;
+        for(; *name; name++)
+            h= (h ^ (unsigned char) *name) * 16777619u;
+        return h;
+    }
+    
+    //! renvoie l'indice de name, ou -1.
+    int find( const char *name ) const
+    {
+        if(m_slots.empty())
+            return -1;
+        
+        unsigned mask= unsigned(m_slots.size()) -1;
+        for(unsigned i= hash(name) & mask; m_slots[i] != -1; i= (i +1) & mask)
+            if(strcmp(m_strings[m_slots[i]].c_str(), name) == 0)
+                return m_slots[i];
+        return -1;
+    }
+    
+    //! ajoute name, a la fin, et renvoie son indice. name ne doit pas deja exister, cf find().
+    int insert( const char *name )
+    {
+        // garde la table remplie aux 2/3 au plus
+        if(2 * m_slots.size() < 3 * (m_strings.size() +1))
+        {
+            m_slots.assign(std::max(size_t(16), 2 * m_slots.size()), -1);
+            for(int i= 0; i < int(m_strings.size()); i++)
+                insert_slot(i);
+        }
+        
+        m_strings.push_back(name);
+        insert_slot(int(m_strings.size()) -1);
+        return int(m_strings.size()) -1;
+    }
+    
+    //! nombre de noms.
+    size_t size( ) const { return m_strings.size(); }
+    //! renvoie vrai si l'ensemble est vide.
+    bool empty( ) const { return m_strings.empty(); }
+    //! renvoie le ieme nom.
+    const std::string& operator[] ( const int id ) const { return m_strings[id]; }
+    //! renvoie tous les noms, dans l'ordre de leurs indices.
+    const std::vector<std::string>& strings( ) const { return m_strings; }
+    
+protected:
+    void insert_slot( const int id )
+    {
+        unsigned mask= unsigned(m_slots.size()) -1;
+        unsigned i= hash(m_strings[id].c_str()) & mask;
+        while(m_slots[i] != -1)
+            i= (i +1) & mask;
+        m_slots[i]= id;
+    }
+    
+    std::vector<std::string> m_strings;
+    std::vector<int> m_slots;
+};
+
+
 /*! ensemble de matieres d'un Mesh. + ensemble de textures referencees par les descriptions de matieres. 
 
     `names[id]` est le nom de la matiere `materials[id]`, utiliser name() et material() pour recuperer la description d'une matiere d'indice `id`.
@@ -40,12 +112,16 @@ struct Material
     
     pourquoi cette indexation supplementaire ? pour eviter de charger plusieurs fois une image / creer plusieurs fois une texture. 
     il est aussi tres simple de creer un tableau avec les textures openGL indexe de la meme maniere.
+    
+    find() et find_texture() utilisent l'index des noms, cf NameIndex, et ne comparent pas tous les noms : un fichier .obj peut changer des centaines
+    de milliers de fois de matiere, avec usemtl, et un fichier .mtl peut decrire des milliers de matieres.
+    les noms ne sont modifiables que par insert() et insert_texture().
 */
 struct Materials
 {
-    std::vector<std::string> names;     //!< noms des matieres.
+    NameIndex names;                    //!< noms des matieres.
     std::vector<Material> materials;    //!< description des matieres.
-    std::vector<std::string> texture_filenames; //!< noms des textures a charger.
+    NameIndex texture_filenames;        //!< noms des textures a charger.
     int default_material_id;    //!< indice de la matiere par defaut dans materials.
     
     Materials( ) : names(), materials(), texture_filenames(), default_material_id(-1) {}
@@ -56,8 +132,7 @@ struct Materials
         int id= find(name);
         if(id == -1)
         {
-            id= int(materials.size());
-            names.push_back(name);
+            id= names.insert(name);
             materials.push_back(material);
         }
         assert(materials.size() == names.size());
@@ -69,25 +144,17 @@ struct Materials
     {
         int id= find_texture(filename);
         if(id == -1)
-        {
-            id= int(texture_filenames.size());
-            texture_filenames.push_back(filename);
-        }
+            id= texture_filenames.insert(filename);
         return id;
     }
     
     //! recherche une matiere avec son nom. renvoie son indice dans materials, ou -1.
-    int find( const char *name )
+    int find( const char *name ) const
     {
         if(name == nullptr || name[0] == 0)
             return -1;
         
-        for(int i= 0; i < int(names.size()); i++)
-        {
-            if(names[i] == name)
-                return i;
-        }
-        return -1;
+        return names.find(name);
     }
     
     //! nombre de matieres.
@@ -141,17 +208,12 @@ struct Materials
     const char *filename( const int id ) const { return texture_filenames[id].c_str(); }
     
     //! renvoie l'indice d'une texture, si elle existe.
-    int find_texture( const char *filename )
+    int find_texture( const char *filename ) const
     {
         if(filename == nullptr || filename[0] == 0)
             return -1;
         
-        for(int i= 0; i < int(texture_filenames.size()); i++)
-        {
-            if(texture_filenames[i] == filename)
-                return i;
-        }
-        return -1;
+        return texture_filenames.find(filename);
     }
 };
 
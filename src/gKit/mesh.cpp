@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cassert>
 #include <string>
+#include <utility>
 #include <algorithm>
 
 #include "vec.h"
@@ -42,6 +43,13 @@ Mesh& Mesh::color( const vec4& color )
     return *this;
 }
 
+Mesh::Mesh( const GLenum primitives, std::vector<vec3>&& positions, std::vector<vec2>&& texcoords, std::vector<vec3>&& normals, 
+    std::vector<unsigned int>&& indices, const Materials& materials, std::vector<unsigned int>&& triangle_materials ) :
+    m_positions(std::move(positions)), m_texcoords(std::move(texcoords)), m_normals(std::move(normals)), m_colors(), m_indices(std::move(indices)),
+    m_materials(materials), m_triangle_materials(std::move(triangle_materials)),
+    m_color(White()), m_primitives(primitives), m_vao(0), m_buffer(0), m_index_buffer(0), m_update_buffers(true) 
+{}
+
 Mesh& Mesh::normal( const vec3& normal )
 {
     m_update_buffers= true;
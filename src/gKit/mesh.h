@@ -121,6 +121,10 @@ public:
     Mesh( const GLenum primitives ) : m_positions(), m_texcoords(), m_normals(), m_colors(), m_indices(), 
         m_color(White()), m_primitives(primitives), m_vao(0), m_buffer(0), m_index_buffer(0), m_update_buffers(false) {}
     
+    //! constructeur. les attributs de tous les sommets, les indices, s'ils sont definis, et les matieres des triangles sont deplaces dans le mesh, cf read_mesh_fast().
+    Mesh( const GLenum primitives, std::vector<vec3>&& positions, std::vector<vec2>&& texcoords, std::vector<vec3>&& normals, 
+        std::vector<unsigned int>&& indices, const Materials& materials, std::vector<unsigned int>&& triangle_materials );
+    
     //! construit les objets openGL.
     int create( const GLenum primitives );
     //! detruit les objets openGL.
@@ -0,0 +1,423 @@
+
+// off_t sur 64 bits, meme sur les systemes 32 bits, cf seek()
+#define _FILE_OFFSET_BITS 64
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#include "mesh_cache.h"
+
+
+/* format du cache : un entete, puis les sections, chacune alignee sur 64 octets.
+    les tableaux sont enregistres tels qu'ils sont en memoire, sans conversion : chaque section est relue directement dans le tableau du mesh,
+    ou peut etre utilisee telle quelle, si le fichier est projete en memoire.
+    les chaines de caracteres, noms des matieres, des textures et des fichiers source, sont terminees par 0, et rangees les unes a la suite des autres.
+
+    le premier fichier source est le fichier .obj, les suivants sont ses dependances, les fichiers .mtl. leurs chemins sont absolus, cf absolute_filename().
+    le cache n'est plus a jour si la taille ou la date de modification de l'un des fichiers source a change.
+ */
+enum
+{
+    CACHE_POSITIONS= 0,
+    CACHE_TEXCOORDS,
+    CACHE_NORMALS,
+    CACHE_INDICES,
+    CACHE_TRIANGLE_MATERIALS,
+    CACHE_MATERIALS,
+    CACHE_MATERIAL_NAMES,
+    CACHE_TEXTURE_NAMES,
+    CACHE_SOURCES,
+    CACHE_SOURCE_NAMES,
+    CACHE_SECTIONS
+};
+
+// position et taille d'une section, en octets
+struct CacheSection
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t material_size;     // sizeof(Material), detecte les changements de representation des matieres
+    uint32_t primitives;
+    int32_t default_material;
+    CacheSection sections[CACHE_SECTIONS];
+};
+
+// taille et date de modification d'un fichier source, en nanosecondes, cf source_stamp()
+struct CacheSource
+{
+    int64_t size;
+    int64_t time;
+};
+
+static const char cache_magic[8]= { 'g', 'k', 'i', 't', 'm', 'e', 's', 'h' };
+static const uint32_t cache_version= 2;
+static const uint64_t cache_alignment= 64;
+
+
+static
+bool source_stamp( const char *filename, CacheSource& source )
+{
+#ifndef _MSC_VER
+    struct stat info;
+    if(stat(filename, &info) != 0)
+        return false;
+#else
+    // taille sur 64 bits
+    struct _stat64 info;
+    if(_stat64(filename, &info) != 0)
+        return false;
+#endif
+
+    source.size= int64_t(info.st_size);
+    // en nanosecondes, si le systeme les fournit : un fichier reecrit dans la meme seconde, avec la meme taille, invalide aussi le cache
+#if defined(WIN32)
+    source.time= int64_t(info.st_mtime) * 1000000000;
+#elif defined(__APPLE__)
+    source.time= int64_t(info.st_mtimespec.tv_sec) * 1000000000 + int64_t(info.st_mtimespec.tv_nsec);
+#else
+    source.time= int64_t(info.st_mtim.tv_sec) * 1000000000 + int64_t(info.st_mtim.tv_nsec);
+#endif
+    return true;
+}
+
+// chaines terminees par 0, les unes a la suite des autres
+static
+std::vector<char> pack_strings( const std::vector<std::string>& strings )
+{
+    std::vector<char> data;
+    for(int i= 0; i < int(strings.size()); i++)
+        data.insert(data.end(), strings[i].c_str(), strings[i].c_str() + strings[i].size() +1);
+    return data;
+}
+
+static
+std::vector<std::string> unpack_strings( const std::vector<char>& data )
+{
+    std::vector<std::string> strings;
+    for(size_t i= 0; i < data.size(); )
+    {
+        const char *string= data.data() + i;
+        size_t length= strnlen(string, data.size() - i);
+        strings.push_back(std::string(string, length));
+        i+= length +1;
+    }
+    return strings;
+}
+
+
+// chemin absolu d'un fichier, ou filename, si le fichier n'existe pas
+static
+std::string absolute_filename( const char *filename )
+{
+#ifdef WIN32
+    char *path= _fullpath(nullptr, filename, 0);
+#else
+    char *path= realpath(filename, nullptr);
+#endif
+    if(path == nullptr)
+        return filename;
+
+    std::string absolute= path;
+    free(path);
+    return absolute;
+}
+
+// cree le repertoire et ses parents, si necessaire
+static
+bool make_directory( const std::string& path )
+{
+    for(size_t i= 1; i <= path.size(); i++)
+    {
+        if(i < path.size() && path[i] != '/' && path[i] != '\\')
+            continue;
+
+        std::string parent= path.substr(0, i);
+    #ifdef WIN32
+        _mkdir(parent.c_str());
+    #else
+        mkdir(parent.c_str(), 0755);
+    #endif
+    }
+
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+}
+
+std::string mesh_cache_path( )
+{
+    static std::string path;
+    static bool init= false;
+    if(init)
+        return path;
+    init= true;
+
+    std::string base;
+    if(const char *env= std::getenv("GKIT_CACHE_PATH"))
+        base= env;
+    else
+    {
+    #if defined(WIN32)
+        if(const char *local= std::getenv("LOCALAPPDATA"))
+            base= std::string(local) + "/gkit";
+    #elif defined(__APPLE__)
+        if(const char *home= std::getenv("HOME"))
+            base= std::string(home) + "/Library/Caches/gkit";
+    #else
+        if(const char *xdg= std::getenv("XDG_CACHE_HOME"))
+            base= std::string(xdg) + "/gkit";
+        else if(const char *home= std::getenv("HOME"))
+            base= std::string(home) + "/.cache/gkit";
+    #endif
+    }
+
+    while(base.size() > 1 && (base[base.size() -1] == '/' || base[base.size() -1] == '\\'))
+        base.erase(base.size() -1);
+
+    if(!base.empty() && make_directory(base))
+        path= base;
+    else
+        printf("[error] mesh cache directory '%s'...\n", base.c_str());
+
+    return path;
+}
+
+std::string mesh_cache_filename( const char *filename, const char *tag )
+{
+    std::string path= mesh_cache_path();
+    if(path.empty())
+        return path;
+
+    // le nom du cache depend du chemin absolu du fichier : 2 fichiers de meme nom, dans des repertoires differents, ont chacun leur cache
+    std::string absolute= absolute_filename(filename);
+    uint64_t hash= 14695981039346656037ull;     // fnv-1a 64 bits
+    for(size_t i= 0; i < absolute.size(); i++)
+        hash= (hash ^ (unsigned char) absolute[i]) * 1099511628211ull;
+
+    std::string name= absolute;
+    size_t slash= name.find_last_of("/\\");
+    if(slash != std::string::npos)
+        name= name.substr(slash +1);
+
+    char key[32];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+    return path + "/" + name + "." + key + "." + tag + ".cache";
+}
+
+
+// se place a offset octets du debut du fichier. fseek() utilise un long, sur 32 bits sous windows, et ne peut pas depasser 2Go
+static
+int seek( FILE *file, const uint64_t offset )
+{
+#ifdef WIN32
+    return _fseeki64(file, int64_t(offset), SEEK_SET);
+#else
+    return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+}
+
+// renvoie la taille du fichier, en octets, ou 0 en cas d'erreur
+static
+uint64_t file_size( FILE *file )
+{
+#ifndef _MSC_VER
+    struct stat info;
+    if(fstat(fileno(file), &info) != 0)
+        return 0;
+#else
+    // taille sur 64 bits
+    struct _stat64 info;
+    if(_fstat64(_fileno(file), &info) != 0)
+        return 0;
+#endif
+    return uint64_t(info.st_size);
+}
+
+// relit une section dans un tableau. un cache tronque ou corrompu peut decrire une section en dehors du fichier : elle est rejetee avant d'allouer le tableau
+template < typename T >
+static
+bool read_section( FILE *in, const uint64_t size, const CacheSection& section, std::vector<T>& data )
+{
+    if(section.size % sizeof(T) != 0)
+        return false;
+    if(section.offset > size || section.size > size - section.offset)
+        return false;
+
+    data.resize(section.size / sizeof(T));
+    if(data.empty())
+        return true;
+
+    return seek(in, section.offset) == 0 && fread(data.data(), 1, section.size, in) == section.size;
+}
+
+int read_mesh_cache( const char *cache, const char *filename, Mesh& mesh )
+{
+    FILE *in= fopen(cache, "rb");
+    if(in == nullptr)
+        return -1;
+
+    const uint64_t size= file_size(in);
+
+    // verifie la version du format, puis les fichiers source
+    CacheHeader header;
+    bool valid= fread(&header, sizeof(header), 1, in) == 1
+        && memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0
+        && header.version == cache_version
+        && header.material_size == sizeof(Material);
+
+    std::vector<CacheSource> sources;
+    std::vector<char> names;
+    valid= valid && read_section(in, size, header.sections[CACHE_SOURCES], sources) && read_section(in, size, header.sections[CACHE_SOURCE_NAMES], names);
+    if(valid)
+    {
+        std::vector<std::string> source_names= unpack_strings(names);
+        valid= !sources.empty() && source_names.size() == sources.size() && source_names[0] == absolute_filename(filename);
+        for(int i= 0; valid && i < int(sources.size()); i++)
+        {
+            CacheSource source;
+            valid= source_stamp(source_names[i].c_str(), source) && source.size == sources[i].size && source.time == sources[i].time;
+        }
+    }
+
+    if(!valid)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    printf("loading mesh cache '%s'...\n", cache);
+
+    std::vector<vec3> positions;
+    std::vector<vec2> texcoords;
+    std::vector<vec3> normals;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> triangle_materials;
+    Materials materials;
+    std::vector<char> material_names;
+    std::vector<char> texture_names;
+
+    bool errors= false;
+    errors= errors || !read_section(in, size, header.sections[CACHE_POSITIONS], positions);
+    errors= errors || !read_section(in, size, header.sections[CACHE_TEXCOORDS], texcoords);
+    errors= errors || !read_section(in, size, header.sections[CACHE_NORMALS], normals);
+    errors= errors || !read_section(in, size, header.sections[CACHE_INDICES], indices);
+    errors= errors || !read_section(in, size, header.sections[CACHE_TRIANGLE_MATERIALS], triangle_materials);
+    errors= errors || !read_section(in, size, header.sections[CACHE_MATERIALS], materials.materials);
+    errors= errors || !read_section(in, size, header.sections[CACHE_MATERIAL_NAMES], material_names);
+    errors= errors || !read_section(in, size, header.sections[CACHE_TEXTURE_NAMES], texture_names);
+    fclose(in);
+
+    // les noms ne sont ajoutes que par insert(), cf NameIndex
+    std::vector<std::string> material_strings= unpack_strings(material_names);
+    errors= errors || material_strings.size() != materials.materials.size();
+    for(int i= 0; !errors && i < int(material_strings.size()); i++)
+        materials.names.insert(material_strings[i].c_str());
+    std::vector<std::string> texture_strings= unpack_strings(texture_names);
+    for(int i= 0; i < int(texture_strings.size()); i++)
+        materials.texture_filenames.insert(texture_strings[i].c_str());
+    materials.default_material_id= header.default_material;
+
+    if(errors)
+    {
+        printf("[error] loading mesh cache '%s'...\n", cache);
+        return -1;
+    }
+
+    mesh= Mesh(GLenum(header.primitives), std::move(positions), std::move(texcoords), std::move(normals), std::move(indices), materials, std::move(triangle_materials));
+    return 0;
+}
+
+
+// ecrit une section, a la suite des precedentes
+template < typename T >
+static
+bool write_section( FILE *out, const std::vector<T>& data, CacheSection& section, uint64_t& offset )
+{
+    // aligne le debut de la section
+    static const char zeros[cache_alignment]= { };
+    uint64_t padding= (cache_alignment - offset % cache_alignment) % cache_alignment;
+    if(padding > 0 && fwrite(zeros, 1, padding, out) != padding)
+        return false;
+    offset+= padding;
+
+    section.offset= offset;
+    section.size= data.size() * sizeof(T);
+    offset+= section.size;
+    return data.empty() || fwrite(data.data(), sizeof(T), data.size(), out) == data.size();
+}
+
+int write_mesh_cache( const char *cache, const char *filename, const std::vector<std::string>& dependencies, const Mesh& mesh )
+{
+    // fichiers source
+    std::vector<std::string> source_names;
+    source_names.push_back(absolute_filename(filename));
+    for(int i= 0; i < int(dependencies.size()); i++)
+        source_names.push_back(absolute_filename(dependencies[i].c_str()));
+
+    std::vector<CacheSource> sources(source_names.size());
+    for(int i= 0; i < int(sources.size()); i++)
+        if(!source_stamp(source_names[i].c_str(), sources[i]))
+            return -1;      // pas de cache si un fichier source n'existe pas
+
+    // le fichier est ecrit a cote, puis renomme : un chargement interrompu pendant l'ecriture ne laisse pas de cache incomplet
+    std::string tmp= std::string(cache) + ".tmp";
+    FILE *out= fopen(tmp.c_str(), "wb");
+    if(out == nullptr)
+    {
+        printf("[error] writing mesh cache '%s'...\n", cache);
+        return -1;
+    }
+
+    const Materials& materials= mesh.materials();
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version= cache_version;
+    header.material_size= sizeof(Material);
+    header.primitives= uint32_t(mesh.primitives());
+    header.default_material= materials.default_material_id;
+
+    // entete provisoire, reecrit avec la position des sections
+    uint64_t offset= sizeof(header);
+    bool errors= fwrite(&header, sizeof(header), 1, out) != 1;
+    errors= errors || !write_section(out, mesh.positions(), header.sections[CACHE_POSITIONS], offset);
+    errors= errors || !write_section(out, mesh.texcoords(), header.sections[CACHE_TEXCOORDS], offset);
+    errors= errors || !write_section(out, mesh.normals(), header.sections[CACHE_NORMALS], offset);
+    errors= errors || !write_section(out, mesh.indices(), header.sections[CACHE_INDICES], offset);
+    errors= errors || !write_section(out, mesh.material_indices(), header.sections[CACHE_TRIANGLE_MATERIALS], offset);
+    errors= errors || !write_section(out, materials.materials, header.sections[CACHE_MATERIALS], offset);
+    errors= errors || !write_section(out, pack_strings(materials.names.strings()), header.sections[CACHE_MATERIAL_NAMES], offset);
+    errors= errors || !write_section(out, pack_strings(materials.texture_filenames.strings()), header.sections[CACHE_TEXTURE_NAMES], offset);
+    errors= errors || !write_section(out, sources, header.sections[CACHE_SOURCES], offset);
+    errors= errors || !write_section(out, pack_strings(source_names), header.sections[CACHE_SOURCE_NAMES], offset);
+    errors= errors || seek(out, 0) != 0 || fwrite(&header, sizeof(header), 1, out) != 1;
+    errors= (fclose(out) != 0) || errors;
+
+#ifdef WIN32
+    // windows : rename() ne remplace pas un fichier existant
+    if(!errors)
+        remove(cache);
+#endif
+    if(errors || rename(tmp.c_str(), cache) != 0)
+    {
+        printf("[error] writing mesh cache '%s'...\n", cache);
+        remove(tmp.c_str());
+        return -1;
+    }
+
+    printf("writing mesh cache '%s'...\n", cache);
+    return 0;
+}
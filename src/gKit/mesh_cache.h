@@ -0,0 +1,55 @@
+
+#ifndef _MESH_CACHE_H
+#define _MESH_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+
+//! \addtogroup objet3D
+///@{
+
+//! \file
+//! cache binaire des mesh charges depuis un fichier .obj : les tableaux du mesh sont enregistres tels quels, et relus sans analyse au prochain chargement.
+//! le cache est place dans le repertoire de cache de l'utilisateur, cf mesh_cache_path(), pas a cote du fichier .obj, qui peut etre en lecture seule.
+//! il est reconstruit si le fichier .obj ou l'un de ses fichiers .mtl est modifie (taille ou date).
+
+//! renvoie le repertoire des caches, cree si necessaire : la variable d'environnement GKIT_CACHE_PATH, si elle est definie,
+//! ou $XDG_CACHE_HOME/gkit, ~/.cache/gkit, ~/Library/Caches/gkit sous macos, %LOCALAPPDATA%/gkit sous windows. renvoie une chaine vide si le repertoire n'est pas utilisable.
+std::string mesh_cache_path( );
+
+//! renvoie le nom du fichier cache d'un mesh, dans mesh_cache_path(), ou une chaine vide. tag distingue les differentes versions du meme fichier : indexee ou pas, etc.
+std::string mesh_cache_filename( const char *filename, const char *tag );
+
+//! charge le cache d'un mesh, s'il est a jour par rapport au fichier filename et a ses dependances. renvoie 0, ou -1 si le cache n'existe pas ou n'est pas a jour.
+int read_mesh_cache( const char *cache, const char *filename, Mesh& mesh );
+
+//! enregistre le cache d'un mesh charge depuis filename. dependencies : fichiers utilises, en plus de filename, par exemple les fichiers .mtl. renvoie 0, ou -1 en cas d'erreur.
+int write_mesh_cache( const char *cache, const char *filename, const std::vector<std::string>& dependencies, const Mesh& mesh );
+
+/*! charge un mesh depuis son cache, s'il est a jour, ou avec read( filename, dependencies ), qui renvoie aussi les fichiers utilises, puis enregistre le cache.
+    cf read_mesh() et read_mesh_fast().
+ */
+template < typename Read >
+Mesh read_cached_mesh( const char *filename, const char *tag, Read read )
+{
+    std::string cache= mesh_cache_filename(filename, tag);
+    std::vector<std::string> dependencies;
+    if(cache.empty())
+        // pas de repertoire de cache, charge le fichier
+        return read(filename, dependencies);
+
+    Mesh mesh;
+    if(read_mesh_cache(cache.c_str(), filename, mesh) == 0)
+        return mesh;
+
+    mesh= read(filename, dependencies);
+    if(mesh.vertex_count() > 0)
+        write_mesh_cache(cache.c_str(), filename, dependencies, mesh);
+    return mesh;
+}
+
+///@}
+#endif
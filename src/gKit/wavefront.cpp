@@ -7,6 +7,8 @@
 #include <algorithm>
 
 #include "wavefront.h"
+#include "wavefront_parser.h"
+#include "mesh_cache.h"
 
 /*! renvoie le chemin d'acces a un fichier. le chemin est toujours termine par /
     pathname("path\to\file") == "path/to/"
@@ -48,7 +50,45 @@ std::string normalize_filename( const std::string& filename )
     return path;
 }
 
-Mesh read_mesh( const char *filename )
+// analyse les sommets d'une face : p/t/n ou p//n ou p/t ou p... les attributs absents sont notes 0
+static
+void parse_face( const char *line, std::vector<int>& idp, std::vector<int>& idt, std::vector<int>& idn )
+{
+    idp.clear();
+    idt.clear();
+    idn.clear();
+    
+    for(;;)
+    {
+        int p= 0, t= 0, n= 0;       // 0: invalid index
+        line= skip_whitespace(line);
+        const char *next= parse_int(line, &p);
+        if(next == line)
+            break;      // pas un indice, fin de la face
+        line= next;
+        
+        if(*line == '/')
+        {
+            line++;
+            if(*line != '/')
+                line= parse_int(line, &t);
+            
+            if(*line == '/')
+            {
+                line++;
+                line= parse_int(line, &n);
+            }
+        }
+        
+        idp.push_back(p);
+        idt.push_back(t);
+        idn.push_back(n);
+    }
+}
+
+// charge le fichier .obj, et renvoie aussi les fichiers .mtl utilises, cf read_cached_mesh()
+static
+Mesh read_obj_mesh( const char *filename, std::vector<std::string>& dependencies )
 {
     FILE *in= fopen(filename, "rb");
     if(in == NULL)
@@ -70,7 +110,6 @@ Mesh read_mesh( const char *filename )
     std::vector<int> idt;
     std::vector<int> idn;
     
-    char tmp[1024];
     char line_buffer[1024];
     bool error= true;
     for(;;)
@@ -92,53 +131,40 @@ Mesh read_mesh( const char *filename )
         
         if(line[0] == 'v')
         {
-            float x, y, z;
+            float v[3];
             if(line[1] == ' ')          // position x y z
             {
-                if(sscanf(line, "v %f %f %f", &x, &y, &z) != 3)
+                if(parse_floats(line +2, v, 3) != 3)
                     break;
-                positions.push_back( vec3(x, y, z) );
+                positions.push_back( vec3(v[0], v[1], v[2]) );
             }
             else if(line[1] == 'n')     // normal x y z
             {
-                if(sscanf(line, "vn %f %f %f", &x, &y, &z) != 3)
+                if(parse_floats(line +2, v, 3) != 3)
                     break;
-                normals.push_back( vec3(x, y, z) );
+                normals.push_back( vec3(v[0], v[1], v[2]) );
             }
             else if(line[1] == 't')     // texcoord x y
             {
-                if(sscanf(line, "vt %f %f", &x, &y) != 2)
+                if(parse_floats(line +2, v, 2) != 2)
                     break;
-                texcoords.push_back( vec2(x, y) );
+                texcoords.push_back( vec2(v[0], v[1]) );
             }
         }
         
         else if(line[0] == 'f')         // triangle a b c, les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
         {
-            idp.clear();
-            idt.clear();
-            idn.clear();
+            parse_face(line +1, idp, idt, idn);
             
-            int next;
-            for(line= line +1; ; line= line + next)
+            // indices des attributs des sommets, a partir de 0, et corrige les indices invalides
+            for(int k= 0; k < (int) idp.size(); k++)
             {
-                idp.push_back(0); 
-                idt.push_back(0); 
-                idn.push_back(0);         // 0: invalid index
-                
-                // analyse les attributs du sommet : p/t/n ou p//n ou p/t ou p...
-                next= 0;
-                if(sscanf(line, " %d/%d/%d %n", &idp.back(), &idt.back(), &idn.back(), &next) == 3) 
-                    continue;
-                else if(sscanf(line, " %d/%d %n", &idp.back(), &idt.back(), &next) == 2)
-                    continue;
-                else if(sscanf(line, " %d//%d %n", &idp.back(), &idn.back(), &next) == 2)
-                    continue;
-                else if(sscanf(line, " %d %n", &idp.back(), &next) == 1)
-                    continue;
-                else if(next == 0)      // fin de ligne
-                    break;
+                idp[k]= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
+                idt[k]= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
+                idn[k]= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
             }
+            if(!repair_face(idp, idt, idn, positions.size(), texcoords.size(), normals.size()))
+                idp.clear();
             
             // force une matiere par defaut, si necessaire
             if(material_id == -1)
@@ -150,17 +176,15 @@ Mesh read_mesh( const char *filename )
             data.material(material_id);
             
             // triangule la face
-            for(int v= 2; v +1 < (int) idp.size(); v++)
+            for(int v= 2; v < (int) idp.size(); v++)
             {
                 int idv[3]= { 0, v -1, v };
                 for(int i= 0; i < 3; i++)
                 {
                     int k= idv[i];
-                    int p= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
-                    int t= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
-                    int n= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
-                    
-                    if(p < 0) break; // error
+                    int p= idp[k];
+                    int t= idt[k];
+                    int n= idn[k];
                     
                     // attribut du ieme sommet
                     if(t >= 0) data.texcoord(texcoords[t]);
@@ -172,9 +196,11 @@ Mesh read_mesh( const char *filename )
         
         else if(line[0] == 'm')
         {
-           if(sscanf(line, "mtllib %[^\r\n]", tmp) == 1)
+           char *name= parse_keyword(line, "mtllib") ? parse_name(line +6) : nullptr;
+           if(name)
            {
-               Materials materials= read_materials( normalize_filename(pathname(filename) + tmp).c_str() );
+               dependencies.push_back( normalize_filename(pathname(filename) + name) );
+               Materials materials= read_materials( dependencies.back().c_str() );
                // enregistre les matieres dans le mesh
                data.materials(materials);
            }
@@ -182,8 +208,9 @@ Mesh read_mesh( const char *filename )
         
         else if(line[0] == 'u')
         {
-           if(sscanf(line, "usemtl %[^\r\n]", tmp) == 1)
-               material_id= data.materials().find(tmp);
+           char *name= parse_keyword(line, "usemtl") ? parse_name(line +6) : nullptr;
+           if(name)
+               material_id= data.materials().find(name);
         }
     }
     
@@ -192,7 +219,7 @@ Mesh read_mesh( const char *filename )
     if(error)
         printf("[error] loading mesh '%s'...\n%s\n\n", filename, line_buffer);
     else
-        printf("mesh '%s': %d positions %s %s\n", filename, int(data.positions().size()), data.has_texcoord() ? "texcoord" : "", data.has_normal() ? "normal" : "");
+        printf("mesh '%s': %d positions%s%s\n", filename, int(data.positions().size()), data.has_texcoord() ? " texcoord" : "", data.has_normal() ? " normal" : "");
     
     return data;
 }
@@ -221,7 +248,8 @@ struct vertex
 };
 
 
-Mesh read_indexed_mesh( const char *filename )
+static
+Mesh read_obj_indexed_mesh( const char *filename, std::vector<std::string>& dependencies )
 {
     FILE *in= fopen(filename, "rb");
     if(in == NULL)
@@ -245,7 +273,6 @@ Mesh read_indexed_mesh( const char *filename )
     
     std::map<vertex, int> remap;
     
-    char tmp[1024];
     char line_buffer[1024];
     bool error= true;
     for(;;)
@@ -267,53 +294,40 @@ Mesh read_indexed_mesh( const char *filename )
         
         if(line[0] == 'v')
         {
-            float x, y, z;
+            float v[3];
             if(line[1] == ' ')          // position x y z
             {
-                if(sscanf(line, "v %f %f %f", &x, &y, &z) != 3)
+                if(parse_floats(line +2, v, 3) != 3)
                     break;
-                positions.push_back( vec3(x, y, z) );
+                positions.push_back( vec3(v[0], v[1], v[2]) );
             }
             else if(line[1] == 'n')     // normal x y z
             {
-                if(sscanf(line, "vn %f %f %f", &x, &y, &z) != 3)
+                if(parse_floats(line +2, v, 3) != 3)
                     break;
-                normals.push_back( vec3(x, y, z) );
+                normals.push_back( vec3(v[0], v[1], v[2]) );
             }
             else if(line[1] == 't')     // texcoord x y
             {
-                if(sscanf(line, "vt %f %f", &x, &y) != 2)
+                if(parse_floats(line +2, v, 2) != 2)
                     break;
-                texcoords.push_back( vec2(x, y) );
+                texcoords.push_back( vec2(v[0], v[1]) );
             }
         }
         
         else if(line[0] == 'f')         // triangle a b c, les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
         {
-            idp.clear();
-            idt.clear();
-            idn.clear();
+            parse_face(line +1, idp, idt, idn);
             
-            int next;
-            for(line= line +1; ; line= line + next)
+            // indices des attributs des sommets, a partir de 0, et corrige les indices invalides
+            for(int k= 0; k < (int) idp.size(); k++)
             {
-                idp.push_back(0); 
-                idt.push_back(0); 
-                idn.push_back(0);         // 0: invalid index
-                
-                // analyse les attributs du sommet : p/t/n ou p//n ou p/t ou p...
-                next= 0;
-                if(sscanf(line, " %d/%d/%d %n", &idp.back(), &idt.back(), &idn.back(), &next) == 3) 
-                    continue;
-                else if(sscanf(line, " %d/%d %n", &idp.back(), &idt.back(), &next) == 2)
-                    continue;
-                else if(sscanf(line, " %d//%d %n", &idp.back(), &idn.back(), &next) == 2)
-                    continue;
-                else if(sscanf(line, " %d %n", &idp.back(), &next) == 1)
-                    continue;
-                else if(next == 0)      // fin de ligne
-                    break;
+                idp[k]= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
+                idt[k]= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
+                idn[k]= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
             }
+            if(!repair_face(idp, idt, idn, positions.size(), texcoords.size(), normals.size()))
+                idp.clear();
             
             // force une matiere par defaut, si necessaire
             if(material_id == -1)
@@ -325,18 +339,16 @@ Mesh read_indexed_mesh( const char *filename )
             data.material(material_id);
             
             // triangule la face
-            for(int v= 2; v +1 < (int) idp.size(); v++)
+            for(int v= 2; v < (int) idp.size(); v++)
             {
                 int idv[3]= { 0, v -1, v };
                 for(int i= 0; i < 3; i++)
                 {
                     int k= idv[i];
                     // indices des attributs du sommet
-                    int p= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
-                    int t= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
-                    int n= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
-                    
-                    if(p < 0) break; // error
+                    int p= idp[k];
+                    int t= idt[k];
+                    int n= idn[k];
                     
                     // recherche / insere le sommet 
                     auto found= remap.insert( std::make_pair(vertex(material_id, p, t, n), remap.size()) );
@@ -356,9 +368,11 @@ Mesh read_indexed_mesh( const char *filename )
         
         else if(line[0] == 'm')
         {
-           if(sscanf(line, "mtllib %[^\r\n]", tmp) == 1)
+           char *name= parse_keyword(line, "mtllib") ? parse_name(line +6) : nullptr;
+           if(name)
            {
-               Materials materials= read_materials( normalize_filename(pathname(filename) + tmp).c_str() );
+               dependencies.push_back( normalize_filename(pathname(filename) + name) );
+               Materials materials= read_materials( dependencies.back().c_str() );
                // enregistre les matieres dans le mesh
                data.materials(materials);
            }
@@ -366,8 +380,9 @@ Mesh read_indexed_mesh( const char *filename )
         
         else if(line[0] == 'u')
         {
-           if(sscanf(line, "usemtl %[^\r\n]", tmp) == 1)
-               material_id= data.materials().find(tmp);
+           char *name= parse_keyword(line, "usemtl") ? parse_name(line +6) : nullptr;
+           if(name)
+               material_id= data.materials().find(name);
         }
     }
     
@@ -452,6 +467,23 @@ int write_mesh( const Mesh& mesh, const char *filename )
 }
 
 
+Mesh read_mesh( const char *filename, const bool use_cache )
+{
+    std::vector<std::string> dependencies;
+    if(!use_cache)
+        return read_obj_mesh(filename, dependencies);
+    return read_cached_mesh(filename, "mesh", read_obj_mesh);
+}
+
+Mesh read_indexed_mesh( const char *filename, const bool use_cache )
+{
+    std::vector<std::string> dependencies;
+    if(!use_cache)
+        return read_obj_indexed_mesh(filename, dependencies);
+    return read_cached_mesh(filename, "indexed_mesh", read_obj_indexed_mesh);
+}
+
+
 Materials read_materials( const char *filename )
 {
     Materials materials;
@@ -466,7 +498,6 @@ Materials read_materials( const char *filename )
     printf("loading materials '%s'...\n", filename);
     
     Material *material= NULL;
-    char tmp[1024];
     char line_buffer[1024];
     bool error= true;
     for(;;)
@@ -488,9 +519,10 @@ Materials read_materials( const char *filename )
         
         if(line[0] == 'n')
         {
-            if(sscanf(line, "newmtl %[^\r\n]", tmp) == 1)
+            char *name= parse_keyword(line, "newmtl") ? parse_name(line +6) : nullptr;
+            if(name)
             {
-                int id= materials.insert(Material(Black()), tmp);
+                int id= materials.insert(Material(Black()), name);
                 material= &materials.material(id);
             }
         }
@@ -500,32 +532,33 @@ Materials read_materials( const char *filename )
         
         if(line[0] == 'K')
         {
-            float r, g, b;
-            if(sscanf(line, "Kd %f %f %f", &r, &g, &b) == 3)
-                material->diffuse= Color(r, g, b);
-            else if(sscanf(line, "Ks %f %f %f", &r, &g, &b) == 3)
-                material->specular= Color(r, g, b);
-            else if(sscanf(line, "Ke %f %f %f", &r, &g, &b) == 3)
-                material->emission= Color(r, g, b);
+            float c[3];
+            if(parse_keyword(line, "Kd") && parse_floats(line +2, c, 3) == 3)
+                material->diffuse= Color(c[0], c[1], c[2]);
+            else if(parse_keyword(line, "Ks") && parse_floats(line +2, c, 3) == 3)
+                material->specular= Color(c[0], c[1], c[2]);
+            else if(parse_keyword(line, "Ke") && parse_floats(line +2, c, 3) == 3)
+                material->emission= Color(c[0], c[1], c[2]);
         }
         
         else if(line[0] == 'N')
         {
             float n;
-            if(sscanf(line, "Ns %f", &n) == 1)          // Ns, puissance / concentration du reflet, modele blinn phong
+            if(parse_keyword(line, "Ns") && parse_floats(line +2, &n, 1) == 1)          // Ns, puissance / concentration du reflet, modele blinn phong
                 material->ns= n;
         }
         
         else if(line[0] == 'm')
         {
-            if(sscanf(line, "map_Kd %[^\r\n]", tmp) == 1)
-                material->diffuse_texture= materials.insert_texture( normalize_filename(pathname(filename) + tmp).c_str() );
+            char *name= nullptr;
+            if(parse_keyword(line, "map_Kd") && (name= parse_name(line +6)))
+                material->diffuse_texture= materials.insert_texture( normalize_filename(pathname(filename) + name).c_str() );
                 
-            else if(sscanf(line, "map_Ks %[^\r\n]", tmp) == 1)
-                material->specular_texture= materials.insert_texture( normalize_filename(pathname(filename) + tmp).c_str() );
+            else if(parse_keyword(line, "map_Ks") && (name= parse_name(line +6)))
+                material->specular_texture= materials.insert_texture( normalize_filename(pathname(filename) + name).c_str() );
                 
-            else if(sscanf(line, "map_Ke %[^\r\n]", tmp) == 1)
-                material->emission_texture= materials.insert_texture( normalize_filename(pathname(filename) + tmp).c_str() );
+            else if(parse_keyword(line, "map_Ke") && (name= parse_name(line +6)))
+                material->emission_texture= materials.insert_texture( normalize_filename(pathname(filename) + name).c_str() );
         }
         
     }
@@ -12,10 +12,12 @@
 //! charge un fichier wavefront .obj et construit un mesh.
 
 //! charge un fichier wavefront .obj et renvoie un mesh compose de triangles non indexes. utiliser glDrawArrays pour l'afficher. a detruire avec Mesh::release( ).
-Mesh read_mesh( const char *filename );
+//! use_cache : relit le cache binaire du mesh, s'il est a jour, ou le cree, cf read_cached_mesh().
+Mesh read_mesh( const char *filename, const bool use_cache= true );
 
 //! charge un fichier wavefront .obj et renvoie un mesh compose de triangles indexes. utiliser glDrawElements pour l'afficher. a detruire avec Mesh::release( ).
-Mesh read_indexed_mesh( const char *filename );
+//! use_cache : relit le cache binaire du mesh, s'il est a jour, ou le cree, cf read_cached_mesh().
+Mesh read_indexed_mesh( const char *filename, const bool use_cache= true );
 
 //! enregistre un mesh dans un fichier .obj.
 int write_mesh( const Mesh& mesh, const char *filename );
@@ -1,303 +1,670 @@
 
+// off_t sur 64 bits, meme sur les systemes 32 bits, cf StreamAttributes
+#define _FILE_OFFSET_BITS 64
+
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <ctype.h>
 #include <climits>
+#include <cassert>
 
-#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
 #include <algorithm>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "wavefront.h"
 #include "wavefront_fast.h"
+#include "wavefront_parser.h"
+#include "mesh_cache.h"
 
-// parse_int() + parse_float() + tools from fast_obj parser
-// https://github.com/thisistherk/fast_obj 
-int is_whitespace( const char c )
+/*! renvoie le chemin d'acces a un fichier. le chemin est toujours termine par /
+    pathname("path\to\file") == "path/to/"
+    pathname("path\to/file") == "path/to/"
+    pathname("path/to/file") == "path/to/"
+    pathname("file") == "./"
+ */
+static
+std::string pathname( const std::string& filename )
 {
-    return (c == ' ' || c == '\t' || c == '\r');
+    std::string path= filename;
+#ifndef WIN32
+    std::replace(path.begin(), path.end(), '\\', '/');   // linux, macos : remplace les \ par /.
+    size_t slash = path.find_last_of( '/' );
+    if(slash != std::string::npos)
+        return path.substr(0, slash +1); // inclus le slash
+    else
+        return "./";
+#else
+    std::replace(path.begin(), path.end(), '/', '\\');   // windows : remplace les / par \.
+    size_t slash = path.find_last_of( '\\' );
+    if(slash != std::string::npos)
+        return path.substr(0, slash +1); // inclus le slash
+    else
+        return ".\\";
+#endif
 }
 
-int is_digit( const char c )
+static 
+std::string normalize_filename( const std::string& filename )
 {
-    return (c >= '0' && c <= '9');
-}
+    std::string path= filename;
+#ifndef WIN32
+    std::replace(path.begin(), path.end(), '\\', '/');   // linux, macos : remplace les \ par /.
+#else
+    std::replace(path.begin(), path.end(), '/', '\\');   // windows : remplace les / par \.
+#endif
 
-int is_exponent( const char c )
-{
-    return (c == 'e' || c == 'E');
+    return path;
 }
 
-const char* skip_whitespace( const char* ptr )
+// fichier charge en memoire : projete en memoire, ou lu completement si mmap n'est pas disponible
+struct MappedFile
 {
-    while (ptr && is_whitespace(*ptr))
-        ptr++;
-
-    return ptr;
-}
+    const char *data;
+    size_t size;
 
-const char* parse_int( const char* ptr, int* val )
-{
-    ptr = skip_whitespace(ptr);
-    
-    int sign= 0;
-    if (*ptr == '-')
+    MappedFile( const char *filename ) : data(nullptr), size(0), buffer(), mapped(nullptr)
     {
-        sign = -1;
-        ptr++;
+    #ifndef WIN32
+        int fd= open(filename, O_RDONLY);
+        if(fd < 0)
+            return;
+
+        struct stat info;
+        if(fstat(fd, &info) == 0)
+        {
+            if(info.st_size == 0)
+                data= "";   // fichier vide, mmap() echoue
+            else
+            {
+                void *p= mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(p != MAP_FAILED)
+                {
+                    madvise(p, info.st_size, MADV_SEQUENTIAL);
+                    mapped= p;
+                    data= static_cast<const char *>(p);
+                    size= info.st_size;
+                }
+            }
+        }
+        close(fd);
+    #else
+        FILE *in= fopen(filename, "rb");
+        if(in == NULL)
+            return;
+
+        fseek(in, 0, SEEK_END);
+        long length= ftell(in);
+        fseek(in, 0, SEEK_SET);
+        buffer.resize(std::max(0L, length));
+        if(length > 0 && fread(buffer.data(), 1, length, in) == size_t(length))
+        {
+            data= buffer.data();
+            size= length;
+        }
+        else if(length == 0)
+            data= "";
+        fclose(in);
+    #endif
     }
-    else
+
+    ~MappedFile( )
     {
-        sign = +1;
+    #ifndef WIN32
+        if(mapped)
+            munmap(mapped, size);
+    #endif
     }
 
-    int num = 0;
-    while (is_digit(*ptr))
-        num = 10 * num + (*ptr++ - '0');
+protected:
+    MappedFile( const MappedFile& );
+    MappedFile& operator= ( const MappedFile& );
 
-    *val = sign * num;
-    return ptr;
-}
+    std::vector<char> buffer;
+    void *mapped;
+};
 
-/* Max supported power when parsing float */
-#define MAX_POWER               20
 
-static const
-double POWER_10_POS[MAX_POWER] =
+/* morceau du fichier .obj, analyse par un thread, cf parse_obj().
+    les indices des faces sont conserves tels qu'ils sont ecrits dans le fichier : a partir de 1, ou relatifs a la fin des tableaux, s'ils sont negatifs,
+    ils sont corriges lorsque tous les morceaux sont analyses, et que le nombre de sommets des morceaux precedents est connu.
+ */
+struct ObjChunk
 {
-    1.0e0,  1.0e1,  1.0e2,  1.0e3,  1.0e4,  1.0e5,  1.0e6,  1.0e7,  1.0e8,  1.0e9,
-    1.0e10, 1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19,
-};
+    std::vector<vec3> positions;
+    std::vector<vec2> texcoords;
+    std::vector<vec3> normals;
 
-static const
-double POWER_10_NEG[MAX_POWER] =
-{
-    1.0e0,   1.0e-1,  1.0e-2,  1.0e-3,  1.0e-4,  1.0e-5,  1.0e-6,  1.0e-7,  1.0e-8,  1.0e-9,
-    1.0e-10, 1.0e-11, 1.0e-12, 1.0e-13, 1.0e-14, 1.0e-15, 1.0e-16, 1.0e-17, 1.0e-18, 1.0e-19,
+    // faces : nombre de sommets n, puis n triplets position, texcoord, normale, 0 pour un attribut absent.
+    // si la face utilise des indices relatifs, n est negatif, et suivi du nombre de positions, texcoords et normales deja lues dans le morceau
+    std::vector<int> faces;
+    std::vector<int> face;      // sommets de la face en cours d'analyse
+
+    // mtllib et usemtl, dans l'ordre du fichier : position dans faces, et nom
+    struct Command
+    {
+        size_t offset;
+        bool usemtl;
+        std::string name;
+    };
+    std::vector<Command> commands;
+
+    // description des faces, cf build_mesh_parallel()
+    long triangles;
+    bool regular;               // faces d'au moins 3 sommets, avec une position. tous les sommets d'une face, ou aucun, ont une texcoord, et une normale
+    int first_attributes;       // texcoords (1) et normales (2) de la premiere face, ou -1 sans face
+    long last_texcoord;         // position dans faces de la derniere face avec des texcoords, ou -1
+    long last_normal;           // position dans faces de la derniere face avec des normales, ou -1
+
+    ObjChunk( ) : positions(), texcoords(), normals(), faces(), face(), commands(), triangles(0), regular(true), first_attributes(-1), last_texcoord(-1), last_normal(-1) {}
 };
 
-const char* parse_float(const char* ptr, float* val)
+// analyse une ligne, terminee par \n
+static
+void parse_line( const char *line, const char *end, ObjChunk& chunk )
 {
-    ptr = skip_whitespace(ptr);
+    // saute les espaces en debut de ligne
+    line= skip_whitespace(line);
 
-    double sign= 0;
-    switch (*ptr)
+    if(line[0] == 'v')
     {
-    case '+':
-        sign = 1.0;
-        ptr++;
-        break;
+        float x, y, z;
+        if(line[1] == ' ')          // position x y z
+        {
+            line+= 2;
+            line= parse_float(line, &x);
+            line= parse_float(line, &y);
+            line= parse_float(line, &z);
 
-    case '-':
-        sign = -1.0;
-        ptr++;
-        break;
+            chunk.positions.push_back( vec3(x, y, z) );
+        }
+        else if(line[1] == 'n')     // normal x y z
+        {
+            line+= 3;
+            line= parse_float(line, &x);
+            line= parse_float(line, &y);
+            line= parse_float(line, &z);
+
+            chunk.normals.push_back( vec3(x, y, z) );
+        }
+        else if(line[1] == 't')     // texcoord x y
+        {
+            line+= 3;
+            line= parse_float(line, &x);
+            line= parse_float(line, &y);
 
-    default:
-        sign = 1.0;
-        break;
+            chunk.texcoords.push_back( vec2(x, y) );
+        }
     }
 
-    double num= 0.0;
-    while (is_digit(*ptr))
-        num = 10.0 * num + (double)(*ptr++ - '0');
+    else if(line[0] == 'f' && is_whitespace(line[1]))      // face a b c ..., les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
+    {
+        std::vector<int>& face= chunk.face;
+        face.clear();
 
-    if (*ptr == '.')
-        ptr++;
+        bool relative= false;
+        line+= 2;
+        for(;;)
+        {
+            line= skip_whitespace(line);
+            if(line >= end)
+                break;
 
-    double fra= 0;
-    double div= 1;
-    while (is_digit(*ptr))
-    {
-        fra  = 10.0 * fra + (double)(*ptr++ - '0');
-        div *= 10.0;
-    }
+            int p= 0, t= 0, n= 0;       // 0: invalid index
+            const char *next= parse_int(line, &p);
+            if(next == line)
+                break;      // pas un indice, fin de la face
+            line= next;
 
-    num += fra / div;
+            if(*line == '/')
+            {
+                line++;
+                if(*line != '/')
+                    line= parse_int(line, &t);
 
-    if (is_exponent(*ptr))
-    {
-        ptr++;
+                if(*line == '/')
+                {
+                    line++;
+                    line= parse_int(line, &n);
+                }
+            }
 
-        const double* powers= nullptr;
-        switch (*ptr)
+            face.push_back(p);
+            face.push_back(t);
+            face.push_back(n);
+            relative= relative || p < 0 || t < 0 || n < 0;
+        }
+
+        int count= int(face.size()) / 3;
+        int with_texcoord= 0;
+        int with_normal= 0;
+        for(int k= 0; k < count; k++)
         {
-        case '+':
-            powers = POWER_10_POS;
-            ptr++;
-            break;
+            chunk.regular= chunk.regular && face[3*k] != 0;
+            with_texcoord+= (face[3*k +1] != 0);
+            with_normal+= (face[3*k +2] != 0);
+        }
+        chunk.regular= chunk.regular && count >= 3 && (with_texcoord == 0 || with_texcoord == count) && (with_normal == 0 || with_normal == count);
+        chunk.triangles+= std::max(0, count -2);
 
-        case '-':
-            powers = POWER_10_NEG;
-            ptr++;
-            break;
+        if(chunk.first_attributes < 0)
+            chunk.first_attributes= (with_texcoord ? 1 : 0) | (with_normal ? 2 : 0);
+        if(with_texcoord)
+            chunk.last_texcoord= long(chunk.faces.size());
+        if(with_normal)
+            chunk.last_normal= long(chunk.faces.size());
+
+        if(relative)
+        {
+            chunk.faces.push_back(-count);
+            chunk.faces.push_back(int(chunk.positions.size()));
+            chunk.faces.push_back(int(chunk.texcoords.size()));
+            chunk.faces.push_back(int(chunk.normals.size()));
+        }
+        else
+            chunk.faces.push_back(count);
+        chunk.faces.insert(chunk.faces.end(), face.begin(), face.end());
+    }
+
+    else if(line[0] == 'm' || line[0] == 'u')
+    {
+        // mtllib nom, ou usemtl nom, le nom s'arrete a la fin de la ligne
+        bool usemtl= (line[0] == 'u');
+        const char *keyword= usemtl ? "usemtl" : "mtllib";
+        if(end - line < 6 || strncmp(line, keyword, 6) != 0)
+            return;
+
+        const char *name= line + 6;
+        while(name < end && isspace(*name))
+            name++;
+        const char *last= name;
+        while(last < end && *last != '\r')
+            last++;
 
-        default:
-            powers = POWER_10_POS;
+        if(last > name)
+            chunk.commands.push_back( { chunk.faces.size(), usemtl, std::string(name, last) } );
+    }
+}
+
+// analyse les lignes de [begin end), la derniere ligne du fichier n'est pas forcement terminee par \n
+static
+void parse_chunk( const char *begin, const char *end, ObjChunk& chunk )
+{
+    const char *line= begin;
+    while(line < end)
+    {
+        const char *next= static_cast<const char *>(memchr(line, '\n', end - line));
+        if(next == nullptr)
+        {
+            // copie la derniere ligne, pour terminer l'analyse des nombres sur \n, sans lire apres la fin du fichier
+            std::string last(line, end);
+            last.push_back('\n');
+            parse_line(last.data(), last.data() + last.size() -1, chunk);
             break;
         }
 
-        unsigned int eval= 0;
-        while (is_digit(*ptr))
-            eval = 10 * eval + (*ptr++ - '0');
+        parse_line(line, next, chunk);
+        line= next +1;
+    }
+}
+
+/* decoupe le fichier en morceaux, a la fin d'une ligne, et les analyse en parallele.
+    renvoie le nombre d'octets du fichier, ou -1 en cas d'erreur.
+ */
+static
+long parse_obj( const char *filename, std::vector<ObjChunk>& chunks )
+{
+    MappedFile file(filename);
+    if(file.data == nullptr)
+        return -1;
 
-        num *= (eval >= MAX_POWER) ? 0.0 : powers[eval];
+    const size_t chunk_size= 4 << 20;
+    std::vector<size_t> bounds;
+    bounds.push_back(0);
+    while(bounds.back() < file.size)
+    {
+        size_t end= std::min(file.size, bounds.back() + chunk_size);
+        // termine le morceau a la fin de la ligne
+        const char *next= static_cast<const char *>(memchr(file.data + end, '\n', file.size - end));
+        end= next ? size_t(next - file.data) +1 : file.size;
+        bounds.push_back(end);
     }
 
-    *val = (float)(sign * num);
-    return ptr;
+    const int n= int(bounds.size()) -1;
+    chunks.clear();
+    chunks.resize(n);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int i= 0; i < n; i++)
+        parse_chunk(file.data + bounds[i], file.data + bounds[i +1], chunks[i]);
+
+    return long(file.size);
 }
 
+/* indices des attributs des sommets de la face commencant en faces[offset], -1 pour un attribut absent.
+    first_position, first_texcoord, first_normal : nombre d'attributs avant le morceau, pour les indices relatifs. renvoie l'indice de la face suivante.
+ */
+static
+size_t decode_face( const std::vector<int>& faces, size_t offset, const int first_position, const int first_texcoord, const int first_normal,
+    std::vector<int>& idp, std::vector<int>& idt, std::vector<int>& idn )
+{
+    int count= faces[offset++];
 
-/*! renvoie le chemin d'acces a un fichier. le chemin est toujours termine par /
-    pathname("path\to\file") == "path/to/"
-    pathname("path\to/file") == "path/to/"
-    pathname("path/to/file") == "path/to/"
-    pathname("file") == "./"
+    // nombre d'attributs avant la face, pour les indices relatifs
+    int np= 0, nt= 0, nn= 0;
+    if(count < 0)
+    {
+        count= -count;
+        np= first_position + faces[offset];
+        nt= first_texcoord + faces[offset +1];
+        nn= first_normal + faces[offset +2];
+        offset+= 3;
+    }
+
+    idp.resize(count);
+    idt.resize(count);
+    idn.resize(count);
+    for(int k= 0; k < count; k++, offset+= 3)
+    {
+        idp[k]= (faces[offset] < 0) ? np + faces[offset] : faces[offset] -1;
+        idt[k]= (faces[offset +1] < 0) ? nt + faces[offset +1] : faces[offset +1] -1;
+        idn[k]= (faces[offset +2] < 0) ? nn + faces[offset +2] : faces[offset +2] -1;
+    }
+
+    return offset;
+}
+
+// attributs de tous les morceaux, dans l'ordre du fichier, et indices des attributs du premier sommet de chaque morceau
+struct ObjAttributes
+{
+    std::vector<vec3> positions;
+    std::vector<vec2> texcoords;
+    std::vector<vec3> normals;
+
+    std::vector<int> first_position;
+    std::vector<int> first_texcoord;
+    std::vector<int> first_normal;
+
+    ObjAttributes( std::vector<ObjChunk>& chunks ) : positions(), texcoords(), normals(), first_position(), first_texcoord(), first_normal()
+    {
+        // somme prefixe du nombre d'attributs des morceaux
+        int p= 0, t= 0, n= 0;
+        for(int i= 0; i < int(chunks.size()); i++)
+        {
+            first_position.push_back(p);
+            first_texcoord.push_back(t);
+            first_normal.push_back(n);
+            p+= int(chunks[i].positions.size());
+            t+= int(chunks[i].texcoords.size());
+            n+= int(chunks[i].normals.size());
+        }
+
+        positions.resize(p);
+        texcoords.resize(t);
+        normals.resize(n);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(int i= 0; i < int(chunks.size()); i++)
+        {
+            std::copy(chunks[i].positions.begin(), chunks[i].positions.end(), positions.begin() + first_position[i]);
+            std::copy(chunks[i].texcoords.begin(), chunks[i].texcoords.end(), texcoords.begin() + first_texcoord[i]);
+            std::copy(chunks[i].normals.begin(), chunks[i].normals.end(), normals.begin() + first_normal[i]);
+
+            // libere les attributs copies
+            std::vector<vec3>().swap(chunks[i].positions);
+            std::vector<vec2>().swap(chunks[i].texcoords);
+            std::vector<vec3>().swap(chunks[i].normals);
+        }
+    }
+
+    /* indices des attributs des sommets de la face commencant en faces[offset] du morceau chunk, -1 pour un attribut absent.
+        renvoie l'indice de la face suivante.
+     */
+    size_t face( const std::vector<ObjChunk>& chunks, const int chunk, size_t offset, std::vector<int>& idp, std::vector<int>& idt, std::vector<int>& idn ) const
+    {
+        return decode_face(chunks[chunk].faces, offset, first_position[chunk], first_texcoord[chunk], first_normal[chunk], idp, idt, idn);
+    }
+};
+
+// execute les commandes mtllib et usemtl placees avant la face offset
+static
+void obj_commands( const char *filename, const ObjChunk& chunk, size_t& command, const size_t offset, Mesh& data, int& material_id )
+{
+    for(; command < chunk.commands.size() && chunk.commands[command].offset <= offset; command++)
+    {
+        const ObjChunk::Command& c= chunk.commands[command];
+        if(c.usemtl)
+            material_id= data.materials().find(c.name.c_str());
+        else
+        {
+            Materials materials= read_materials( normalize_filename(pathname(filename) + c.name).c_str() );
+            // enregistre les matieres dans le mesh
+            data.materials(materials);
+        }
+    }
+}
+
+/* execute les commandes dans l'ordre du fichier, cf obj_commands(), et note la matiere des faces entre 2 commandes :
+    face_materials[c][i] est la matiere des faces du morceau c placees avant la commande i, ou apres la derniere commande.
  */
 static
-std::string pathname( const std::string& filename )
+void obj_materials( const char *filename, const std::vector<ObjChunk>& chunks, Materials& materials, std::vector<std::vector<int> >& face_materials )
 {
-    std::string path= filename;
-#ifndef WIN32
-    std::replace(path.begin(), path.end(), '\\', '/');   // linux, macos : remplace les \ par /.
-    size_t slash = path.find_last_of( '/' );
-    if(slash != std::string::npos)
-        return path.substr(0, slash +1); // inclus le slash
-    else
-        return "./";
-#else
-    std::replace(path.begin(), path.end(), '/', '\\');   // windows : remplace les / par \.
-    size_t slash = path.find_last_of( '\\' );
-    if(slash != std::string::npos)
-        return path.substr(0, slash +1); // inclus le slash
-    else
-        return ".\\";
-#endif
+    face_materials.assign(chunks.size(), std::vector<int>());
+    int material_id= -1;
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        const ObjChunk& chunk= chunks[c];
+        size_t offset= 0;
+        for(size_t i= 0; i <= chunk.commands.size(); i++)
+        {
+            size_t next= (i < chunk.commands.size()) ? chunk.commands[i].offset : chunk.faces.size();
+            // affecte une matiere par defaut aux faces, si necessaire
+            if(next > offset && material_id == -1)
+                material_id= materials.default_material_index();
+            face_materials[c].push_back(material_id);
+
+            if(i == chunk.commands.size())
+                break;
+
+            const ObjChunk::Command& command= chunk.commands[i];
+            if(command.usemtl)
+                material_id= materials.find(command.name.c_str());
+            else
+                materials= read_materials( normalize_filename(pathname(filename) + command.name).c_str() );
+            offset= next;
+        }
+    }
 }
 
-static 
-std::string normalize_filename( const std::string& filename )
+/* construit le mesh en parallele : chaque morceau ecrit ses triangles a la suite des triangles des morceaux precedents.
+    le resultat est identique a la construction sequentielle, cf read_mesh_fast() et Mesh::vertex() : un sommet sans normale recoit la normale
+    du sommet precedent, idem pour les texcoords.
+    les faces doivent avoir au moins 3 sommets, et tous les sommets d'une face, ou aucun, doivent avoir une normale, et une texcoord.
+    si un sommet a une normale, le premier sommet doit aussi en avoir une, sinon les normales et les positions sont decalees, idem pour les texcoords.
+    renvoie faux sinon, sans modifier data.
+ */
+static
+bool build_mesh_parallel( const char *filename, const std::vector<ObjChunk>& chunks, const ObjAttributes& attributes, Mesh& data )
 {
-    std::string path= filename;
-#ifndef WIN32
-    std::replace(path.begin(), path.end(), '\\', '/');   // linux, macos : remplace les \ par /.
-#else
-    std::replace(path.begin(), path.end(), '/', '\\');   // windows : remplace les / par \.
-#endif
+    const int np= int(attributes.positions.size());
+    const int nt= int(attributes.texcoords.size());
+    const int nn= int(attributes.normals.size());
 
-    return path;
+    // somme prefixe du nombre de triangles des morceaux, et derniers attributs des morceaux precedents
+    std::vector<long> first_triangle;
+    std::vector<vec2> first_texcoord;
+    std::vector<vec3> first_normal;
+    long triangles= 0;
+    int first_attributes= -1;
+    bool with_texcoords= false;
+    bool with_normals= false;
+    vec2 texcoord;
+    vec3 normal;
+    std::vector<int> idp, idt, idn;
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        const ObjChunk& chunk= chunks[c];
+        if(!chunk.regular)
+            return false;
+
+        first_triangle.push_back(triangles);
+        first_texcoord.push_back(texcoord);
+        first_normal.push_back(normal);
+        triangles+= chunk.triangles;
+        if(first_attributes < 0)
+            first_attributes= chunk.first_attributes;
+
+        // le dernier sommet d'une face est aussi le dernier sommet de son dernier triangle
+        if(chunk.last_texcoord >= 0)
+        {
+            with_texcoords= true;
+            attributes.face(chunks, c, chunk.last_texcoord, idp, idt, idn);
+            if(idt.back() < 0 || idt.back() >= nt)
+                return false;
+            texcoord= attributes.texcoords[idt.back()];
+        }
+        if(chunk.last_normal >= 0)
+        {
+            with_normals= true;
+            attributes.face(chunks, c, chunk.last_normal, idp, idt, idn);
+            if(idn.back() < 0 || idn.back() >= nn)
+                return false;
+            normal= attributes.normals[idn.back()];
+        }
+    }
+    if((with_texcoords && !(first_attributes & 1)) || (with_normals && !(first_attributes & 2)))
+        return false;
+
+    Materials materials;
+    std::vector<std::vector<int> > face_materials;
+    obj_materials(filename, chunks, materials, face_materials);
+
+    std::vector<vec3> positions(3 * triangles);
+    std::vector<vec2> texcoords(with_texcoords ? 3 * triangles : 0);
+    std::vector<vec3> normals(with_normals ? 3 * triangles : 0);
+    std::vector<unsigned int> triangle_materials(triangles);
+    std::vector<int> errors(chunks.size(), 0);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        const ObjChunk& chunk= chunks[c];
+        std::vector<int> idp, idt, idn;
+        long triangle= first_triangle[c];
+        vec2 texcoord= first_texcoord[c];
+        vec3 normal= first_normal[c];
+        size_t command= 0;
+        for(size_t offset= 0; offset < chunk.faces.size(); )
+        {
+            while(command < chunk.commands.size() && chunk.commands[command].offset <= offset)
+                command++;
+            int material= face_materials[c][command];
+            offset= attributes.face(chunks, c, offset, idp, idt, idn);
+
+            // triangulation de la face (supposee convexe)
+            for(int v= 2; v < int(idp.size()); v++, triangle++)
+            {
+                triangle_materials[triangle]= material;
+
+                int idv[3]= { 0, v -1, v };
+                for(int i= 0; i < 3; i++)
+                {
+                    int k= idv[i];
+                    if(idp[k] < 0 || idp[k] >= np || idt[k] >= nt || idn[k] >= nn)
+                    {
+                        errors[c]= 1;
+                        continue;
+                    }
+
+                    // sommet sans texcoord ou sans normale : copie celle du sommet precedent
+                    if(idt[k] >= 0) texcoord= attributes.texcoords[idt[k]];
+                    if(idn[k] >= 0) normal= attributes.normals[idn[k]];
+
+                    positions[3 * triangle + i]= attributes.positions[idp[k]];
+                    if(texcoords.size()) texcoords[3 * triangle + i]= texcoord;
+                    if(normals.size()) normals[3 * triangle + i]= normal;
+                }
+            }
+        }
+    }
+
+    // indice invalide, la construction sequentielle traite l'erreur
+    if(std::count(errors.begin(), errors.end(), 1) > 0)
+        return false;
+
+    data= Mesh(GL_TRIANGLES, std::move(positions), std::move(texcoords), std::move(normals), std::vector<unsigned int>(), materials, std::move(triangle_materials));
+    return true;
 }
 
-Mesh read_mesh_fast( const char *filename )
+// fichiers .mtl utilises par le fichier .obj, cf read_cached_mesh()
+static
+void obj_dependencies( const char *filename, const std::vector<ObjChunk>& chunks, std::vector<std::string>& dependencies )
 {
-    FILE *in= fopen(filename, "rb");
-    if(in == NULL)
+    for(int c= 0; c < int(chunks.size()); c++)
+    for(int i= 0; i < int(chunks[c].commands.size()); i++)
+        if(!chunks[c].commands[i].usemtl)
+            dependencies.push_back( normalize_filename(pathname(filename) + chunks[c].commands[i].name) );
+}
+
+
+static
+Mesh read_obj_mesh_fast( const char *filename, std::vector<std::string>& dependencies )
+{
+    auto start= std::chrono::high_resolution_clock::now();
+
+    std::vector<ObjChunk> chunks;
+    long bytes= parse_obj(filename, chunks);
+    if(bytes < 0)
     {
         printf("[error] loading mesh '%s'...\n", filename);
         return Mesh::error();
     }
-    
+    obj_dependencies(filename, chunks, dependencies);
+
     Mesh data(GL_TRIANGLES);
-    
+
     printf("loading mesh '%s'...\n", filename);
-    
-    std::vector<vec3> positions;
-    std::vector<vec2> texcoords;
-    std::vector<vec3> normals;
+
+    ObjAttributes attributes(chunks);
+    const std::vector<vec3>& positions= attributes.positions;
+    const std::vector<vec2>& texcoords= attributes.texcoords;
+    const std::vector<vec3>& normals= attributes.normals;
     int material_id= -1;
-    
+
     std::vector<int> idp;
     std::vector<int> idt;
     std::vector<int> idn;
-    
-    char tmp[1024];
-    char line_buffer[1024];
-    bool error= true;
-    for(;;)
+
+    // construit le mesh en parallele, ou dans l'ordre du fichier, si les faces ne sont pas toutes completes
+    bool parallel= build_mesh_parallel(filename, chunks, attributes, data);
+    for(int c= 0; !parallel && c < int(chunks.size()); c++)
     {
-        // charge une ligne du fichier
-        if(fgets(line_buffer, sizeof(line_buffer), in) == NULL)
-        {
-            error= false;       // fin du fichier, pas d'erreur detectee
-            break;
-        }
-        
-        // force la fin de la ligne, au cas ou
-        line_buffer[sizeof(line_buffer) -1]= 0;
-        
-        // saute les espaces en debut de ligne
-        const char *line= line_buffer;
-        while(*line && isspace(*line))
-            line++;
-        
-        if(line[0] == 'v')
-        {
-            float x, y, z;
-            if(line[1] == ' ')          // position x y z
-            {
-                line+= 2;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                line= parse_float(line, &z);
-                
-                positions.push_back( vec3(x, y, z) );
-            }
-            else if(line[1] == 'n')     // normal x y z
-            {
-                line+= 3;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                line= parse_float(line, &z);
-                
-                normals.push_back( vec3(x, y, z) );
-            }
-            else if(line[1] == 't')     // texcoord x y
-            {
-                line+= 3;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                
-                texcoords.push_back( vec2(x, y) );
-            }
-        }
-        
-        else if(line[0] == 'f')         // triangle a b c, les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
+        const ObjChunk& chunk= chunks[c];
+        size_t command= 0;
+        for(size_t offset= 0; offset < chunk.faces.size(); )
         {
-            idp.clear();
-            idt.clear();
-            idn.clear();
-            
-            line+= 2;
-            while(*line)
-            {
-                idp.push_back(0); 
-                idt.push_back(0); 
-                idn.push_back(0);         // 0: invalid index
-                
-                line= parse_int(line, &idp.back());
-                if(*line == '/')
-                {
-                    line++;
-                    if(*line != '/')
-                        line= parse_int(line, &idt.back());
-                    
-                    if(*line == '/')
-                    {
-                        line++;
-                        line= parse_int(line, &idn.back());
-                    }
-                }
-                
-                while(*line && isspace(*line))
-                    line++;
-            }
-        
+            obj_commands(filename, chunk, command, offset, data, material_id);
+            offset= attributes.face(chunks, c, offset, idp, idt, idn);
+            if(!repair_face(idp, idt, idn, positions.size(), texcoords.size(), normals.size()))
+                idp.clear();
+
             // verifie qu'une matiere est deja definie pour le triangle
             if(material_id == -1)
                 // sinon affecte une matiere par defaut
                 material_id= data.materials().default_material_index();
-            
+
             data.material(material_id);
-            
+
             // triangulation de la face (supposee convexe)
             for(int v= 2; v < int(idp.size()); v++)
             {
@@ -305,42 +672,24 @@ Mesh read_mesh_fast( const char *filename )
                 for(int i= 0; i < 3; i++)
                 {
                     int k= idv[i];
-                    int p= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
-                    int t= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
-                    int n= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
-                    
-                    if(p < 0) break; // error
+                    int p= idp[k];
+                    int t= idt[k];
+                    int n= idn[k];
+
                     if(t >= 0) data.texcoord(texcoords[t]);
                     if(n >= 0) data.normal(normals[n]);
                     data.vertex(positions[p]);
                 }
             }
         }
-        
-        else if(line[0] == 'm')
-        {
-           if(sscanf(line, "mtllib %[^\r\n]", tmp) == 1)
-           {
-               Materials materials= read_materials( normalize_filename(pathname(filename) + tmp).c_str() );
-               // enregistre les matieres dans le mesh
-               data.materials(materials);
-           }
-        }
-        
-        else if(line[0] == 'u')
-        {
-           if(sscanf(line, "usemtl %[^\r\n]", tmp) == 1)
-               material_id= data.materials().find(tmp);
-        }
+        obj_commands(filename, chunk, command, chunk.faces.size(), data, material_id);
     }
-    
-    fclose(in);
-    
-    if(error)
-        printf("[error] loading mesh '%s'...\n%s\n\n", filename, line_buffer);
-    else
-        printf("mesh '%s': %d positions %s %s\n", filename, int(data.positions().size()), data.has_texcoord() ? "texcoord" : "", data.has_normal() ? "normal" : "");
-    
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    float ms= std::chrono::duration<float, std::milli>(stop - start).count();
+    printf("mesh '%s': %d positions%s%s, %.1fMB/s\n", filename, int(data.positions().size()), data.has_texcoord() ? " texcoord" : "", data.has_normal() ? " normal" : "",
+        ms > 0 ? bytes / ms / 1000 : 0.f);
+
     return data;
 }
 
@@ -356,123 +705,245 @@ struct vertex
     vertex( ) : material(-1), position(-1), texcoord(-1), normal(-1) {}
     vertex( const int m, const int p, const int t, const int n ) : material(m), position(p), texcoord(t), normal(n) {}
     
-    // comparaison lexicographique de 2 sommets / des indices de leurs attributs
-    bool operator< ( const vertex& b ) const
+    bool operator== ( const vertex& b ) const
     {
-        if(material != b.material) return material < b.material;
-        if(position != b.position) return position < b.position;
-        if(texcoord != b.texcoord) return texcoord < b.texcoord;
-        if(normal != b.normal) return normal < b.normal;
-        return false;
+        return material == b.material && position == b.position && texcoord == b.texcoord && normal == b.normal;
     }
 };
 
+/* indexation des sommets : table de hachage, adressage ouvert et sondage lineaire, cf read_indexed_mesh_fast().
+    les sommets sont ranges dans l'ordre d'insertion, leur indice est aussi leur indice dans le mesh, et la table ne stocke que cet indice.
+    les 2 tableaux sont alloues une seule fois, pour le nombre maximum de sommets, la table n'est jamais redimensionnee.
+ */
+struct VertexMap
+{
+    std::vector<vertex> vertices;       // sommets, dans l'ordre d'insertion
+    std::vector<int> slots;             // indice du sommet, ou -1 pour une case libre
+    unsigned int mask;
+
+    // n : nombre maximum de sommets
+    VertexMap( const size_t n ) : vertices(), slots(), mask(0)
+    {
+        // remplissage de la table <= 2/3
+        size_t capacity= 16;
+        while(capacity < n + n / 2)
+            capacity*= 2;
+
+        slots.assign(capacity, -1);
+        mask= unsigned(capacity -1);
+        vertices.reserve(n);
+    }
+
+    int size( ) const { return int(vertices.size()); }
+
+    // renvoie l'indice du sommet, l'insere s'il n'est pas encore dans la table
+    int insert( const vertex& v )
+    {
+        assert(vertices.size() < slots.size());
+        for(unsigned int slot= hash(v) & mask;; slot= (slot +1) & mask)
+        {
+            int id= slots[slot];
+            if(id < 0)
+            {
+                id= int(vertices.size());
+                slots[slot]= id;
+                vertices.push_back(v);
+                return id;
+            }
+
+            if(vertices[id] == v)
+                return id;
+        }
+    }
+
+protected:
+    // melange les indices, cf murmurhash3 finalizer
+    static unsigned int hash( const vertex& v )
+    {
+        unsigned int h= unsigned(v.material) * 0x9e3779b1u;
+        h= (h ^ unsigned(v.position)) * 0x85ebca6bu;
+        h= (h ^ unsigned(v.texcoord)) * 0xc2b2ae35u;
+        h= (h ^ unsigned(v.normal)) * 0x27d4eb2fu;
+        h^= h >> 16;
+        h*= 0x85ebca6bu;
+        h^= h >> 13;
+        return h;
+    }
+};
+
+
+/* construit le mesh indexe en parallele : chaque morceau indexe ses sommets, puis les sommets des morceaux sont fusionnes, dans l'ordre du fichier.
+    un sommet garde l'indice de sa premiere apparition dans le fichier, le resultat est identique a la construction sequentielle, cf read_indexed_mesh_fast().
+    si un sommet a une normale, le premier sommet doit aussi en avoir une, idem pour les texcoords.
+    renvoie faux sinon, sans modifier data.
+ */
+static
+bool build_indexed_mesh_parallel( const char *filename, const std::vector<ObjChunk>& chunks, const ObjAttributes& attributes, Mesh& data )
+{
+    const int np= int(attributes.positions.size());
+    const int nt= int(attributes.texcoords.size());
+    const int nn= int(attributes.normals.size());
+
+    std::vector<long> first_triangle;
+    long triangles= 0;
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        first_triangle.push_back(triangles);
+        triangles+= chunks[c].triangles;
+    }
+
+    Materials materials;
+    std::vector<std::vector<int> > face_materials;
+    obj_materials(filename, chunks, materials, face_materials);
+
+    // indexe les sommets de chaque morceau
+    std::vector<VertexMap> maps(chunks.size(), VertexMap(0));
+    std::vector<std::vector<int> > chunk_indices(chunks.size());
+    std::vector<unsigned int> triangle_materials(triangles);
+    std::vector<int> errors(chunks.size(), 0);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        const ObjChunk& chunk= chunks[c];
+        VertexMap& map= maps[c];
+        map= VertexMap(3 * chunk.triangles);
+        std::vector<int>& indices= chunk_indices[c];
+        indices.reserve(3 * chunk.triangles);
+
+        std::vector<int> idp, idt, idn;
+        long triangle= first_triangle[c];
+        size_t command= 0;
+        for(size_t offset= 0; offset < chunk.faces.size(); )
+        {
+            while(command < chunk.commands.size() && chunk.commands[command].offset <= offset)
+                command++;
+            int material= face_materials[c][command];
+            offset= attributes.face(chunks, c, offset, idp, idt, idn);
+
+            // triangule la face
+            for(int v= 2; v < int(idp.size()); v++, triangle++)
+            {
+                triangle_materials[triangle]= material;
+
+                int idv[3]= { 0, v -1, v };
+                for(int i= 0; i < 3; i++)
+                {
+                    int k= idv[i];
+                    if(idp[k] < 0 || idp[k] >= np || idt[k] < -1 || idt[k] >= nt || idn[k] < -1 || idn[k] >= nn)
+                        errors[c]= 1;
+
+                    indices.push_back(map.insert( vertex(material, idp[k], idt[k], idn[k]) ));
+                }
+            }
+        }
+    }
+
+    // indice invalide, la construction sequentielle traite l'erreur
+    if(std::count(errors.begin(), errors.end(), 1) > 0)
+        return false;
+
+    // fusionne les sommets des morceaux, dans l'ordre du fichier
+    size_t n= 0;
+    for(int c= 0; c < int(maps.size()); c++)
+        n+= maps[c].size();
+
+    VertexMap remap(n);
+    std::vector<std::vector<int> > chunk_remap(chunks.size());
+    for(int c= 0; c < int(maps.size()); c++)
+    {
+        const std::vector<vertex>& vertices= maps[c].vertices;
+        chunk_remap[c].resize(vertices.size());
+        for(int i= 0; i < int(vertices.size()); i++)
+            chunk_remap[c][i]= remap.insert(vertices[i]);
+
+        // libere la table du morceau
+        maps[c]= VertexMap(0);
+    }
+
+    // attributs des sommets, un sommet sans texcoord ou sans normale copie celle du sommet precedent, cf Mesh::vertex()
+    const std::vector<vertex>& vertices= remap.vertices;
+    bool with_texcoords= false;
+    bool with_normals= false;
+    for(int i= 0; i < int(vertices.size()); i++)
+    {
+        with_texcoords= with_texcoords || vertices[i].texcoord >= 0;
+        with_normals= with_normals || vertices[i].normal >= 0;
+    }
+    if(vertices.size() && ((with_texcoords && vertices[0].texcoord < 0) || (with_normals && vertices[0].normal < 0)))
+        return false;
+
+    std::vector<vec3> positions(vertices.size());
+    std::vector<vec2> texcoords(with_texcoords ? vertices.size() : 0);
+    std::vector<vec3> normals(with_normals ? vertices.size() : 0);
+    for(int i= 0; i < int(vertices.size()); i++)
+    {
+        positions[i]= attributes.positions[vertices[i].position];
+        if(with_texcoords)
+            texcoords[i]= (vertices[i].texcoord < 0) ? texcoords[i -1] : attributes.texcoords[vertices[i].texcoord];
+        if(with_normals)
+            normals[i]= (vertices[i].normal < 0) ? normals[i -1] : attributes.normals[vertices[i].normal];
+    }
+
+    // index buffer
+    std::vector<unsigned int> indices(3 * triangles);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int c= 0; c < int(chunks.size()); c++)
+    {
+        const std::vector<int>& local= chunk_indices[c];
+        for(int i= 0; i < int(local.size()); i++)
+            indices[3 * first_triangle[c] + i]= chunk_remap[c][local[i]];
+    }
 
-Mesh read_indexed_mesh_fast( const char *filename )
+    data= Mesh(GL_TRIANGLES, std::move(positions), std::move(texcoords), std::move(normals), std::move(indices), materials, std::move(triangle_materials));
+    return true;
+}
+
+
+static
+Mesh read_obj_indexed_mesh_fast( const char *filename, std::vector<std::string>& dependencies )
 {
-    FILE *in= fopen(filename, "rb");
-    if(in == NULL)
+    std::vector<ObjChunk> chunks;
+    if(parse_obj(filename, chunks) < 0)
     {
         printf("[error] loading indexed mesh '%s'...\n", filename);
         return Mesh::error();
     }
+    obj_dependencies(filename, chunks, dependencies);
     
     Mesh data(GL_TRIANGLES);
     
     printf("loading indexed mesh '%s'...\n", filename);
     
-    std::vector<vec3> positions;
-    std::vector<vec2> texcoords;
-    std::vector<vec3> normals;
+    ObjAttributes attributes(chunks);
+    const std::vector<vec3>& positions= attributes.positions;
+    const std::vector<vec2>& texcoords= attributes.texcoords;
+    const std::vector<vec3>& normals= attributes.normals;
     int material_id= -1;
     
     std::vector<int> idp;
     std::vector<int> idt;
     std::vector<int> idn;
     
-    std::map<vertex, int> remap;
-    
-    char tmp[1024];
-    char line_buffer[1024];
-    bool error= true;
-    for(;;)
+    // construit le mesh en parallele, ou dans l'ordre du fichier, si les attributs des sommets sont incomplets
+    bool parallel= build_indexed_mesh_parallel(filename, chunks, attributes, data);
+
+    long triangles= 0;
+    for(int c= 0; c < int(chunks.size()); c++)
+        triangles+= chunks[c].triangles;
+    VertexMap remap(parallel ? 0 : 3 * triangles);
+
+    for(int c= 0; !parallel && c < int(chunks.size()); c++)
     {
-        // charge une ligne du fichier
-        if(fgets(line_buffer, sizeof(line_buffer), in) == NULL)
-        {
-            error= false;       // fin du fichier, pas d'erreur detectee
-            break;
-        }
-        
-        // force la fin de la ligne, au cas ou
-        line_buffer[sizeof(line_buffer) -1]= 0;
-        
-        // saute les espaces en debut de ligne
-        const char *line= line_buffer;
-        while(*line && isspace(*line))
-            line++;
-        
-        if(line[0] == 'v')
-        {
-            float x, y, z;
-            if(line[1] == ' ')          // position x y z
-            {
-                line+= 2;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                line= parse_float(line, &z);
-                
-                positions.push_back( vec3(x, y, z) );
-            }
-            else if(line[1] == 'n')     // normal x y z
-            {
-                line+= 3;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                line= parse_float(line, &z);
-                
-                normals.push_back( vec3(x, y, z) );
-            }
-            else if(line[1] == 't')     // texcoord x y
-            {
-                line+= 3;
-                line= parse_float(line, &x);
-                line= parse_float(line, &y);
-                
-                texcoords.push_back( vec2(x, y) );
-            }
-        }
-        
-        else if(line[0] == 'f')         // triangle a b c, les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
+        const ObjChunk& chunk= chunks[c];
+        size_t command= 0;
+        for(size_t offset= 0; offset < chunk.faces.size(); )
         {
-            idp.clear();
-            idt.clear();
-            idn.clear();
-            
-            line+= 2;
-            while(*line)
-            {
-                idp.push_back(0); 
-                idt.push_back(0); 
-                idn.push_back(0);         // 0: invalid index
-                
-                line= parse_int(line, &idp.back());
-                if(*line == '/')
-                {
-                    line++;
-                    if(*line != '/')
-                        line= parse_int(line, &idt.back());
-                    
-                    if(*line == '/')
-                    {
-                        line++;
-                        line= parse_int(line, &idn.back());
-                    }
-                }
-                
-                while(*line && isspace(*line))
-                    line++;
-            }
+            obj_commands(filename, chunk, command, offset, data, material_id);
+            offset= attributes.face(chunks, c, offset, idp, idt, idn);
+            if(!repair_face(idp, idt, idn, positions.size(), texcoords.size(), normals.size()))
+                idp.clear();
             
             // force une matiere par defaut, si necessaire
             if(material_id == -1)
@@ -481,25 +952,25 @@ Mesh read_indexed_mesh_fast( const char *filename )
                 printf("usemtl default\n");
             }
             
-            data.material(material_id);
-            
             // triangule la face
             for(int v= 2; v < int(idp.size()); v++)
             {
+                // une matiere par triangle, Mesh::vertex() ne la recopie pas pour les triangles indexes
+                data.material(material_id);
+                
                 int idv[3]= { 0, v -1, v };
                 for(int i= 0; i < 3; i++)
                 {
                     int k= idv[i];
                     // indices des attributs du sommet
-                    int p= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
-                    int t= (idt[k] < 0) ? (int) texcoords.size() + idt[k] : idt[k] -1;
-                    int n= (idn[k] < 0) ? (int) normals.size()   + idn[k] : idn[k] -1;
-                    
-                    if(p < 0) break; // error
+                    int p= idp[k];
+                    int t= idt[k];
+                    int n= idn[k];
                     
                     // recherche / insere le sommet 
-                    auto found= remap.insert( std::make_pair(vertex(material_id, p, t, n), remap.size()) );
-                    if(found.second)
+                    int count= remap.size();
+                    int id= remap.insert( vertex(material_id, p, t, n) );
+                    if(id == count)
                     {
                         // pas trouve, copie les nouveaux attributs
                         if(t != -1) data.texcoord(texcoords[t]);
@@ -508,35 +979,341 @@ Mesh read_indexed_mesh_fast( const char *filename )
                     }
                     
                     // construit l'index buffer
-                    data.index(found.first->second);
+                    data.index(id);
                 }
             }
         }
-        
-        else if(line[0] == 'm')
+        obj_commands(filename, chunk, command, chunk.faces.size(), data, material_id);
+    }
+    
+    printf("  %d indices, %d positions %d texcoords %d normals\n", 
+        int(data.indices().size()), int(data.positions().size()), int(data.texcoords().size()), int(data.normals().size()));
+    
+    return data;
+}
+
+
+Mesh read_mesh_fast( const char *filename, const bool use_cache )
+{
+    std::vector<std::string> dependencies;
+    if(!use_cache)
+        return read_obj_mesh_fast(filename, dependencies);
+    return read_cached_mesh(filename, "fast_mesh", read_obj_mesh_fast);
+}
+
+Mesh read_indexed_mesh_fast( const char *filename, const bool use_cache )
+{
+    std::vector<std::string> dependencies;
+    if(!use_cache)
+        return read_obj_indexed_mesh_fast(filename, dependencies);
+    return read_cached_mesh(filename, "fast_indexed_mesh", read_obj_indexed_mesh_fast);
+}
+
+
+// se place a offset octets du debut du fichier, cf mesh_cache.cpp
+static
+int seek( FILE *file, const uint64_t offset )
+{
+#ifdef WIN32
+    return _fseeki64(file, int64_t(offset), SEEK_SET);
+#else
+    return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+}
+
+/* attributs des sommets lus par MeshStream. seuls la derniere page, en cours de remplissage, et quelques pages relues restent en memoire,
+    les pages pleines sont ecrites dans un fichier temporaire. les faces d'un fichier .obj utilisent, en general, des sommets definis peu avant,
+    et les pages relues restent dans un petit cache, un emplacement par page, cf operator[].
+    si le fichier temporaire ne peut pas etre cree, ou ecrit, les attributs suivants restent en memoire.
+ */
+template < typename T >
+struct StreamAttributes
+{
+    enum { PAGE_SIZE= 1 << 14, CACHE_SIZE= 16 };
+
+    FILE *file;                     // pages pleines, ou nullptr
+    std::vector<T> page;            // derniere page
+    std::vector<T> cache;           // pages relues, CACHE_SIZE pages
+    std::vector<int> cache_pages;   // page relue dans chaque emplacement du cache, ou -1
+    int pages;                      // nombre de pages ecrites dans le fichier
+    bool spill;
+
+    StreamAttributes( ) : file(nullptr), page(), cache(), cache_pages(CACHE_SIZE, -1), pages(0), spill(true) {}
+    ~StreamAttributes( ) { if(file) fclose(file); }
+
+    int size( ) const { return pages * int(PAGE_SIZE) + int(page.size()); }
+    size_t memory( ) const { return (page.capacity() + cache.capacity()) * sizeof(T); }
+
+    void push_back( const T& v )
+    {
+        page.push_back(v);
+        if(spill && page.size() == size_t(PAGE_SIZE))
+            write_page();
+    }
+
+    // renvoie l'attribut id, 0 <= id < size(). la reference reste valide jusqu'au prochain appel
+    const T& operator[] ( const int id )
+    {
+        int p= id / PAGE_SIZE;
+        if(p >= pages)
+            return page[id - pages * PAGE_SIZE];
+
+        int slot= p % CACHE_SIZE;
+        T *data= cache.data() + size_t(slot) * PAGE_SIZE;
+        if(cache_pages[slot] != p)
         {
-           if(sscanf(line, "mtllib %[^\r\n]", tmp) == 1)
-           {
-               Materials materials= read_materials( normalize_filename(pathname(filename) + tmp).c_str() );
-               // enregistre les matieres dans le mesh
-               data.materials(materials);
-           }
+            if(seek(file, uint64_t(p) * PAGE_SIZE * sizeof(T)) != 0 || fread(data, sizeof(T), PAGE_SIZE, file) != size_t(PAGE_SIZE))
+            {
+                printf("[error] reading mesh stream attributes...\n");
+                std::fill(data, data + PAGE_SIZE, T());
+            }
+            cache_pages[slot]= p;
         }
-        
-        else if(line[0] == 'u')
+        return data[id % PAGE_SIZE];
+    }
+
+    // ecrit la derniere page dans le fichier temporaire
+    void write_page( )
+    {
+        if(file == nullptr)
+            file= tmpfile();
+        if(file == nullptr || seek(file, uint64_t(pages) * PAGE_SIZE * sizeof(T)) != 0 || fwrite(page.data(), sizeof(T), PAGE_SIZE, file) != size_t(PAGE_SIZE))
         {
-           if(sscanf(line, "usemtl %[^\r\n]", tmp) == 1)
-               material_id= data.materials().find(tmp);
+            // garde les attributs en memoire
+            spill= false;
+            return;
         }
+
+        if(cache.empty())
+            cache.resize(size_t(CACHE_SIZE) * PAGE_SIZE);
+        pages++;
+        page.clear();
+    }
+};
+
+
+MeshStream::MeshStream( const char *filename, const int batch_size ) : m_filename(filename), m_file(nullptr), m_buffer(), m_carry(0), m_batch_size(std::max(1, batch_size)),
+    m_chunk(new ObjChunk()), m_face(0), m_command(0), m_first_position(0), m_first_texcoord(0), m_first_normal(0), m_idp(), m_idt(), m_idn(),
+    m_positions(new StreamAttributes<vec3>()), m_texcoords(new StreamAttributes<vec2>()), m_normals(new StreamAttributes<vec3>()), m_materials(), m_material_id(-1), m_texcoord(), m_normal(), m_has_texcoord(false), m_has_normal(false),
+    m_triangles(), m_triangle_materials(), m_next(0), m_first(0), m_error(false)
+{
+    m_file= fopen(filename, "rb");
+    if(m_file == nullptr)
+    {
+        printf("[error] loading mesh '%s'...\n", filename);
+        m_error= true;
+        return;
+    }
+
+    printf("loading mesh stream '%s'...\n", filename);
+}
+
+MeshStream::~MeshStream( )
+{
+    if(m_file)
+        fclose(m_file);
+    delete m_chunk;
+    delete m_positions;
+    delete m_texcoords;
+    delete m_normals;
+}
+
+size_t MeshStream::memory( ) const
+{
+    return m_buffer.capacity() + m_chunk->faces.capacity() * sizeof(int)
+        + m_positions->memory() + m_texcoords->memory() + m_normals->memory()
+        + m_triangles.capacity() * sizeof(TriangleData) + m_triangle_materials.capacity() * sizeof(int);
+}
+
+bool MeshStream::next( MeshBatch& batch )
+{
+    // supprime les triangles deja transmis, puis construit les triangles des faces suivantes
+    m_triangles.erase(m_triangles.begin(), m_triangles.begin() + m_next);
+    m_triangle_materials.erase(m_triangle_materials.begin(), m_triangle_materials.begin() + m_next);
+    m_next= 0;
+
+    while(m_triangles.size() < size_t(m_batch_size))
+    {
+        if(!read_face() && !read_block())
+            break;
+    }
+
+    size_t n= std::min(m_triangles.size(), size_t(m_batch_size));
+    if(n == 0)
+        return false;
+
+    batch.first= m_first;
+    batch.triangles.assign(m_triangles.begin(), m_triangles.begin() + n);
+    batch.materials.assign(m_triangle_materials.begin(), m_triangle_materials.begin() + n);
+    m_next= n;
+    m_first+= int(n);
+    return true;
+}
+
+// lit et analyse le bloc suivant du fichier, renvoie faux a la fin du fichier
+bool MeshStream::read_block( )
+{
+    if(m_file == nullptr)
+        return false;
+
+    const size_t block_size= 1 << 20;
+    if(m_buffer.size() < m_carry + block_size)
+        m_buffer.resize(m_carry + block_size);
+
+    size_t size= m_carry + fread(m_buffer.data() + m_carry, 1, block_size, m_file);
+    bool end= (size < m_carry + block_size);
+
+    // termine le bloc a la fin de la derniere ligne complete
+    size_t length= size;
+    if(!end)
+    {
+        while(length > 0 && m_buffer[length -1] != '\n')
+            length--;
+
+        if(length == 0)
+        {
+            // pas de fin de ligne dans le bloc, lit la suite de la ligne
+            m_carry= size;
+            return true;
+        }
+    }
+
+    ObjChunk& chunk= *m_chunk;
+    chunk= ObjChunk();
+    parse_chunk(m_buffer.data(), m_buffer.data() + length, chunk);
+    m_face= 0;
+    m_command= 0;
+
+    // garde le debut de la derniere ligne, pour le prochain bloc
+    std::copy(m_buffer.begin() + length, m_buffer.begin() + size, m_buffer.begin());
+    m_carry= size - length;
+
+    if(end)
+    {
+        fclose(m_file);
+        m_file= nullptr;
+    }
+
+    // attributs des sommets
+    m_first_position= m_positions->size();
+    m_first_texcoord= m_texcoords->size();
+    m_first_normal= m_normals->size();
+    for(size_t i= 0; i < chunk.positions.size(); i++)
+        m_positions->push_back(chunk.positions[i]);
+    for(size_t i= 0; i < chunk.texcoords.size(); i++)
+        m_texcoords->push_back(chunk.texcoords[i]);
+    for(size_t i= 0; i < chunk.normals.size(); i++)
+        m_normals->push_back(chunk.normals[i]);
+    std::vector<vec3>().swap(chunk.positions);
+    std::vector<vec2>().swap(chunk.texcoords);
+    std::vector<vec3>().swap(chunk.normals);
+    return true;
+}
+
+// construit les triangles de la face suivante du bloc, renvoie faux a la fin du bloc
+bool MeshStream::read_face( )
+{
+    const ObjChunk& chunk= *m_chunk;
+
+    // commandes mtllib et usemtl placees avant la face, ou a la fin du bloc
+    for(; m_command < chunk.commands.size() && chunk.commands[m_command].offset <= m_face; m_command++)
+    {
+        const ObjChunk::Command& c= chunk.commands[m_command];
+        if(c.usemtl)
+            m_material_id= m_materials.find(c.name.c_str());
+        else
+            m_materials= read_materials( normalize_filename(pathname(m_filename) + c.name).c_str() );
+    }
+    if(m_face >= chunk.faces.size())
+        return false;
+
+    m_face= decode_face(chunk.faces, m_face, m_first_position, m_first_texcoord, m_first_normal, m_idp, m_idt, m_idn);
+    if(!repair_face(m_idp, m_idt, m_idn, m_positions->size(), m_texcoords->size(), m_normals->size()))
+        m_idp.clear();
+
+    // verifie qu'une matiere est deja definie pour le triangle, sinon affecte une matiere par defaut
+    if(m_material_id == -1)
+        m_material_id= m_materials.default_material_index();
+
+    // triangulation de la face (supposee convexe)
+    for(int v= 2; v < int(m_idp.size()); v++)
+        triangle(0, v -1, v, m_idp, m_idt, m_idn);
+
+    return true;
+}
+
+// construit le triangle abc de la face, cf Mesh::vertex() et Mesh::triangle()
+void MeshStream::triangle( const int a, const int b, const int c, const std::vector<int>& idp, const std::vector<int>& idt, const std::vector<int>& idn )
+{
+    const int np= m_positions->size();
+    const int nt= m_texcoords->size();
+    const int nn= m_normals->size();
+
+    const int idv[3]= { a, b, c };
+    vec3 positions[3];
+    vec2 texcoords[3];
+    vec3 normals[3];
+    bool texcoord= true;
+    bool normal= true;
+    for(int i= 0; i < 3; i++)
+    {
+        int k= idv[i];
+        // indices corriges par repair_face()
+        assert(idp[k] >= 0 && idp[k] < np);
+        assert(idt[k] < nt && idn[k] < nn);
+
+        positions[i]= (*m_positions)[idp[k]];
+
+        // un sommet sans texcoord ou sans normale copie celle du sommet precedent
+        if(idt[k] >= 0)
+        {
+            m_texcoord= (*m_texcoords)[idt[k]];
+            m_has_texcoord= true;
+        }
+        if(idn[k] >= 0)
+        {
+            m_normal= (*m_normals)[idn[k]];
+            m_has_normal= true;
+        }
+
+        texcoord= texcoord && m_has_texcoord;
+        normal= normal && m_has_normal;
+        texcoords[i]= m_texcoord;
+        normals[i]= m_normal;
+    }
+
+    TriangleData data;
+    data.a= positions[0];
+    data.b= positions[1];
+    data.c= positions[2];
+    if(normal)
+    {
+        data.na= normals[0];
+        data.nb= normals[1];
+        data.nc= normals[2];
     }
-    
-    fclose(in);
-    
-    if(error)
-        printf("[error] loading indexed mesh '%s'...\n%s\n\n", filename, line_buffer);
     else
-        printf("  %d indices, %d positions %d texcoords %d normals\n", 
-            int(data.indices().size()), int(data.positions().size()), int(data.texcoords().size()), int(data.normals().size()));
-    
-    return data;
+    {
+        // normale geometrique
+        Vector n= normalize(cross(Point(data.b) - Point(data.a), Point(data.c) - Point(data.a)));
+        data.na= vec3(n);
+        data.nb= vec3(n);
+        data.nc= vec3(n);
+    }
+    if(texcoord)
+    {
+        data.ta= texcoords[0];
+        data.tb= texcoords[1];
+        data.tc= texcoords[2];
+    }
+    else
+    {
+        // coordonnees barycentriques des sommets, cf Mesh::triangle()
+        data.ta= vec2(0, 0);
+        data.tb= vec2(1, 0);
+        data.tc= vec2(0, 1);
+    }
+
+    m_triangles.push_back(data);
+    m_triangle_materials.push_back(m_material_id);
 }
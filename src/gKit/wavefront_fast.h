@@ -2,6 +2,10 @@
 #ifndef _OBJ_FAST_H
 #define _OBJ_FAST_H
 
+#include <cstdio>
+#include <string>
+#include <vector>
+
 #include "mesh.h"
 
 
@@ -12,10 +16,105 @@
 //! charge un fichier wavefront .obj et construit un mesh. version rapide, mais pas robuste aux erreurs.
 
 //! charge un fichier wavefront .obj et renvoie un mesh compose de triangles non indexes. utiliser glDrawArrays pour l'afficher. a detruire avec Mesh::release( ).
-Mesh read_mesh_fast( const char *filename );
+//! use_cache : relit le cache binaire du mesh, s'il est a jour, ou le cree, cf read_cached_mesh().
+Mesh read_mesh_fast( const char *filename, const bool use_cache= true );
 
 //! charge un fichier wavefront .obj et renvoie un mesh compose de triangles indexes. utiliser glDrawElements pour l'afficher. a detruire avec Mesh::release( ).
-Mesh read_indexed_mesh_fast( const char *filename );
+//! use_cache : relit le cache binaire du mesh, s'il est a jour, ou le cree, cf read_cached_mesh().
+Mesh read_indexed_mesh_fast( const char *filename, const bool use_cache= true );
+
+
+//! lot de triangles, cf MeshStream.
+struct MeshBatch
+{
+    std::vector<TriangleData> triangles;
+    std::vector<int> materials;     //!< matiere de chaque triangle, indice dans MeshStream::materials().
+    int first;                      //!< indice, dans le fichier, du premier triangle du lot.
+
+    MeshBatch( ) : triangles(), materials(), first(0) {}
+};
+
+struct ObjChunk;
+template < typename T > struct StreamAttributes;
+
+/*! lecture d'un fichier wavefront .obj par lots de triangles, sans construire le mesh complet.
+    seuls un bloc du fichier, ses faces, un lot de triangles, et une fenetre des attributs des sommets restent en memoire.
+    les attributs plus anciens sont ecrits dans un fichier temporaire, et relus par pages, si une face les utilise.
+    les triangles sont construits et transmis a l'application au fur et a mesure de la lecture.
+    les triangles sont numerotes dans l'ordre du fichier, comme les triangles du mesh de read_mesh_fast() : un sommet sans normale recoit la normale
+    du sommet precedent, ou la normale geometrique du triangle, idem pour les texcoords, cf Mesh::vertex() et Mesh::triangle().
+    les triangles sont identiques a ceux du mesh si le premier sommet du fichier a une normale, ou si aucun sommet n'en a, idem pour les texcoords.
+    une face avec un indice invalide garde ses triangles, eventuellement degeneres, cf repair_face(), et les triangles suivants gardent leur indice.
+
+    exemple :
+    \code
+    MeshStream stream("data/bigguy.obj");
+    MeshBatch batch;
+    while(stream.next(batch))
+    {
+        for(int i= 0; i < int(batch.triangles.size()); i++)
+            // triangle batch.first + i, matiere stream.materials().material(batch.materials[i])
+            { ... }
+    }
+    \endcode
+ */
+class MeshStream
+{
+public:
+    //! ouvre le fichier. batch_size : nombre de triangles des lots, sauf le dernier.
+    MeshStream( const char *filename, const int batch_size= 4096 );
+    ~MeshStream( );
+
+    //! renvoie les triangles suivants du fichier, ou faux a la fin du fichier.
+    bool next( MeshBatch& batch );
+
+    //! renvoie les matieres, decrites par les fichiers .mtl, deja lus.
+    const Materials& materials( ) const { return m_materials; }
+    //! renvoie vrai si le fichier n'a pas pu etre ouvert.
+    bool error( ) const { return m_error; }
+    //! renvoie la memoire utilisee, en octets.
+    size_t memory( ) const;
+
+protected:
+    MeshStream( const MeshStream& );
+    MeshStream& operator= ( const MeshStream& );
+
+    bool read_block( );
+    bool read_face( );
+    void triangle( const int a, const int b, const int c, const std::vector<int>& idp, const std::vector<int>& idt, const std::vector<int>& idn );
+
+    std::string m_filename;
+    FILE *m_file;
+    std::vector<char> m_buffer;         // bloc du fichier, et debut de la derniere ligne du bloc precedent
+    size_t m_carry;
+    int m_batch_size;
+
+    ObjChunk *m_chunk;                  // faces du bloc, cf read_face()
+    size_t m_face;
+    size_t m_command;
+    int m_first_position;               // nombre d'attributs avant le bloc
+    int m_first_texcoord;
+    int m_first_normal;
+    std::vector<int> m_idp;             // indices des attributs des sommets de la face
+    std::vector<int> m_idt;
+    std::vector<int> m_idn;
+
+    StreamAttributes<vec3> *m_positions;    // attributs des sommets, cf read_block()
+    StreamAttributes<vec2> *m_texcoords;
+    StreamAttributes<vec3> *m_normals;
+    Materials m_materials;
+    int m_material_id;
+    vec2 m_texcoord;                    // derniers attributs, cf Mesh::vertex()
+    vec3 m_normal;
+    bool m_has_texcoord;
+    bool m_has_normal;
+
+    std::vector<TriangleData> m_triangles;  // triangles, pas encore transmis
+    std::vector<int> m_triangle_materials;
+    size_t m_next;
+    int m_first;
+    bool m_error;
+};
 
 ///@}
 #endif
@@ -0,0 +1,214 @@
+
+#ifndef _WAVEFRONT_PARSER_H
+#define _WAVEFRONT_PARSER_H
+
+#include <cstring>
+#include <vector>
+
+
+//! \file
+//! analyse des lignes des fichiers .obj et .mtl, sans sscanf(), cf read_mesh(), read_materials() et read_mesh_fast().
+
+// parse_int() + parse_float() + tools from fast_obj parser
+// https://github.com/thisistherk/fast_obj 
+inline int is_whitespace( const char c )
+{
+    return (c == ' ' || c == '\t' || c == '\r');
+}
+
+inline int is_digit( const char c )
+{
+    return (c >= '0' && c <= '9');
+}
+
+inline int is_exponent( const char c )
+{
+    return (c == 'e' || c == 'E');
+}
+
+inline const char* skip_whitespace( const char* ptr )
+{
+    while (ptr && is_whitespace(*ptr))
+        ptr++;
+
+    return ptr;
+}
+
+inline const char* parse_int( const char* ptr, int* val )
+{
+    ptr = skip_whitespace(ptr);
+    
+    int sign= 0;
+    if (*ptr == '-')
+    {
+        sign = -1;
+        ptr++;
+    }
+    else
+    {
+        sign = +1;
+    }
+
+    int num = 0;
+    while (is_digit(*ptr))
+        num = 10 * num + (*ptr++ - '0');
+
+    *val = sign * num;
+    return ptr;
+}
+
+/* Max supported power when parsing float */
+#define MAX_POWER               20
+
+static const
+double POWER_10_POS[MAX_POWER] =
+{
+    1.0e0,  1.0e1,  1.0e2,  1.0e3,  1.0e4,  1.0e5,  1.0e6,  1.0e7,  1.0e8,  1.0e9,
+    1.0e10, 1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19,
+};
+
+static const
+double POWER_10_NEG[MAX_POWER] =
+{
+    1.0e0,   1.0e-1,  1.0e-2,  1.0e-3,  1.0e-4,  1.0e-5,  1.0e-6,  1.0e-7,  1.0e-8,  1.0e-9,
+    1.0e-10, 1.0e-11, 1.0e-12, 1.0e-13, 1.0e-14, 1.0e-15, 1.0e-16, 1.0e-17, 1.0e-18, 1.0e-19,
+};
+
+inline const char* parse_float(const char* ptr, float* val)
+{
+    ptr = skip_whitespace(ptr);
+
+    double sign= 0;
+    switch (*ptr)
+    {
+    case '+':
+        sign = 1.0;
+        ptr++;
+        break;
+
+    case '-':
+        sign = -1.0;
+        ptr++;
+        break;
+
+    default:
+        sign = 1.0;
+        break;
+    }
+
+    double num= 0.0;
+    while (is_digit(*ptr))
+        num = 10.0 * num + (double)(*ptr++ - '0');
+
+    if (*ptr == '.')
+        ptr++;
+
+    double fra= 0;
+    double div= 1;
+    while (is_digit(*ptr))
+    {
+        fra  = 10.0 * fra + (double)(*ptr++ - '0');
+        div *= 10.0;
+    }
+
+    num += fra / div;
+
+    if (is_exponent(*ptr))
+    {
+        ptr++;
+
+        const double* powers= nullptr;
+        switch (*ptr)
+        {
+        case '+':
+            powers = POWER_10_POS;
+            ptr++;
+            break;
+
+        case '-':
+            powers = POWER_10_NEG;
+            ptr++;
+            break;
+
+        default:
+            powers = POWER_10_POS;
+            break;
+        }
+
+        unsigned int eval= 0;
+        while (is_digit(*ptr))
+            eval = 10 * eval + (*ptr++ - '0');
+
+        num *= (eval >= MAX_POWER) ? 0.0 : powers[eval];
+    }
+
+    *val = (float)(sign * num);
+    return ptr;
+}
+
+
+//! reconnait le mot cle au debut de la ligne. renvoie la suite de la ligne, ou nullptr.
+inline const char *parse_keyword( const char *line, const char *keyword )
+{
+    size_t n= strlen(keyword);
+    if(strncmp(line, keyword, n) != 0)
+        return nullptr;
+    return line + n;
+}
+
+//! renvoie le nom qui suit un mot cle, jusqu'a la fin de la ligne, sans les espaces du debut, et le termine par 0, dans la ligne. renvoie nullptr si le nom est vide.
+inline char *parse_name( char *line )
+{
+    while(is_whitespace(*line) || *line == '\n')
+        line++;
+    
+    char *last= line + strcspn(line, "\r\n");
+    *last= 0;
+    return (last > line) ? line : nullptr;
+}
+
+//! lit n reels. renvoie le nombre de reels lus, comme sscanf().
+inline int parse_floats( const char *line, float *values, const int n )
+{
+    for(int i= 0; i < n; i++)
+    {
+        // verifie que la suite commence par un nombre, parse_float() ne detecte pas les erreurs
+        line= skip_whitespace(line);
+        const char *digit= line;
+        if(*digit == '+' || *digit == '-')
+            digit++;
+        if(*digit == '.')
+            digit++;
+        if(!is_digit(*digit))
+            return i;
+        
+        line= parse_float(line, &values[i]);
+    }
+    return n;
+}
+
+/*! corrige les indices des sommets d'une face, numerotes a partir de 0, -1 pour un attribut absent. np, nt, nn : nombre de positions, texcoords, normales.
+    une position invalide est remplacee par la premiere position valide de la face, ou par la premiere position du fichier : la face garde ses triangles,
+    eventuellement degeneres, et les triangles suivants gardent leur indice, cf read_mesh(), read_mesh_fast() et MeshStream.
+    une texcoord ou une normale invalide devient absente. renvoie faux si aucune position n'est definie, la face est ignoree.
+ */
+inline bool repair_face( std::vector<int>& idp, std::vector<int>& idt, std::vector<int>& idn, const int np, const int nt, const int nn )
+{
+    if(np == 0)
+        return false;
+
+    int valid= 0;
+    for(int k= int(idp.size()) -1; k >= 0; k--)
+        if(idp[k] >= 0 && idp[k] < np)
+            valid= idp[k];
+
+    for(int k= 0; k < int(idp.size()); k++)
+    {
+        if(idp[k] < 0 || idp[k] >= np) idp[k]= valid;
+        if(idt[k] < -1 || idt[k] >= nt) idt[k]= -1;
+        if(idn[k] < -1 || idn[k] >= nn) idn[k]= -1;
+    }
+    return true;
+}
+
+#endif
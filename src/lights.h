@@ -0,0 +1,299 @@
+#ifndef _LIGHTS_H
+#define _LIGHTS_H
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include "vec.h"
+#include "color.h"
+#include "mesh.h"
+#include "bvh.h"
+
+/* choix des sources de lumiere pour l'eclairage direct, cf shade() dans tp2.cpp
+    une source est choisie, proportionnellement a sa puissance, puis un point est choisi sur le triangle, cf Triangle::sample18().
+    le cout ne depend plus du nombre de sources : table d'alias, en O(1), ou arbre de sources, en O(log n), qui tient compte
+    de la distance entre le point a eclairer et les sources.
+
+    cf "the alias method", A. Walker, 1977, et "a linear algorithm for generating random numbers with a given distribution", M. Vose, 1991
+    cf "importance sampling of many lights with adaptive tree splitting", A. Conty Estevez, C. Kulla, 2018
+ */
+
+// choisit un indice, proportionnellement aux poids, avec un seul nombre aleatoire
+struct AliasTable
+{
+    std::vector<float> threshold;   // probabilite de garder l'indice, sinon alias
+    std::vector<int> alias;
+    std::vector<float> pmf;         // probabilite de chaque indice
+
+    AliasTable( ) : threshold(), alias(), pmf() {}
+
+    void build( const std::vector<float>& weights )
+    {
+        const int n= int(weights.size());
+        threshold.assign(n, 1);
+        alias.assign(n, 0);
+        pmf.assign(n, 0);
+        if(n == 0)
+            return;
+
+        double total= 0;
+        for(int i= 0; i < n; i++)
+            total+= weights[i];
+
+        // repartit les indices : sous la moyenne / au dessus de la moyenne
+        std::vector<double> scaled(n);
+        std::vector<int> small;
+        std::vector<int> large;
+        for(int i= 0; i < n; i++)
+        {
+            pmf[i]= total > 0 ? float(weights[i] / total) : 1.f / n;
+            scaled[i]= total > 0 ? weights[i] / total * n : 1;
+            alias[i]= i;
+            if(scaled[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        // complete chaque indice sous la moyenne avec un indice au dessus de la moyenne
+        while(!small.empty() && !large.empty())
+        {
+            int s= small.back(); small.pop_back();
+            int l= large.back(); large.pop_back();
+            threshold[s]= float(scaled[s]);
+            alias[s]= l;
+
+            scaled[l]= (scaled[l] + scaled[s]) - 1;
+            if(scaled[l] < 1)
+                small.push_back(l);
+            else
+                large.push_back(l);
+        }
+        // erreurs d'arrondi, les indices restants sont gardes
+        for(int i= 0; i < int(small.size()); i++) threshold[small[i]]= 1;
+        for(int i= 0; i < int(large.size()); i++) threshold[large[i]]= 1;
+    }
+
+    // renvoie un indice, et sa probabilite
+    int sample( const float u, float& p ) const
+    {
+        const int n= int(alias.size());
+        float x= u * n;
+        int i= std::min(int(x), n -1);
+        float v= x - i;     // reutilise la partie fractionnaire de u
+        if(v >= threshold[i])
+            i= alias[i];
+
+        p= pmf[i];
+        return i;
+    }
+};
+
+
+// point choisi sur une source
+struct LightSample
+{
+    Point p;
+    Vector n;           // normale de la source en p
+    Color emission;
+    int triangle_id;
+    float pdf;          // densite de proba, par rapport a l'aire : probabilite de la source / aire du triangle
+};
+
+// arbre de sources : les noeuds englobent des sources voisines, et un point choisit plutot les sources proches et puissantes
+struct LightNode
+{
+    BBox bounds;
+    float power;
+    int left, right;    // fils, ou -1 pour une feuille
+    int light;          // source de la feuille
+    int parent;
+};
+
+struct Lights
+{
+    std::vector<Triangle> triangles;    // triangles emissifs
+    std::vector<Color> emission;
+    std::vector<Vector> normals;        // normales des sommets des triangles, 3 par triangle, cf TriangleData
+    std::vector<float> power;           // puissance de chaque source : emission x aire
+    std::vector<int> lights;            // indice de la source d'un triangle du mesh, ou -1
+    AliasTable table;
+
+    std::vector<LightNode> nodes;       // arbre, cf tree
+    std::vector<int> leaves;            // feuille de chaque source
+    bool tree;                          // choisit les sources avec l'arbre, sinon avec la table d'alias
+
+    Lights( ) : triangles(), emission(), normals(), power(), lights(), table(), nodes(), leaves(), tree(false) {}
+
+    void build( const Mesh& mesh )
+    {
+        int n= mesh.triangle_count();
+        lights.assign(n, -1);
+        for(int i= 0; i < n; i++)
+        {
+            const Material& material= mesh.triangle_material(i);
+            if(material.emission.r + material.emission.g + material.emission.b <= 0)
+                continue;
+
+            const TriangleData& data= mesh.triangle(i);
+            lights[i]= int(triangles.size());
+            triangles.emplace_back(data, i);
+            emission.push_back(material.emission);
+
+            // normales du mesh, ou normale geometrique
+            Vector ng= normalize(cross(Vector(data.a, data.b), Vector(data.a, data.c)));
+            Vector na(data.na), nb(data.nb), nc(data.nc);
+            normals.push_back(length2(na) > 0 ? na : ng);
+            normals.push_back(length2(nb) > 0 ? nb : ng);
+            normals.push_back(length2(nc) > 0 ? nc : ng);
+
+            power.push_back((material.emission.r + material.emission.g + material.emission.b) / 3 * triangles.back().aire);
+        }
+
+        table.build(power);
+
+        nodes.clear();
+        leaves.assign(triangles.size(), -1);
+        if(!triangles.empty())
+        {
+            std::vector<int> ids(triangles.size());
+            for(int i= 0; i < int(ids.size()); i++)
+                ids[i]= i;
+            build_tree(ids, 0, int(ids.size()), -1);
+        }
+    }
+
+    int size( ) const { return int(triangles.size()); }
+
+    // choisit un point sur une source, pour eclairer le point x
+    LightSample sample( const Point& x, const float u0, const float u1, const float u2 ) const
+    {
+        float p= 0;
+        int light= tree ? sample_tree(x, u0, p) : table.sample(u0, p);
+
+        const Triangle& triangle= triangles[light];
+        // coordonnees barycentriques du point, cf Triangle::sample18()
+        float r1= std::sqrt(u1);
+        float b= (1 - u2) * r1;
+        float g= u2 * r1;
+        Vector n= normalize((1 - b - g) * normals[3*light] + b * normals[3*light +1] + g * normals[3*light +2]);
+
+        LightSample s= { triangle.sample18(u1, u2), n, emission[light], triangle.id, p / triangle.aire };
+        return s;
+    }
+
+    // densite de proba, par rapport a l'aire, de choisir le point p du triangle triangle_id, pour eclairer le point x, cf MIS
+    float pdf( const Point& x, const int triangle_id ) const
+    {
+        int light= lights[triangle_id];
+        if(light < 0)
+            return 0;
+
+        float p= tree ? pmf_tree(x, light) : table.pmf[light];
+        return p / triangles[light].aire;
+    }
+
+protected:
+    // repartit les sources [begin .. end) : coupe l'englobant de leurs centres par le milieu, le long de son axe le plus long
+    int build_tree( std::vector<int>& ids, const int begin, const int end, const int parent )
+    {
+        int index= int(nodes.size());
+        nodes.emplace_back();
+        LightNode node;
+        node.bounds= BBox::empty();
+        node.power= 0;
+        node.left= -1;
+        node.right= -1;
+        node.light= -1;
+        node.parent= parent;
+
+        BBox centroids= BBox::empty();
+        for(int i= begin; i < end; i++)
+        {
+            node.bounds.insert(triangles[ids[i]].bounds());
+            node.power+= power[ids[i]];
+            centroids.insert(triangles[ids[i]].bounds().centroid());
+        }
+
+        if(end - begin == 1)
+        {
+            node.light= ids[begin];
+            leaves[node.light]= index;
+            nodes[index]= node;
+            return index;
+        }
+
+        Vector d(centroids.pmin, centroids.pmax);
+        int axis= (d.x > d.y && d.x > d.z) ? 0 : (d.y > d.z ? 1 : 2);
+        int middle= (begin + end) / 2;
+        std::nth_element(ids.begin() + begin, ids.begin() + middle, ids.begin() + end,
+            [&]( const int a, const int b ) { return triangles[a].bounds().centroid(axis) < triangles[b].bounds().centroid(axis); });
+
+        node.left= build_tree(ids, begin, middle, index);
+        node.right= build_tree(ids, middle, end, index);
+        nodes[index]= node;
+        return index;
+    }
+
+    // importance d'un noeud pour le point x : puissance / distance au carre, bornee par la taille de l'englobant
+    float importance( const Point& x, const int index ) const
+    {
+        const LightNode& node= nodes[index];
+        float d2= distance2(x, node.bounds.centroid());
+        float r2= length2(Vector(node.bounds.pmin, node.bounds.pmax)) / 4;
+        return node.power / std::max(d2, r2);
+    }
+
+    // probabilite de choisir le fils gauche du noeud interne index
+    float left_probability( const Point& x, const int index ) const
+    {
+        float l= importance(x, nodes[index].left);
+        float r= importance(x, nodes[index].right);
+        if(l + r <= 0)
+            return 0.5f;
+        return l / (l + r);
+    }
+
+    int sample_tree( const Point& x, float u, float& p ) const
+    {
+        p= 1;
+        int index= 0;
+        while(nodes[index].light < 0)
+        {
+            float pl= left_probability(x, index);
+            // reutilise u pour le niveau suivant
+            if(u < pl)
+            {
+                u= std::min(u / pl, 0.99999994f);
+                p*= pl;
+                index= nodes[index].left;
+            }
+            else
+            {
+                u= std::min((u - pl) / (1 - pl), 0.99999994f);
+                p*= 1 - pl;
+                index= nodes[index].right;
+            }
+        }
+        return nodes[index].light;
+    }
+
+    // probabilite de choisir la source light : produit des probabilites des noeuds, depuis la racine
+    float pmf_tree( const Point& x, const int light ) const
+    {
+        float p= 1;
+        int index= leaves[light];
+        while(nodes[index].parent >= 0)
+        {
+            int parent= nodes[index].parent;
+            float pl= left_probability(x, parent);
+            p*= (nodes[parent].left == index) ? pl : 1 - pl;
+            index= parent;
+        }
+        return p;
+    }
+};
+
+#endif
@@ -0,0 +1,278 @@
+
+//! \file mesh_bench.cpp compare le temps de chargement des fichiers .obj, read_mesh(), read_mesh_fast() et read_indexed_mesh_fast(), sans cache, et du cache binaire, cf mesh_cache.h, et verifie que les mesh sont identiques
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "mesh.h"
+#include "wavefront.h"
+#include "wavefront_fast.h"
+#include "mesh_cache.h"
+
+
+// compare 2 tableaux d'attributs, renvoie l'indice du premier sommet different, ou -1
+template < typename T >
+int compare( const std::vector<T>& a, const std::vector<T>& b )
+{
+    if(a.size() != b.size())
+        return 0;
+
+    for(int i= 0; i < int(a.size()); i++)
+    {
+        const float *pa= &a[i].x;
+        const float *pb= &b[i].x;
+        for(int k= 0; k < int(sizeof(T) / sizeof(float)); k++)
+            if(pa[k] != pb[k])
+                return i;
+    }
+    return -1;
+}
+
+bool compare( const Mesh& a, const Mesh& b )
+{
+    bool same= true;
+    int p= compare(a.positions(), b.positions());
+    int t= compare(a.texcoords(), b.texcoords());
+    int n= compare(a.normals(), b.normals());
+    if(p >= 0) { printf("[error] positions: vertex %d (%d / %d vertices)\n", p, int(a.positions().size()), int(b.positions().size())); same= false; }
+    if(t >= 0) { printf("[error] texcoords: vertex %d (%d / %d texcoords)\n", t, int(a.texcoords().size()), int(b.texcoords().size())); same= false; }
+    if(n >= 0) { printf("[error] normals: vertex %d (%d / %d normals)\n", n, int(a.normals().size()), int(b.normals().size())); same= false; }
+
+    if(a.triangle_count() != b.triangle_count())
+    {
+        printf("[error] %d / %d triangles\n", a.triangle_count(), b.triangle_count());
+        return false;
+    }
+
+    // compare les matieres par nom, les 2 versions peuvent les numeroter differemment
+    for(int i= 0; i < a.triangle_count(); i++)
+    {
+        if(strcmp(a.materials().name(a.triangle_material_index(i)), b.materials().name(b.triangle_material_index(i))) != 0)
+        {
+            printf("[error] material: triangle %d\n", i);
+            return false;
+        }
+    }
+    return same;
+}
+
+// compare les triangles d'un mesh indexe et d'un mesh non indexe
+bool compare_indexed( const Mesh& indexed, const Mesh& mesh )
+{
+    if(indexed.triangle_count() != mesh.triangle_count())
+    {
+        printf("[error] indexed: %d / %d triangles\n", indexed.triangle_count(), mesh.triangle_count());
+        return false;
+    }
+
+    const std::vector<unsigned int>& indices= indexed.indices();
+    for(int i= 0; i < int(indices.size()); i++)
+    {
+        const vec3& a= indexed.positions()[indices[i]];
+        const vec3& b= mesh.positions()[i];
+        bool same= (a.x == b.x && a.y == b.y && a.z == b.z);
+        if(same && indexed.has_normal() && mesh.has_normal())
+        {
+            const vec3& na= indexed.normals()[indices[i]];
+            const vec3& nb= mesh.normals()[i];
+            same= (na.x == nb.x && na.y == nb.y && na.z == nb.z);
+        }
+        same= same && indexed.triangle_material_index(i / 3) == mesh.triangle_material_index(i / 3);
+
+        if(!same)
+        {
+            printf("[error] indexed: triangle %d\n", i / 3);
+            return false;
+        }
+    }
+    return true;
+}
+
+// lit le fichier par lots de triangles, et compare les triangles avec ceux du mesh. renvoie le temps de lecture, en ms
+float compare_stream( const char *filename, const Mesh& mesh, size_t& memory, bool& same )
+{
+    auto start= std::chrono::high_resolution_clock::now();
+
+    MeshStream stream(filename);
+    MeshBatch batch;
+    int n= 0;
+    same= !stream.error();
+    while(stream.next(batch))
+    {
+        for(int i= 0; same && i < int(batch.triangles.size()); i++)
+        {
+            int id= batch.first + i;
+            const TriangleData& a= batch.triangles[i];
+            const TriangleData b= mesh.triangle(id);
+            same= id < mesh.triangle_count() && memcmp(&a, &b, sizeof(TriangleData)) == 0
+                && batch.materials[i] == mesh.triangle_material_index(id);
+            if(!same)
+                printf("[error] stream: triangle %d\n", id);
+        }
+        n+= int(batch.triangles.size());
+    }
+    same= same && n == mesh.triangle_count();
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    memory= stream.memory();
+    return std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+// lit le fichier par lots de triangles, sans les garder, et calcule l'englobant des triangles. renvoie le temps de lecture, en ms
+float stream_bounds( const char *filename, Point& pmin, Point& pmax, int& triangles, size_t& memory )
+{
+    auto start= std::chrono::high_resolution_clock::now();
+
+    MeshStream stream(filename);
+    MeshBatch batch;
+    triangles= 0;
+    memory= 0;
+    while(stream.next(batch))
+    {
+        for(int i= 0; i < int(batch.triangles.size()); i++)
+        {
+            const TriangleData& data= batch.triangles[i];
+            Point a= Point(data.a);
+            Point b= Point(data.b);
+            Point c= Point(data.c);
+            if(triangles + i == 0)
+            {
+                pmin= a;
+                pmax= a;
+            }
+            pmin= min(pmin, min(a, min(b, c)));
+            pmax= max(pmax, max(a, max(b, c)));
+        }
+
+        triangles+= int(batch.triangles.size());
+        memory= std::max(memory, stream.memory() + batch.triangles.capacity() * sizeof(TriangleData) + batch.materials.capacity() * sizeof(int));
+    }
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+// memoire utilisee par les sommets du mesh, en octets
+size_t memory( const Mesh& mesh )
+{
+    return mesh.positions().size() * sizeof(vec3) + mesh.texcoords().size() * sizeof(vec2) + mesh.normals().size() * sizeof(vec3)
+        + mesh.indices().size() * sizeof(unsigned int) + mesh.material_indices().size() * sizeof(unsigned int);
+}
+
+// verifie que les faces avec des indices invalides gardent leurs triangles, et que les triangles suivants gardent leur indice, cf repair_face()
+bool check_malformed( const char *filename, const int triangles )
+{
+    Mesh reference= read_mesh(filename, false);
+    Mesh fast= read_mesh_fast(filename, false);
+    Mesh indexed= read_indexed_mesh_fast(filename, false);
+
+    size_t memory= 0;
+    bool same_stream= false;
+    compare_stream(filename, fast, memory, same_stream);
+
+    bool same= reference.triangle_count() == triangles && compare(reference, fast) && compare_indexed(indexed, fast) && same_stream;
+    printf("%s: %d / %d triangles, %s\n", filename, reference.triangle_count(), triangles, same ? "same mesh" : "[error] different meshes");
+
+    reference.release();
+    fast.release();
+    indexed.release();
+    return same;
+}
+
+// charge le fichier runs fois, renvoie le temps le plus court, en ms
+template < typename Read >
+float load( const char *filename, const int runs, Read read, Mesh& mesh )
+{
+    float best= 0;
+    for(int r= 0; r < runs; r++)
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+        mesh= read(filename);
+        auto stop= std::chrono::high_resolution_clock::now();
+
+        float ms= std::chrono::duration<float, std::milli>(stop - start).count();
+        if(r == 0 || ms < best)
+            best= ms;
+    }
+    return best;
+}
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    if(argc > 1)
+        mesh_filename= argv[1];
+
+    int runs= 3;
+    if(argc > 2)
+        runs= std::max(1, atoi(argv[2]));
+
+    FILE *in= fopen(mesh_filename, "rb");
+    if(in == nullptr)
+    {
+        printf("[error] loading mesh '%s'...\n", mesh_filename);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    float mb= ftell(in) / float(1024 * 1024);
+    fclose(in);
+
+    Mesh reference;
+    float reference_ms= load(mesh_filename, runs, []( const char *filename ) { return read_mesh(filename, false); }, reference);
+    if(reference.vertex_count() == 0)
+        return 1;
+
+    Mesh fast;
+    float fast_ms= load(mesh_filename, runs, []( const char *filename ) { return read_mesh_fast(filename, false); }, fast);
+    if(fast.vertex_count() == 0)
+        return 1;
+
+    Mesh indexed;
+    float indexed_ms= load(mesh_filename, runs, []( const char *filename ) { return read_indexed_mesh_fast(filename, false); }, indexed);
+    if(indexed.vertex_count() == 0)
+        return 1;
+
+    // cree le cache, si necessaire, puis le relit
+    read_mesh_fast(mesh_filename).release();
+    Mesh cached;
+    float cached_ms= load(mesh_filename, runs, []( const char *filename ) { return read_mesh_fast(filename); }, cached);
+
+    printf("\n%s: %.1fMB, %d triangles, %d indexed vertices\n", mesh_filename, mb, fast.triangle_count(), indexed.vertex_count());
+    printf("  read_mesh              %8.1fms %8.1fMB/s\n", reference_ms, mb / reference_ms * 1000);
+    printf("  read_mesh_fast         %8.1fms %8.1fMB/s  x%.1f\n", fast_ms, mb / fast_ms * 1000, reference_ms / fast_ms);
+    printf("  read_indexed_mesh_fast %8.1fms %8.1fMB/s  x%.1f\n", indexed_ms, mb / indexed_ms * 1000, reference_ms / indexed_ms);
+    printf("  mesh cache             %8.1fms %8.1fMB/s  x%.1f\n", cached_ms, mb / cached_ms * 1000, reference_ms / cached_ms);
+
+    size_t stream_memory= 0;
+    bool same_stream= false;
+    float stream_ms= compare_stream(mesh_filename, fast, stream_memory, same_stream);
+    printf("  mesh stream            %8.1fms %8.1fMB/s  x%.1f, %.1fMB / mesh %.1fMB\n", stream_ms, mb / stream_ms * 1000, reference_ms / stream_ms,
+        stream_memory / float(1024 * 1024), memory(fast) / float(1024 * 1024));
+
+    // englobant du mesh, calcule lot par lot
+    Point bounds_min, bounds_max;
+    Point pmin, pmax;
+    int bounds_triangles= 0;
+    size_t bounds_memory= 0;
+    float bounds_ms= stream_bounds(mesh_filename, bounds_min, bounds_max, bounds_triangles, bounds_memory);
+    fast.bounds(pmin, pmax);
+    bool same_bounds= bounds_triangles == fast.triangle_count()
+        && (bounds_triangles == 0 || (bounds_min.x == pmin.x && bounds_min.y == pmin.y && bounds_min.z == pmin.z
+            && bounds_max.x == pmax.x && bounds_max.y == pmax.y && bounds_max.z == pmax.z));
+    printf("  stream bounds          %8.1fms %8.1fMB/s  x%.1f, %.1fMB%s\n", bounds_ms, mb / bounds_ms * 1000, reference_ms / bounds_ms,
+        bounds_memory / float(1024 * 1024), same_bounds ? "" : ", [error] different bounds");
+
+    bool same= compare(reference, fast) && compare_indexed(indexed, fast) && compare(fast, cached) && same_stream && same_bounds;
+    same= check_malformed("data/malformed.obj", 9) && same;
+    printf("  %s\n", same ? "same mesh" : "[error] different meshes");
+
+    reference.release();
+    fast.release();
+    indexed.release();
+    cached.release();
+    return same ? 0 : 1;
+}
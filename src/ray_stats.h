@@ -0,0 +1,122 @@
+#ifndef _RAY_STATS_H
+#define _RAY_STATS_H
+
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "color.h"
+#include "image.h"
+
+/* compteurs du parcours des bvh : rayons par type, noeuds visites, triangles testes et intersections, cf bvh.h, bvh_wide.h et bvh_packet.h
+    desactives par defaut, RAY_STAT() ne fait rien. compiler avec -DRAY_STATS pour les activer.
+
+    chaque thread incremente ses propres compteurs, sans atomique ni verrou, ils sont additionnes a la fin du rendu, cf ray_stats_total().
+    les compteurs d'un thread sont alloues a sa premiere utilisation, et ne sont jamais liberes : ils restent lisibles apres la fin du thread.
+ */
+struct RayStats
+{
+    long long closest;     // rayons, intersection la plus proche, cf intersect()
+    long long occluded;    // rayons d'ombre, cf occluded()
+    long long packets;     // rayons des paquets, cf intersect( bvh, packet, hits )
+    long long nodes;       // noeuds visites
+    long long triangles;   // triangles testes, les blocs de triangles comptent pour BLOCK triangles, cf WideBVH
+    long long hits;        // rayons qui touchent un triangle, ou rayons d'ombre occultes
+
+    RayStats( ) : closest(0), occluded(0), packets(0), nodes(0), triangles(0), hits(0) {}
+
+    long long rays( ) const { return closest + occluded + packets; }
+
+    // cout d'un rayon ou d'un pixel, cf cost heatmap dans tp2.cpp
+    long long cost( ) const { return nodes + triangles; }
+
+    RayStats& operator+= ( const RayStats& b )
+    {
+        closest+= b.closest;
+        occluded+= b.occluded;
+        packets+= b.packets;
+        nodes+= b.nodes;
+        triangles+= b.triangles;
+        hits+= b.hits;
+        return *this;
+    }
+
+    // ms : temps de calcul de tous les rayons
+    void print( const float ms ) const
+    {
+        long long n= std::max(1LL, rays());
+        printf("rays: %lld closest, %lld occluded, %lld packet, %.2f Mrays/s\n", closest, occluded, packets, ms > 0 ? rays() / ms / 1000 : 0.f);
+        printf("  %.1f nodes, %.1f triangles per ray, %.1f%% hits\n", float(nodes) / n, float(triangles) / n, 100.f * hits / n);
+    }
+};
+
+#ifdef RAY_STATS
+// compteurs de tous les threads
+struct RayStatsRegistry
+{
+    std::mutex lock;
+    std::vector<RayStats *> threads;
+
+    static RayStatsRegistry& instance( )
+    {
+        static RayStatsRegistry registry;
+        return registry;
+    }
+
+    RayStats *add( )
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(new RayStats());
+        return threads.back();
+    }
+};
+
+// compteurs du thread
+inline RayStats& ray_stats( )
+{
+    static thread_local RayStats *stats= RayStatsRegistry::instance().add();
+    return *stats;
+}
+
+// somme des compteurs de tous les threads, a utiliser en dehors des regions paralleles
+inline RayStats ray_stats_total( )
+{
+    RayStatsRegistry& registry= RayStatsRegistry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    RayStats total;
+    for(int i= 0; i < int(registry.threads.size()); i++)
+        total+= *registry.threads[i];
+    return total;
+}
+
+#define RAY_STAT(counter, n) (ray_stats().counter+= (n))
+#else
+inline RayStats ray_stats_total( ) { return RayStats(); }
+
+#define RAY_STAT(counter, n) ((void) 0)
+#endif
+
+// cout de chaque pixel : du bleu, pour le moins couteux, au rouge, pour le plus couteux
+inline Image cost_heatmap( const std::vector<float>& cost, const int width, const int height )
+{
+    const Color ramp[]= { Color(0, 0, 1), Color(0, 1, 1), Color(0, 1, 0), Color(1, 1, 0), Color(1, 0, 0) };
+
+    float most= 0;
+    for(int i= 0; i < int(cost.size()); i++)
+        most= std::max(most, cost[i]);
+
+    Image image(width, height);
+    for(int y= 0; y < height; y++)
+    for(int x= 0; x < width; x++)
+    {
+        float t= most > 0 ? cost[y * width + x] / most * 4 : 0;
+        int i= std::min(int(t), 3);
+        image(x, y)= ramp[i] * (1 - (t - i)) + ramp[i +1] * (t - i);
+        image(x, y).a= 1;
+    }
+    return image;
+}
+
+#endif
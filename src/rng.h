@@ -0,0 +1,48 @@
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <cstdint>
+
+/* nombres aleatoires par compteur : chaque nombre est le hash de (graine, pixel, echantillon, dimension), sans etat partage.
+    les threads n'ont pas besoin de se synchroniser, et l'image ne depend ni du nombre de threads, ni de l'ordre des pixels.
+
+    cf "hash functions for gpu rendering", M. Jarzynski, M. Olano, 2020 : pcg hash
+    et "parallel random numbers: as easy as 1, 2, 3", J. Salmon, 2011
+ */
+
+// pcg hash, 32 bits
+inline uint32_t pcg_hash( const uint32_t v )
+{
+    uint32_t state= v * 747796405u + 2891336453u;
+    uint32_t word= ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// renvoie un reel uniforme dans [0 1), avec les 24 bits de poids fort
+inline float u01( const uint32_t bits )
+{
+    return float(bits >> 8) / 16777216.f;
+}
+
+// flot de nombres aleatoires d'un echantillon d'un pixel, les nombres successifs correspondent aux dimensions 0, 1, 2, etc.
+struct PixelRNG
+{
+    uint32_t key;
+    uint32_t dimension;
+
+    PixelRNG( const uint32_t pixel, const uint32_t sample, const uint32_t seed= 0 ) : key(pcg_hash(pcg_hash(seed ^ pcg_hash(pixel)) ^ sample)), dimension(0) {}
+
+    // nombre de la dimension d, quel que soit l'etat du flot
+    uint32_t bits( const uint32_t d ) const { return pcg_hash(key ^ pcg_hash(d)); }
+
+    // dimension suivante
+    uint32_t next( ) { return bits(dimension++); }
+
+    // reel uniforme dans [0 1) de la dimension suivante
+    float operator() ( ) { return u01(next()); }
+
+    // passe a la dimension d, cf les dimensions reservees par un integrateur
+    void seek( const uint32_t d ) { dimension= d; }
+};
+
+#endif
@@ -1,3 +1,13 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "vec.h"
+#include "rng.h"
+
 // genere une direction sur l'hemisphere, 
 // cf GI compendium, eq 34
 Vector sample34( const float u1, const float u2 )
@@ -36,4 +46,294 @@ float pdf35( const Vector& w )
 {
     if(w.z < 0) return 0;
     return w.z / float(M_PI);
-}
\ No newline at end of file
+}
+
+
+/* sequences d'echantillons, meme interface pour toutes : sequence(pixel, index, dimension) renvoie la coordonnee dimension
+    de l'echantillon index du pixel, dans [0 1). cf PixelSampler pour les utiliser comme un generateur de nombres aleatoires.
+
+    les sequences a faible discrepance repartissent mieux les echantillons d'un pixel que des nombres independants,
+    et l'estimation converge avec moins d'echantillons, cf sampler_bench.cpp
+ */
+
+// nombres independants, cf PixelRNG
+struct RandomSequence
+{
+    uint32_t seed;
+
+    RandomSequence( const uint32_t _seed= 0 ) : seed(_seed) {}
+
+    float operator() ( const uint32_t pixel, const uint32_t index, const uint32_t dimension ) const
+    {
+        return u01(PixelRNG(pixel, index, seed).bits(dimension));
+    }
+};
+
+inline uint32_t reverse_bits( uint32_t x )
+{
+    x= (x << 16) | (x >> 16);
+    x= ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x= ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x= ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x= ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// permutation de owen, cf "practical hash-based owen scrambling", B. Burley, 2020
+inline uint32_t nested_uniform_scramble( uint32_t x, const uint32_t seed )
+{
+    x= reverse_bits(x);
+    x+= seed;
+    x^= x * 0x6c50b47cu;
+    x^= x * 0xb82f1e52u;
+    x^= x * 0xc7afe638u;
+    x^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+/* sobol, melange de owen. les 4 premieres dimensions sont utilisees par groupes de 4, chaque groupe avec un ordre different des echantillons,
+    cf "practical hash-based owen scrambling", B. Burley, 2020
+    et "constructing sobol sequences with better two-dimensional projections", S. Joe, F. Kuo, 2008, pour les nombres directeurs
+ */
+struct SobolSequence
+{
+    enum { DIMENSIONS= 4 };
+
+    uint32_t seed;
+
+    SobolSequence( const uint32_t _seed= 0 ) : seed(_seed) {}
+
+    float operator() ( const uint32_t pixel, const uint32_t index, const uint32_t dimension ) const
+    {
+        uint32_t shuffle= pcg_hash(pcg_hash(pixel + seed) ^ (dimension / DIMENSIONS));
+        uint32_t i= nested_uniform_scramble(index, shuffle);
+        uint32_t x= sobol(i, dimension % DIMENSIONS);
+        return u01(nested_uniform_scramble(x, pcg_hash(shuffle ^ dimension)));
+    }
+
+    static uint32_t sobol( const uint32_t index, const int dimension )
+    {
+        // les index melanges utilisent les 32 bits : combine les nombres directeurs 4 bits par 4 bits
+        static const std::vector<uint32_t> tables= nibbles();
+        const uint32_t *table= &tables[dimension * 8 * 16];
+
+        uint32_t x= 0;
+        for(int i= 0; i < 8; i++)
+            x^= table[i * 16 + ((index >> (4*i)) & 15)];
+        return x;
+    }
+
+protected:
+    // table[i][n] : combinaison des nombres directeurs 4i .. 4i+3 selectionnes par les bits de n
+    static std::vector<uint32_t> nibbles( )
+    {
+        std::vector<uint32_t> v= directions();
+        std::vector<uint32_t> tables(DIMENSIONS * 8 * 16, 0);
+        for(int d= 0; d < DIMENSIONS; d++)
+        for(int i= 0; i < 8; i++)
+        for(int n= 0; n < 16; n++)
+        for(int bit= 0; bit < 4; bit++)
+            if(n & (1 << bit))
+                tables[(d * 8 + i) * 16 + n]^= v[d * 32 + 4*i + bit];
+        return tables;
+    }
+
+    // nombres directeurs des 4 premieres dimensions : polynomes primitifs x+1, x^2+x+1, x^3+x+1
+    static std::vector<uint32_t> directions( )
+    {
+        const int degree[]= { 1, 2, 3 };
+        const uint32_t coefficients[]= { 0, 1, 1 };
+        const uint32_t initial[][3]= { {1}, {1, 3}, {1, 3, 1} };
+
+        std::vector<uint32_t> v(DIMENSIONS * 32);
+        for(int k= 0; k < 32; k++)
+            v[k]= 1u << (31 - k);       // van der corput
+
+        for(int d= 1; d < DIMENSIONS; d++)
+        {
+            uint32_t *m= &v[d * 32];
+            int s= degree[d -1];
+            uint32_t a= coefficients[d -1];
+            for(int k= 0; k < s; k++)
+                m[k]= initial[d -1][k] << (31 - k);
+
+            for(int k= s; k < 32; k++)
+            {
+                m[k]= m[k - s] ^ (m[k - s] >> s);
+                for(int j= 1; j < s; j++)
+                    if((a >> (s -1 - j)) & 1)
+                        m[k]^= m[k - j];
+            }
+        }
+        return v;
+    }
+};
+
+// halton, decale par pixel, cf "randomization of number theoretic methods for multiple integration", R. Cranley, T. Patterson, 1976
+struct HaltonSequence
+{
+    enum { DIMENSIONS= 16 };
+
+    uint32_t seed;
+
+    HaltonSequence( const uint32_t _seed= 0 ) : seed(_seed) {}
+
+    float operator() ( const uint32_t pixel, const uint32_t index, const uint32_t dimension ) const
+    {
+        static const int primes[DIMENSIONS]= { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+        // au dela des 16 premieres dimensions, reutilise les memes bases, mais avec d'autres echantillons
+        uint32_t i= index + (pcg_hash(seed ^ (dimension / DIMENSIONS)) & 0xffff) * (dimension >= DIMENSIONS);
+        double x= radical_inverse(i, primes[dimension % DIMENSIONS]) + u01(pcg_hash(seed ^ pcg_hash(pixel ^ pcg_hash(dimension))));
+        if(x >= 1)
+            x-= 1;
+        return std::min(float(x), 0.99999994f);
+    }
+
+    static double radical_inverse( uint32_t index, const int base )
+    {
+        double inv= 1.0 / base;
+        double scale= inv;
+        double x= 0;
+        for(; index; index/= base, scale*= inv)
+            x+= (index % base) * scale;
+        return x;
+    }
+};
+
+/* bruit bleu : une tuile de 64x64 valeurs, construite une seule fois, cf "the void-and-cluster method for dither array generation", R. Ulichney, 1993.
+    chaque dimension decale la tuile, et chaque echantillon decale les valeurs, avec la suite R2, cf "the unreasonable effectiveness of quasirandom sequences", M. Roberts, 2018.
+    l'erreur est repartie en bruit bleu sur l'image, au lieu d'un bruit blanc.
+ */
+struct BlueNoiseSequence
+{
+    enum { SIZE= 64 };
+
+    uint32_t width;     // largeur de l'image, pour retrouver les coordonnees du pixel
+    uint32_t seed;
+
+    BlueNoiseSequence( const int _width, const uint32_t _seed= 0 ) : width(_width), seed(_seed) {}
+
+    float operator() ( const uint32_t pixel, const uint32_t index, const uint32_t dimension ) const
+    {
+        static const std::vector<float> values= tile();
+
+        uint32_t offset= pcg_hash(seed ^ pcg_hash(dimension));
+        uint32_t x= (pixel % width + offset) % SIZE;
+        uint32_t y= (pixel / width + (offset >> 16)) % SIZE;
+
+        const double alpha[2]= { 0.7548776662466927, 0.5698402909980532 };
+        double v= values[y * SIZE + x] + index * alpha[dimension & 1];
+        return std::min(float(v - std::floor(v)), 0.99999994f);
+    }
+
+    // classe les pixels de la tuile : chaque nouveau pixel est place dans le plus grand trou, loin des pixels deja places
+    static std::vector<float> tile( )
+    {
+        const int n= SIZE * SIZE;
+
+        // energie d'un pixel place, fonction de la distance, sur une tuile qui se repete
+        std::vector<float> kernel(n);
+        for(int y= 0; y < SIZE; y++)
+        for(int x= 0; x < SIZE; x++)
+        {
+            int dx= std::min(x, SIZE - x);
+            int dy= std::min(y, SIZE - y);
+            kernel[y * SIZE + x]= std::exp(-(dx*dx + dy*dy) / (2 * 1.9f * 1.9f));
+        }
+
+        std::vector<int> on(n, 0);
+        std::vector<float> energy(n, 0);
+        auto splat= [&]( const int p, const float sign )
+        {
+            int px= p % SIZE;
+            int py= p / SIZE;
+            for(int y= 0; y < SIZE; y++)
+            for(int x= 0; x < SIZE; x++)
+                energy[y * SIZE + x]+= sign * kernel[((y - py + SIZE) % SIZE) * SIZE + (x - px + SIZE) % SIZE];
+        };
+        // pixel place (ou libre) avec l'energie la plus forte (ou la plus faible)
+        auto extreme= [&]( const int state, const bool cluster )
+        {
+            int best= -1;
+            for(int i= 0; i < n; i++)
+                if(on[i] == state && (best < 0 || (cluster ? energy[i] > energy[best] : energy[i] < energy[best])))
+                    best= i;
+            return best;
+        };
+
+        // motif initial : 10% des pixels, choisis au hasard, puis deplaces des amas vers les trous
+        int count= n / 10;
+        uint32_t h= 0;
+        for(int i= 0; i < count; i++)
+        {
+            int p;
+            do { h= pcg_hash(h); p= h % n; } while(on[p]);
+            on[p]= 1;
+            splat(p, 1);
+        }
+        for(;;)
+        {
+            int c= extreme(1, true);
+            on[c]= 0;
+            splat(c, -1);
+            int v= extreme(0, false);
+            on[v]= 1;
+            splat(v, 1);
+            if(v == c)
+                break;
+        }
+
+        std::vector<int> rank(n, 0);
+        {
+            // rang des pixels du motif initial : retire les amas
+            std::vector<int> initial= on;
+            std::vector<float> initial_energy= energy;
+            for(int r= count -1; r >= 0; r--)
+            {
+                int c= extreme(1, true);
+                on[c]= 0;
+                splat(c, -1);
+                rank[c]= r;
+            }
+            on= initial;
+            energy= initial_energy;
+        }
+
+        // rang des autres pixels : remplit les trous
+        for(int r= count; r < n; r++)
+        {
+            int v= extreme(0, false);
+            on[v]= 1;
+            splat(v, 1);
+            rank[v]= r;
+        }
+
+        std::vector<float> values(n);
+        for(int i= 0; i < n; i++)
+            values[i]= (rank[i] + 0.5f) / n;
+        return values;
+    }
+};
+
+// nombres successifs d'un echantillon d'un pixel, avec n'importe quelle sequence, cf shade() et occultationAmb() dans tp2.cpp
+template< typename Sequence >
+struct PixelSampler
+{
+    const Sequence& sequence;
+    uint32_t pixel;
+    uint32_t first;     // premier echantillon, cf les passes d'un rendu progressif
+    uint32_t index;
+    uint32_t dimension;
+
+    PixelSampler( const Sequence& _sequence, const uint32_t _pixel, const uint32_t _first= 0 ) :
+        sequence(_sequence), pixel(_pixel), first(_first), index(_first), dimension(0) {}
+
+    // commence l'echantillon first + i, a partir de la dimension d
+    void start( const uint32_t i, const uint32_t d= 0 ) { index= first + i; dimension= d; }
+
+    // dimension suivante de l'echantillon
+    float operator() ( ) { return sequence(pixel, index, dimension++); }
+};
+
+#endif
@@ -0,0 +1,163 @@
+
+//! \file sampler_bench.cpp compare la convergence des sequences d'echantillons de sampler.h, sur l'occultation ambiante de tp2
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+
+#include "vec.h"
+#include "mat.h"
+#include "orbiter.h"
+#include "mesh.h"
+#include "wavefront_fast.h"
+#include "rng.h"
+#include "sampler.h"
+#include "bvh.h"
+#include "bvh_wide.h"
+
+
+// repere local autour de la normale, cf World dans tp2.cpp
+struct Frame
+{
+    Frame( const Vector& _n ) : n(_n)
+    {
+        float sign= std::copysign(1.0f, n.z);
+        float a= -1.0f / (sign + n.z);
+        float d= n.x * n.y * a;
+        t= Vector(1.0f + sign * n.x * n.x * a, sign * d, -sign * n.x);
+        b= Vector(d, sign + n.y * n.y * a, -n.y);
+    }
+
+    Vector operator( ) ( const Vector& local )  const { return local.x * t + local.y * b + local.z * n; }
+
+    Vector t;
+    Vector b;
+    Vector n;
+};
+
+// point visible dans un pixel
+struct Shading
+{
+    Point o;
+    Vector n;
+    int pixel;
+};
+
+// occultation ambiante de tous les points visibles, avec spp echantillons par pixel
+template< typename Sequence >
+double render( const BVH4& bvh, const std::vector<Shading>& points, const Sequence& sequence, const int spp, std::vector<float>& values )
+{
+    values.resize(points.size());
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    const int n= int(points.size());
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(int i= 0; i < n; i++)
+    {
+        PixelSampler<Sequence> sampler(sequence, points[i].pixel);
+        Frame frame(points[i].n);
+
+        int visible= 0;
+        for(int s= 0; s < spp; s++)
+        {
+            sampler.start(s);
+            float u1= sampler();
+            float u2= sampler();
+            visible+= !bvh.occluded(Ray(points[i].o, frame(sample35(u1, u2))));
+        }
+        values[i]= float(visible) / spp;
+    }
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+double rmse( const std::vector<float>& values, const std::vector<float>& reference )
+{
+    double sum= 0;
+    for(int i= 0; i < int(values.size()); i++)
+        sum+= (values[i] - reference[i]) * (values[i] - reference[i]);
+    return std::sqrt(sum / std::max(1, int(values.size())));
+}
+
+template< typename Sequence >
+void bench( const char *name, const BVH4& bvh, const std::vector<Shading>& points, const Sequence& sequence, const std::vector<float>& reference )
+{
+    printf("%s:\n", name);
+    std::vector<float> values;
+    for(int spp= 1; spp <= 64; spp*= 2)
+    {
+        double cpu= render(bvh, points, sequence, spp, values);
+        printf("  %3d spp %8.1fms rmse %.5f\n", spp, cpu, rmse(values, reference));
+    }
+}
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    if(argc > 1)
+        mesh_filename= argv[1];
+
+    const char *orbiter_filename= "data/cornell_orbiter.txt";
+    if(argc > 2)
+        orbiter_filename= argv[2];
+
+    // nombre d'echantillons de l'image de reference
+    int reference_spp= 1024;
+    if(argc > 3)
+        reference_spp= atoi(argv[3]);
+
+    Orbiter camera;
+    if(camera.read_orbiter(orbiter_filename) < 0)
+        return 1;
+
+    Mesh mesh= read_mesh_fast(mesh_filename);
+    if(mesh == Mesh::error())
+        return 1;
+
+    BVH bvh;
+    bvh.build(mesh);
+    BVH4 wide;
+    wide.build(bvh);
+
+    // points visibles, normales du cote de la camera
+    const int width= 256;
+    const int height= 192;
+    camera.projection(width, height, 45);
+    Transform inv= Inverse(camera.viewport() * camera.projection() * camera.view());
+
+    std::vector<Shading> points;
+    for(int y= 0; y < height; y++)
+    for(int x= 0; x < width; x++)
+    {
+        Ray ray(inv(Point(x + .5f, y + .5f, 0)), inv(Point(x + .5f, y + .5f, 1)));
+        Hit hit= wide.intersect(ray);
+        if(!hit)
+            continue;
+
+        const TriangleData& data= mesh.triangle(hit.triangle_id);
+        Vector n= normalize(cross(Vector(data.a, data.b), Vector(data.a, data.c)));
+        if(dot(n, ray.d) > 0) n= -n;
+
+        Point p= ray.o + hit.t * ray.d;
+        points.push_back( { p + 0.001f * n, n, y * width + x } );
+    }
+    printf("%dx%d pixels, %d visible points\n", width, height, int(points.size()));
+
+    // reference : nombres independants, avec une autre graine que les sequences comparees
+    std::vector<float> reference;
+    {
+        double cpu= render(wide, points, RandomSequence(0x9e3779b9u), reference_spp, reference);
+        printf("reference %d spp %.1fms\n", reference_spp, cpu);
+    }
+
+    bench("random", wide, points, RandomSequence(), reference);
+    bench("halton", wide, points, HaltonSequence(), reference);
+    bench("sobol", wide, points, SobolSequence(), reference);
+    bench("blue noise", wide, points, BlueNoiseSequence(width), reference);
+
+    return 0;
+}
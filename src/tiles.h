@@ -0,0 +1,242 @@
+#ifndef _TILES_H
+#define _TILES_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* repartition des tuiles de l'image entre les threads, cf tp2.cpp
+    les tuiles sont numerotees ligne par ligne, cf PacketCamera, puis ordonnees : par lignes, le long d'une courbe de morton, ou en spirale depuis le centre.
+    chaque thread recoit une suite de tuiles voisines dans cet ordre, et les rayons d'un thread visitent les memes noeuds du bvh.
+    un thread qui n'a plus de tuiles vole la moitie des tuiles restantes d'un autre thread.
+
+    cf "scheduling multithreaded computations by work stealing", R. Blumofe, C. Leiserson, 1999
+ */
+
+// entrelace les bits de x et y
+inline uint32_t morton2( const uint32_t x, const uint32_t y )
+{
+    auto spread= []( uint32_t v )
+    {
+        v&= 0xffff;
+        v= (v | (v << 8)) & 0x00ff00ffu;
+        v= (v | (v << 4)) & 0x0f0f0f0fu;
+        v= (v | (v << 2)) & 0x33333333u;
+        v= (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// temps de calcul d'une tuile
+struct TileStat
+{
+    int thread;
+    bool stolen;        // la tuile a ete volee a un autre thread
+    float ms;
+};
+
+struct TileScheduler
+{
+    enum Order { ROWS, MORTON, SPIRAL };
+
+    int tiles_x, tiles_y;
+    Order order_type;
+    std::vector<int> order;         // tuiles, dans l'ordre de visite
+    std::vector<TileStat> stats;    // temps de calcul de chaque tuile, cf done()
+
+    TileScheduler( const int _tiles_x, const int _tiles_y, const Order _order= MORTON, const int _threads= max_threads() ) :
+        tiles_x(_tiles_x), tiles_y(_tiles_y), order_type(_order), order(), stats(_tiles_x * _tiles_y), queues(std::max(1, _threads))
+    {
+        const int n= tiles_x * tiles_y;
+        std::vector<uint64_t> keys(n);
+        for(int i= 0; i < n; i++)
+        {
+            int x= i % tiles_x;
+            int y= i / tiles_x;
+            if(order_type == MORTON)
+                keys[i]= morton2(x, y);
+            else if(order_type == SPIRAL)
+            {
+                // anneau autour du centre, puis angle dans l'anneau
+                float dx= x - (tiles_x -1) / 2.f;
+                float dy= y - (tiles_y -1) / 2.f;
+                uint32_t ring= uint32_t(std::max(std::abs(dx), std::abs(dy)) * 2);
+                uint32_t angle= uint32_t((std::atan2(dy, dx) + float(M_PI)) / float(2 * M_PI) * 65535);
+                keys[i]= (uint64_t(ring) << 16) | angle;
+            }
+            else
+                keys[i]= i;
+
+            keys[i]= (keys[i] << 32) | uint32_t(i);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        order.resize(n);
+        for(int i= 0; i < n; i++)
+            order[i]= int(keys[i] & 0xffffffffu);
+
+        // repartit les tuiles : une suite de tuiles voisines par thread
+        const int threads= int(queues.size());
+        for(int t= 0; t < threads; t++)
+        {
+            queues[t].begin= int(int64_t(n) * t / threads);
+            queues[t].end= int(int64_t(n) * (t +1) / threads);
+        }
+    }
+
+    static int max_threads( )
+    {
+    #ifdef _OPENMP
+        return omp_get_max_threads();
+    #else
+        return 1;
+    #endif
+    }
+
+    static int thread_id( )
+    {
+    #ifdef _OPENMP
+        return omp_get_thread_num();
+    #else
+        return 0;
+    #endif
+    }
+
+    // tuile suivante du thread, renvoie faux lorsqu'il ne reste plus de tuiles, ni a lui, ni aux autres threads
+    bool next( const int thread, int& tile, bool& stolen )
+    {
+        Queue& queue= queues[thread % queues.size()];
+        stolen= false;
+        for(;;)
+        {
+            {
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if(queue.begin < queue.end)
+                {
+                    tile= order[queue.begin++];
+                    return true;
+                }
+            }
+
+            if(!steal(thread % queues.size()))
+                return false;
+            stolen= true;
+        }
+    }
+
+    // enregistre le temps de calcul d'une tuile
+    void done( const int tile, const int thread, const bool stolen, const float ms )
+    {
+        TileStat stat= { thread, stolen, ms };
+        stats[tile]= stat;
+    }
+
+    void print( ) const
+    {
+        const char *names[]= { "rows", "morton", "spiral" };
+        const int n= int(stats.size());
+        if(n == 0)
+            return;
+
+        float total= 0;
+        int steals= 0;
+        int slowest= 0;
+        for(int i= 0; i < n; i++)
+        {
+            total+= stats[i].ms;
+            steals+= stats[i].stolen;
+            if(stats[i].ms > stats[slowest].ms)
+                slowest= i;
+        }
+
+        float mean= total / n;
+        float variance= 0;
+        float fastest= stats[0].ms;
+        for(int i= 0; i < n; i++)
+        {
+            variance+= (stats[i].ms - mean) * (stats[i].ms - mean);
+            fastest= std::min(fastest, stats[i].ms);
+        }
+
+        printf("tiles %dx%d, %s order: %.2fms min, %.2fms mean, %.2fms max (tile %d %d), %.2fms stddev, %d stolen\n",
+            tiles_x, tiles_y, names[order_type], fastest, mean, stats[slowest].ms, slowest % tiles_x, slowest / tiles_x, std::sqrt(variance / n), steals);
+
+        // charge de chaque thread : le rendu se termine avec le thread le plus charge
+        std::vector<float> busy(queues.size(), 0);
+        std::vector<int> count(queues.size(), 0);
+        for(int i= 0; i < n; i++)
+        {
+            busy[stats[i].thread % busy.size()]+= stats[i].ms;
+            count[stats[i].thread % count.size()]++;
+        }
+
+        float busiest= *std::max_element(busy.begin(), busy.end());
+        printf("  %d threads: %.1fms max busy, %.1fms mean busy, balance %.2f\n", int(busy.size()), busiest, total / busy.size(),
+            busiest > 0 ? total / busy.size() / busiest : 1.f);
+        for(int t= 0; t < int(busy.size()) && busy.size() <= 16; t++)
+            printf("  thread %2d: %4d tiles %8.1fms\n", t, count[t], busy[t]);
+    }
+
+protected:
+    // tuiles d'un thread : order[begin .. end)
+    struct Queue
+    {
+        std::mutex lock;
+        std::atomic<int> begin, end;    // modifies avec le verrou, mais lus sans verrou pour choisir une victime, cf steal()
+        char pad[64];   // une file par ligne de cache
+
+        Queue( ) : lock(), begin(0), end(0) {}
+    };
+
+    std::vector<Queue> queues;
+
+    // vole la moitie des tuiles restantes du thread le plus charge, renvoie faux s'il ne reste plus de tuiles
+    bool steal( const int thread )
+    {
+        for(;;)
+        {
+            // choisit une victime, sans verrou, puis verifie
+            int victim= -1;
+            int remaining= 0;
+            for(int t= 0; t < int(queues.size()); t++)
+            {
+                int r= queues[t].end.load(std::memory_order_relaxed) - queues[t].begin.load(std::memory_order_relaxed);
+                if(t != thread && r > remaining)
+                {
+                    victim= t;
+                    remaining= r;
+                }
+            }
+            if(victim < 0)
+                return false;
+
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> guard(queues[victim].lock);
+                remaining= queues[victim].end - queues[victim].begin;
+                if(remaining <= 0)
+                    continue;
+
+                end= queues[victim].end;
+                begin= end - (remaining +1) / 2;
+                queues[victim].end= begin;
+            }
+
+            std::lock_guard<std::mutex> guard(queues[thread].lock);
+            queues[thread].begin= begin;
+            queues[thread].end= end;
+            return true;
+        }
+    }
+};
+
+#endif
@@ -4,7 +4,10 @@
 #include <vector>
 #include <cfloat>
 #include <chrono>
-#include <random>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include "vec.h"
 #include "mat.h"
@@ -15,7 +18,32 @@
 #include "orbiter.h"
 #include "mesh.h"
 #include "wavefront_fast.h"
+#include "rng.h"
 #include "sampler.h"
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "bvh_packet.h"
+#include "tiles.h"
+#include "film.h"
+#include "lights.h"
+#include "brdf.h"
+#include "ray_stats.h"
+
+#ifdef RAY_STATS
+// compte les allocations dynamiques de chaque thread, pour verifier que le rendu des pixels n'alloue rien, cf ShadingContext.
+// un thread_local sans constructeur, operator new ne peut pas utiliser ray_stats(), qui alloue les compteurs du thread
+static thread_local long long thread_allocations= 0;
+
+void *operator new( std::size_t size )
+{
+    thread_allocations++;
+    if(void *p= malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete( void *p ) noexcept { free(p); }
+#endif
 
 struct World
 {
@@ -39,180 +67,6 @@ struct World
     Vector n;
 };
 
-struct Ray
-{
-    Point o;            // origine
-    Vector d;           // direction
-    float tmax;             // intervalle [0 tmax]
-    
-    Ray( const Point& _o, const Point& _e ) :  o(_o), d(Vector(_o, _e)) {}
-    
-    Ray( const Point& origine, const Vector& direction ) : o(origine), d(direction), tmax(FLT_MAX) {}
-};
-
-struct Hit
-{
-    float t;            // p(t)= o + td, position du point d'intersection sur le rayon
-    float u, v;         // p(u, v), position du point d'intersection sur le triangle
-    int triangle_id;    // indice du triangle dans le mesh
-    
-    Hit( ) : t(FLT_MAX), u(), v(), triangle_id(-1) {}
-    Hit( const float _t, const float _u, const float _v, const int _id ) : t(_t), u(_u), v(_v), triangle_id(_id) {}
-    operator bool ( ) { return (triangle_id != -1); }
-};
-
-struct RayHit
-{
-    Point o;            // origine
-    float t;            // p(t)= o + td, position du point d'intersection sur le rayon
-    Vector d;           // direction
-    int triangle_id;    // indice du triangle dans le mesh
-    float u, v;
-    int x, y;
-    
-    RayHit( const Point& _o, const Point& _e ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(), y() {}
-    RayHit( const Point& _o, const Point& _e, const int _x, const int _y ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(_x), y(_y) {}
-    operator bool ( ) { return (triangle_id != -1); }
-};
-
-struct BBoxHit
-{
-    float tmin, tmax;
-    
-    BBoxHit() : tmin(FLT_MAX), tmax(-FLT_MAX) {}
-    BBoxHit( const float _tmin, const float _tmax ) : tmin(_tmin), tmax(_tmax) {}
-    float centroid( ) const { return (tmin + tmax) / 2; }
-    operator bool( ) const { return tmin <= tmax; }
-};
-
-
-struct BBox
-{
-    Point pmin, pmax;
-    
-    BBox( ) : pmin(), pmax() {}
-    
-    BBox( const Point& p ) : pmin(p), pmax(p) {}
-    BBox( const BBox& box ) : pmin(box.pmin), pmax(box.pmax) {}
-    
-    BBox& insert( const Point& p ) { pmin= min(pmin, p); pmax= max(pmax, p); return *this; }
-    BBox& insert( const BBox& box ) { pmin= min(pmin, box.pmin); pmax= max(pmax, box.pmax); return *this; }
-    
-    float centroid( const int axis ) const { return (pmin(axis) + pmax(axis)) / 2; }
-    
-    BBoxHit intersect( const RayHit& ray ) const
-    {
-        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
-        return intersect(ray, invd);
-    }
-    
-    BBoxHit intersect( const RayHit& ray, const Vector& invd ) const
-    {
-        Point rmin= pmin;
-        Point rmax= pmax;
-        if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
-        if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
-        if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
-        Vector dmin= (rmin - ray.o) * invd;
-        Vector dmax= (rmax - ray.o) * invd;
-        
-        float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
-        float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, ray.t)));
-        return BBoxHit(tmin, tmax);
-    }
-};
-
-struct Triangle
-{
-    Point p;            // sommet a du triangle
-    Vector e1, e2;      // aretes ab, ac du triangle
-    int id;
-    
-    float aire;
-
-    Triangle( const TriangleData& data, const int _id ) : p(data.a), e1(Vector(data.a, data.b)), e2(Vector(data.a, data.c)), id(_id) {
-        float ab = length(e1);
-        float ac = length(e2);
-        float bc = length((p+e2) - (p+e1));
-        float p = (ab + ac + bc)/ 2.f;
-        aire = sqrt(p * (p - ab) * (p - bc) * (p - ac));
-    }
-    
-    /* calcule l'intersection ray/triangle
-        cf "fast, minimum storage ray-triangle intersection" 
-        
-        renvoie faux s'il n'y a pas d'intersection valide (une intersection peut exister mais peut ne pas se trouver dans l'intervalle [0 tmax] du rayon.)
-        renvoie vrai + les coordonnees barycentriques (u, v) du point d'intersection + sa position le long du rayon (t).
-        convention barycentrique : p(u, v)= (1 - u - v) * a + u * b + v * c
-    */
-    Hit intersect( const Ray &ray, const float tmax ) const
-    {
-        Vector pvec= cross(ray.d, e2);
-        float det= dot(e1, pvec);
-        
-        float inv_det= 1 / det;
-        Vector tvec(p, ray.o);
-        
-        float u= dot(tvec, pvec) * inv_det;
-        if(u < 0 || u > 1) return Hit();
-        
-        Vector qvec= cross(tvec, e1);
-        float v= dot(ray.d, qvec) * inv_det;
-        if(v < 0 || u + v > 1) return Hit();
-        
-        float t= dot(e2, qvec) * inv_det;
-        if(t > tmax || t < 0) return Hit();
-        
-        return Hit(t, u, v, id);           // p(u, v)= (1 - u - v) * a + u * b + v * c
-    }
-
-    //GI compemdium eq 18
-    Point sample18(const float u1, const float u2) const
-    {
-        float r1 = std::sqrt(u1);
-        float a = 1 - r1;
-        float b = (1 - u2) * r1;
-        float g = u2 * r1;
-        return a * p + b * (p + e1) + g * (p + e2);
-    }
-
-    float pdf18(const Point& p) const
-    {
-        return 1.0 / aire;
-    }
-
-    void intersect( RayHit &ray ) const
-    {
-        Vector pvec= cross(ray.d, e2);
-        float det= dot(e1, pvec);
-        
-        float inv_det= 1 / det;
-        Vector tvec(p, ray.o);
-        
-        float u= dot(tvec, pvec) * inv_det;
-        if(u < 0 || u > 1) return;
-        
-        Vector qvec= cross(tvec, e1);
-        float v= dot(ray.d, qvec) * inv_det;
-        if(v < 0 || u + v > 1) return;
-        
-        float t= dot(e2, qvec) * inv_det;
-        if(t < 0 || t > ray.t) return;
-        
-        // touche !!
-        ray.t= t;
-        ray.triangle_id= id;
-        ray.u= u;
-        ray.v= v;
-    }
-
-    BBox bounds( ) const 
-    {
-        BBox box(p);
-        return box.insert(p+e1).insert(p+e2);
-    }
-};
-
 Vector normal( const Mesh& mesh, const Hit& hit )
 {
     // recuperer le triangle complet dans le mesh
@@ -236,419 +90,633 @@ struct Source
     int triangle_id;
 };
 
-// construction de l'arbre / BVH
-struct Node
+// scene construite une seule fois, puis partagee en lecture seule par tous les threads : geometrie, bvh, sources et materiaux
+struct Scene
 {
-    BBox bounds;
-    int left;
-    int right;
-    
-    bool internal( ) const { return right > 0; }                        // renvoie vrai si le noeud est un noeud interne
-    int internal_left( ) const { assert(internal()); return left; }     // renvoie le fils gauche du noeud interne 
-    int internal_right( ) const { assert(internal()); return right; }   // renvoie le fils droit
-    
-    bool leaf( ) const { return right < 0; }                            // renvoie vrai si le noeud est une feuille
-    int leaf_begin( ) const { assert(leaf()); return -left; }           // renvoie le premier objet de la feuille
-    int leaf_end( ) const { assert(leaf()); return -right; }            // renvoie le dernier objet
-};
+    const Mesh& mesh;
+    BVH4 bvh;
+    std::vector<int> triangle_index;    // position de chaque triangle du mesh dans bvh.triangles, cf triangle()
+    std::vector<Source> sources;
+    std::vector<Color> diffuse;
+    Lights lights;      // choix des sources pour shade(), cf lights.h
 
-// creation d'un noeud interne
-Node make_node( const BBox& bounds, const int left, const int right )
-{
-    Node node { bounds, left, right };
-    assert(node.internal());    // verifie que c'est bien un noeud...
-    return node;
-}
+    Scene( const Mesh& _mesh, const bool light_tree= false ) : mesh(_mesh), bvh(), triangle_index(), sources(), diffuse(), lights()
+    {
+        // construit le bvh, une seule fois, pour tous les rayons, puis regroupe ses noeuds par 4, les 4 englobants sont testes ensemble.
+        // le bvh binaire n'est plus utilise ensuite, il est detruit a la fin du bloc
+        {
+            BVH binary;
+            auto start= std::chrono::high_resolution_clock::now();
+            binary.build(mesh);
 
-// creation d'une feuille
-Node make_leaf( const BBox& bounds, const int begin, const int end )
-{
-    Node node { bounds, -begin, -end };
-    assert(node.leaf());        // verifie que c'est bien une feuille...
-    return node;
-}
+            auto stop= std::chrono::high_resolution_clock::now();
+            int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+            printf("bvh build %dms: %d triangles, sah %d bins, %d triangles/leaf max\n", cpu, int(binary.triangles.size()), binary.bins, binary.leaf_size);
+            binary.stats().print();
 
+            start= std::chrono::high_resolution_clock::now();
+            bvh.build(binary);
 
-struct triangle_less1
-{
-    int axis;
-    float cut;
-    
-    triangle_less1( const int _axis, const float _cut ) : axis(_axis), cut(_cut) {}
-    
-    bool operator() ( const Triangle& triangle ) const
-    {
-        // re-construit l'englobant du triangle
-        BBox bounds= triangle.bounds();
-        return bounds.centroid(axis) < cut;
-    }
-};
+            stop= std::chrono::high_resolution_clock::now();
+            cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+            printf("bvh4 %dms: %d nodes, %.2f children/node, %s kernel\n", cpu, int(bvh.nodes.size()), bvh.children(), bvh.kernel_name(bvh.kernel));
+        }
 
+        // les triangles du bvh4 sont ranges par feuille, retrouve chaque triangle du mesh, sans le copier
+        int n= mesh.triangle_count();
+        triangle_index.assign(n, -1);
+        for(int i= 0; i < int(bvh.triangles.size()); i++)
+            if(bvh.triangles[i].id != -1)
+                triangle_index[bvh.triangles[i].id]= i;
 
-struct BVH
-{
-    std::vector<Node> nodes;
-    std::vector<Triangle> triangles;
-    int root;
-    
-    int direct_tests;
-    
-    // construit un bvh pour l'ensemble de triangles
-    int build( const BBox& _bounds, const std::vector<Triangle>& _triangles )
-    {
-        triangles= _triangles;  // copie les triangles pour les trier
-        nodes.clear();          // efface les noeuds
-        nodes.reserve(triangles.size());
-        
-        // construit l'arbre... 
-        root= build(_bounds, 0, triangles.size());
-        // et renvoie la racine
-        return root;
-    }
-    
-    void intersect( RayHit& ray ) const
-    {
-        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
-        intersect(root, ray, invd);
-    }
-    
-    void intersect_fast( RayHit& ray ) const
-    {
-        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
-        intersect_fast(root, ray, invd);
-    }
-    
-protected:
-    // construction d'un noeud
-    int build( const BBox& bounds, const int begin, const int end )
-    {
-        if(end - begin < 2)
-        {
-            // inserer une feuille et renvoyer son indice
-            int index= nodes.size();
-            nodes.push_back(make_leaf(bounds, begin, end));
-            return index;
-        }
-        
-        // axe le plus etire de l'englobant
-        Vector d= Vector(bounds.pmin, bounds.pmax);
-        int axis;
-        if(d.x > d.y && d.x > d.z)  // x plus grand que y et z ?
-            axis= 0;
-        else if(d.y > d.z)          // y plus grand que z ? (et que x implicitement)
-            axis= 1;
-        else                        // x et y ne sont pas les plus grands...
-            axis= 2;
-
-        // coupe l'englobant au milieu
-        float cut= bounds.centroid(axis);
-        
-        // repartit les triangles 
-        Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less1(axis, cut));
-        int m= std::distance(triangles.data(), pm);
-        
-        // la repartition des triangles peut echouer, et tous les triangles sont dans la meme partie... 
-        // forcer quand meme un decoupage en 2 ensembles 
-        if(m == begin || m == end)
-            m= (begin + end) / 2;
-        assert(m != begin);
-        assert(m != end);
-        
-        // construire le fils gauche
-        // les triangles se trouvent dans [begin .. m)
-        BBox bounds_left= triangle_bounds(begin, m);
-        int left= build(bounds_left, begin, m);
-        
-        // on recommence pour le fils droit
-        // les triangles se trouvent dans [m .. end)
-        BBox bounds_right= triangle_bounds(m, end);
-        int right= build(bounds_right, m, end);
-        
-        int index= nodes.size();
-        nodes.push_back(make_node(bounds, left, right));
-        return index;
-    }
-    
-    BBox triangle_bounds( const int begin, const int end )
-    {
-        BBox bbox= triangles[begin].bounds();
-        for(int i= begin +1; i < end; i++)
-            bbox.insert(triangles[i].bounds());
-        
-        return bbox;
-    }
-    
-    void intersect( const int index, RayHit& ray, const Vector& invd ) const
-    {
-        const Node& node= nodes[index];
-        if(node.bounds.intersect(ray, invd))
+        // recupere les materiaux diffus et les sources
+        diffuse.reserve(n);
+        for(int i= 0; i < n; i++)
         {
-            if(node.leaf())
-            {
-                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
-                    triangles[i].intersect(ray);
-            }
-            else // if(node.internal())
+            const Material& material= mesh.triangle_material(i);
+            diffuse.push_back(material.diffuse);
+            if(material.emission.r + material.emission.g + material.emission.b > 0)
             {
-                intersect(node.internal_left(), ray, invd);
-                intersect(node.internal_right(), ray, invd);
+                // utiliser le centre du triangle comme source de lumiere
+                const TriangleData& data= mesh.triangle(i);
+                Point p= (Point(data.a) + Point(data.b) + Point(data.c)) / 3;
+
+                sources.push_back( { p, material.emission, i} );
             }
         }
+
+        printf("%d sources\n", int(sources.size()));
+        assert(sources.size() > 0);
+
+        lights.build(mesh);
+        lights.tree= light_tree;
+        printf("%d lights, %s\n", lights.size(), light_tree ? "light tree" : "alias table");
     }
-    
-    void intersect_fast( const int index, RayHit& ray, const Vector& invd ) const
+
+    // triangle touche par un rayon, cf Hit::triangle_id
+    const Triangle& triangle( const int id ) const { return bvh.triangles[triangle_index[id]]; }
+};
+
+// tampons de travail d'un thread, alloues une seule fois et reutilises pour tous ses pixels
+struct ShadingContext
+{
+    std::vector<Point> targets;
+    std::vector<LightSample> samples;
+    std::vector<int> hidden;
+
+    ShadingContext( const int N= 64 ) : targets(), samples(), hidden()
     {
-        const Node& node= nodes[index];
-        if(node.leaf())
-        {
-            for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
-                triangles[i].intersect(ray);
-        }
-        else // if(node.internal())
-        {
-            const Node& left_node= nodes[node.left];
-            const Node& right_node= nodes[node.right];
-            
-            BBoxHit left= left_node.bounds.intersect(ray, invd);
-            BBoxHit right= right_node.bounds.intersect(ray, invd);
-            if(left && right)                                                   // les 2 fils sont touches par le rayon...
-            {
-                if(left.centroid() < right.centroid())                          // parcours de gauche a droite
-                {
-                    intersect_fast(node.internal_left(), ray, invd);
-                    intersect_fast(node.internal_right(), ray, invd);
-                }
-                else                                                            // parcours de droite a gauche                                        
-                {
-                    intersect_fast(node.internal_right(), ray, invd);
-                    intersect_fast(node.internal_left(), ray, invd);
-                }
-            }
-            else if(left)                                                       // uniquement le fils gauche
-                intersect_fast(node.internal_left(), ray, invd);
-            else if(right)
-                intersect_fast(node.internal_right(), ray, invd);               // uniquement le fils droit
-        }
+        targets.reserve(N);
+        samples.reserve(N);
+        hidden.reserve(N);
     }
 };
 
-Color shadeFlat(const Point o, const Hit hit, const std::vector<Triangle> triangles, const std::vector<Source> sources, const std::vector<Color> diffuse){
+Color shadeFlat(const Point& o, const Hit& hit, const Scene& scene){
     bool isLit = false;
 
     // Test si le point est visible par au moins une des sources
-    for(unsigned int i = 0; i < sources.size(); i++){
-        Ray r(o, sources[i].s);
-        Hit htemp;
-        for(int j= 0; j < int(triangles.size()); j++)
-        {
-            if(Hit h= triangles[j].intersect(r, htemp.t)){
-                htemp = h;
-            }
-        }
-        isLit = isLit || (htemp.triangle_id == sources[i].triangle_id);
-    }
+    for(unsigned int i = 0; i < scene.sources.size() && !isLit; i++)
+        isLit = !scene.bvh.occluded(o, scene.sources[i].s);
     if(isLit)
-        return diffuse[hit.triangle_id];
+        return scene.diffuse[hit.triangle_id];
     else
         return Color();
 }
 
-Color shade(const int N, std::uniform_real_distribution<float> &u01, std::default_random_engine &random, const Point o, const Vector n, const Mesh mesh,
-            const std::vector<Triangle> triangles, const std::vector<Source> sources, const  std::vector<Color> diffuse, const Material mat){
+template< typename Sampler >
+Color shade(const int N, Sampler& sampler, const Point& o, const Vector& n, const Material& mat,
+            const Scene& scene, ShadingContext& context){
+    std::vector<Point>& targets = context.targets;
+    std::vector<LightSample>& samples = context.samples;
+    std::vector<int>& hidden = context.hidden;
+    targets.resize(N);
+    samples.resize(N);
+
+    // N points sur l'ensemble des sources, quel que soit leur nombre, cf Lights
+    for(int k = 0; k < N; k++){
+        sampler.start(k);
+        float u0 = sampler();
+        float u1 = sampler();
+        float u2 = sampler();
+        samples[k] = scene.lights.sample(o, u0, u1, u2);
+        targets[k] = samples[k].p;
+    }
+
+    //on vérifie qu'on voit bien la lumière depuis ces points, tous les rayons d'ombre ensemble
     Color finalColor = Color(0,0,0);
-    for(unsigned int i = 0; i < sources.size(); i++){
-        for(int k = 0; k < N; k++){
-            float u1 = u01(random);
-            float u2 = u01(random);
-            // on génère un point random sur le triangle
-            Point sourcePos = triangles[sources[i].triangle_id].sample18(u1, u2);
-            Vector v = Vector(o, sourcePos);
-            Ray r(o, normalize(v));
-            //on vérifie qu'on voit bien la lumière depuis ce point
-            Hit htemp;
-            for(int j= 0; j < int(triangles.size()); j++)
-            {
-                if(Hit h= triangles[j].intersect(r, htemp.t)){
-                    htemp = h;
-                }
-            }
-            if(htemp.triangle_id == sources[i].triangle_id){
-                //si c'est le cas on applique le calcul de l'éclairage direct
-                Color fr = mat.diffuse / M_PI;
-                Vector lightNormal = normal(mesh, htemp);
-                finalColor = finalColor + sources[i].emission * fr
-                           *((std::fmax(0.,dot(n, r.d))*std::fmax(0.,dot(lightNormal, -r.d))) / dot(v, v))
-                           * triangles[htemp.triangle_id].aire;
-            }
-        }
+    if(scene.bvh.occluded(o, targets, hidden) == N)
+        return mat.emission;
+
+    Color fr = mat.diffuse / M_PI;
+    for(int k = 0; k < N; k++){
+        if(hidden[k])
+            continue;
+
+        //si c'est le cas on applique le calcul de l'éclairage direct, divise par la densite de proba du point
+        Vector v = Vector(o, targets[k]);
+        Vector d = normalize(v);
+        finalColor = finalColor + samples[k].emission * fr
+                   *((std::fmax(0.,dot(n, d))*std::fmax(0.,dot(samples[k].n, -d))) / dot(v, v))
+                   / samples[k].pdf;
     }
     return mat.emission + finalColor / N;
 }
 
-Color occultationAmb(const int N, std::uniform_real_distribution<float> &u01, std::default_random_engine &random, const Point o, const Vector n,
-            const std::vector<Triangle> triangles){
+template< typename Sampler >
+Color occultationAmb(const int N, Sampler& sampler, const Point& o, const Vector& n,
+            const Scene& scene){
     World _w = World(n);
     float occultation = 0.;
     for(int i = 0; i < N; i++){
-        Ray r(o,_w(sample35(u01(random), u01(random))));
-        Hit htemp;
-        for(int j= 0; j < int(triangles.size()); j++)
-        {
-            if(Hit h= triangles[j].intersect(r, htemp.t)){
-                htemp = h;
-            }
-        }
-        if(!htemp)
+        sampler.start(i);
+        float u1 = sampler();
+        float u2 = sampler();
+        Ray r(o,_w(sample35(u1, u2)));
+        // il suffit de savoir si une intersection existe, pas de trouver la plus proche
+        if(!scene.bvh.occluded(r))
             occultation += 1.;
     }
     return Color(occultation / N);
 }
 
-int main( const int argc, const char **argv )
+// heuristique de puissance, cf "optimally combining sampling techniques for monte carlo rendering", E. Veach, L. Guibas, 1995
+float power_heuristic( const float a, const float b )
+{
+    if(a == 0) return 0;
+    return (a * a) / (a * a + b * b);
+}
+
+/* N chemins a partir du point visible hit, eclairage global :
+    a chaque rebond, un point sur les sources, cf Lights, et une direction choisie par la brdf, cf Brdf, combines par MIS.
+    les chemins s'arretent par roulette russe, ou apres max_depth rebonds.
+ */
+template< typename Sampler >
+Color path(const int N, Sampler& sampler, const Ray& ray, const Hit& primary,
+            const Scene& scene, const int max_depth= 16){
+    Color finalColor = Color(0,0,0);
+    for(int k = 0; k < N; k++){
+        sampler.start(k);
+
+        Hit hit = primary;
+        Vector wo = -normalize(ray.d);
+        Color weight = White();     // produit des brdf * cos / pdf le long du chemin
+        float pdf_brdf = 0;         // densite de la direction qui a touche hit, par rapport aux angles solides
+        Point previous;             // origine de cette direction
+
+        for(int depth = 0; ; depth++){
+            const Material &mat = scene.mesh.triangle_material(hit.triangle_id);
+            const Triangle &triangle = scene.triangle(hit.triangle_id);
+            Point p = triangle.p*(1 - hit.u - hit.v) +
+                      (triangle.p + triangle.e1)*hit.u +
+                      (triangle.p + triangle.e2)*hit.v;
+            Vector n = normal(scene.mesh, hit);
+
+            // les sources n'emettent que du cote de leur normale, cf shade()
+            if(dot(n, wo) > 0 && mat.emission.max() > 0){
+                if(depth == 0)
+                    finalColor = finalColor + weight * mat.emission;
+                else{
+                    // la source est aussi choisie par l'eclairage direct du rebond precedent
+                    float d2 = distance2(previous, p);
+                    float pdf_light = scene.lights.pdf(previous, hit.triangle_id) * d2 / dot(n, wo);
+                    finalColor = finalColor + weight * mat.emission * power_heuristic(pdf_brdf, pdf_light);
+                }
+            }
+            if(depth >= max_depth)
+                break;
+
+            // surfaces a 2 faces, oriente la normale du cote de wo
+            if(dot(n, wo) < 0)
+                n = -n;
+            World world(n);
+            Brdf brdf(mat);
+            Vector wo_local = world.inverse(wo);
+            Point o = p + 0.001 * n;
+
+            // eclairage direct : un point sur les sources
+            {
+                float u0 = sampler();
+                float u1 = sampler();
+                float u2 = sampler();
+                LightSample s = scene.lights.sample(o, u0, u1, u2);
+                Vector v = Vector(o, s.p);
+                Vector d = normalize(v);
+                float cos_theta = dot(n, d);
+                float cos_light = dot(s.n, -d);
+                if(cos_theta > 0 && cos_light > 0 && s.pdf > 0 && !scene.bvh.occluded(o, s.p)){
+                    Vector wi_local = world.inverse(d);
+                    float pdf_light = s.pdf * dot(v, v) / cos_light;
+                    finalColor = finalColor + weight * s.emission * brdf.f(wo_local, wi_local) * cos_theta
+                               * power_heuristic(pdf_light, brdf.pdf(wo_local, wi_local)) / pdf_light;
+                }
+            }
+
+            // rebond : une direction choisie par la brdf
+            float u0 = sampler();
+            float u1 = sampler();
+            float u2 = sampler();
+            Vector wi_local = brdf.sample(u0, u1, u2, wo_local);
+            pdf_brdf = brdf.pdf(wo_local, wi_local);
+            if(pdf_brdf <= 0)
+                break;
+
+            weight = weight * brdf.f(wo_local, wi_local) * (wi_local.z / pdf_brdf);
+
+            // roulette russe, apres quelques rebonds : continue avec une probabilite proportionnelle au poids du chemin
+            float u = sampler();
+            if(depth >= 2){
+                float q = std::min(0.95f, weight.max());
+                if(u >= q)
+                    break;
+                weight = weight / q;
+            }
+
+            Vector wi = world(wi_local);
+            hit = scene.bvh.intersect(Ray(o, wi));
+            if(!hit)
+                break;
+
+            previous = o;
+            wo = -wi;
+        }
+    }
+    return finalColor / N;
+}
+
+// options de la ligne de commande, cf usage()
+struct Options
 {
     const char *mesh_filename= "data/cornell.obj";
-    if(argc > 1)
-        mesh_filename= argv[1];
-        
     const char *orbiter_filename= "orbiter.txt";
-    if(argc > 2)
-        orbiter_filename= argv[2];
-    
-    Orbiter camera;
-    if(camera.read_orbiter(orbiter_filename) < 0)
-        return 1;
+    uint32_t seed= 0;               // graine des nombres aleatoires
+    int tile_size= PacketCamera::TILE;
+    TileScheduler::Order order= TileScheduler::MORTON;
+    float budget= 10;               // en secondes
+    float threshold= 0.01f;         // erreur standard de chaque pixel, cf Film::error()
+    bool light_tree= false;         // choix des sources : table d'alias, ou arbre de sources
+    std::string integrator= "ao";   // calcul des pixels : occultation ambiante "ao", eclairage direct "direct", ou eclairage global "path"
+    const char *checkpoint_filename= nullptr;
+    bool snapshots= false;          // images intermediaires, snapshot-0001.hdr, etc.
+    bool heatmap= false;            // nombre d'echantillons par pixel, spp.png et spp.hdr, et cout des pixels, cost.png et cost.hdr avec RAY_STATS
+};
 
-    Mesh mesh= read_mesh_fast(mesh_filename);
+void usage( const char *program )
+{
+    printf("usage: %s [mesh.obj [orbiter.txt]] [options]\n", program);
+    printf("  --seed n                      graine des nombres aleatoires, 0 par defaut\n");
+    printf("  --tile n                      taille des tuiles, un multiple de 4 pixels, %d par defaut\n", int(PacketCamera::TILE));
+    printf("  --order rows|morton|spiral    ordre de parcours des tuiles, morton par defaut\n");
+    printf("  --time s                      duree du rendu progressif, en secondes, 10 par defaut\n");
+    printf("  --threshold e                 erreur standard des pixels converges, 0.01 par defaut\n");
+    printf("  --lights alias|tree           choix des sources, table d'alias par defaut\n");
+    printf("  --integrator ao|direct|path   occultation ambiante, eclairage direct, ou eclairage global, ao par defaut\n");
+    printf("  --checkpoint file             sauve, et reprend, le rendu dans file\n");
+    printf("  --snapshots                   ecrit les images intermediaires, snapshot-0001.hdr, snapshot-0002.hdr, snapshot-0004.hdr, etc.\n");
+    printf("  --heatmap                     ecrit le nombre d'echantillons par pixel, spp.png et spp.hdr, et le cout des pixels avec RAY_STATS, cost.png et cost.hdr\n");
+}
 
-    
-    // recupere les triangles
-    std::vector<Triangle> triangles;
-    {
-        int n= mesh.triangle_count();
-        for(int i= 0; i < n; i++)
-            triangles.emplace_back(mesh.triangle(i), i);
-    }
-    
-    // recupere les materiaux diffus
-    std::vector<Color> diffuse;
-    
-    // recupere les sources
-    std::vector<Source> sources;
+// renvoie -1 pour une option inconnue, ou sans valeur
+int read_options( const int argc, const char **argv, Options& options )
+{
+    int positional= 0;
+    for(int i= 1; i < argc; i++)
     {
-        int n= mesh.triangle_count();
-        for(int i= 0; i < n; i++)
+        std::string option= argv[i];
+        if(option.compare(0, 2, "--") != 0)
         {
-            const Material& material= mesh.triangle_material(i);
-            diffuse.push_back(material.diffuse);
-            if(material.emission.r + material.emission.g + material.emission.b > 0)
-            {
-                // utiliser le centre du triangle comme source de lumi�re
-                const TriangleData& data= mesh.triangle(i);
-                Point p= (Point(data.a) + Point(data.b) + Point(data.c)) / 3;
-                
-                sources.push_back( { p, material.emission, i} );
-            }
+            if(positional == 0) options.mesh_filename= argv[i];
+            else if(positional == 1) options.orbiter_filename= argv[i];
+            else return -1;
+            positional++;
+            continue;
         }
-        
-        printf("%d sources\n", int(sources.size()));
-        assert(sources.size() > 0);
+
+        if(option == "--snapshots") { options.snapshots= true; continue; }
+        if(option == "--heatmap") { options.heatmap= true; continue; }
+
+        // les autres options ont une valeur
+        if(i +1 >= argc)
+            return -1;
+        std::string value= argv[++i];
+        if(option == "--seed") options.seed= atoi(value.c_str());
+        else if(option == "--tile") options.tile_size= std::max(4, atoi(value.c_str()) / 4 * 4);
+        else if(option == "--order")
+        {
+            if(value == "rows") options.order= TileScheduler::ROWS;
+            else if(value == "morton") options.order= TileScheduler::MORTON;
+            else if(value == "spiral") options.order= TileScheduler::SPIRAL;
+            else return -1;
+        }
+        else if(option == "--time") options.budget= atof(value.c_str());
+        else if(option == "--threshold") options.threshold= atof(value.c_str());
+        else if(option == "--lights")
+        {
+            if(value != "alias" && value != "tree") return -1;
+            options.light_tree= (value == "tree");
+        }
+        else if(option == "--integrator")
+        {
+            if(value != "ao" && value != "direct" && value != "path") return -1;
+            options.integrator= value;
+        }
+        else if(option == "--checkpoint") options.checkpoint_filename= argv[i];
+        else
+            return -1;
     }
 
+    return 0;
+}
+
+int main( const int argc, const char **argv )
+{
+    Options options;
+    if(read_options(argc, argv, options) < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Orbiter camera;
+    if(camera.read_orbiter(options.orbiter_filename) < 0)
+        return 1;
+
+    Mesh mesh= read_mesh_fast(options.mesh_filename);
+
+    // geometrie, bvh4, sources et materiaux, partages par tous les threads
+    const bool light_tree= options.light_tree;
+    const Scene scene(mesh, light_tree);
+    const bool direct= (options.integrator == "direct");
+    const bool global= (options.integrator == "path");
+    printf("%s integrator\n", options.integrator.c_str());
+
     
     Image image(1024, 768);
 
     // recupere les transformations
     camera.projection(image.width(), image.height(), 45);
-    Transform model= Identity();
-    Transform view= camera.view();
-    Transform projection= camera.projection();
-    Transform viewport= camera.viewport();
-    Transform inv= Inverse(viewport * projection * view * model);
-    
-auto startA= std::chrono::high_resolution_clock::now();
+    // genere les rayons primaires par paquets de 4x2 pixels, et par tuiles
+    PacketCamera packets(camera, image.width(), image.height(), options.tile_size);
+    const TileScheduler::Order order= options.order;
+
+    // rendu progressif : ajoute des passes de N echantillons par pixel, jusqu'a epuiser le temps, ou jusqu'a ce que tous les pixels aient converge
+    const int N= 16;
+    const float budget= options.budget;
+    const float threshold= options.threshold;
+    // echantillonnage adaptatif : au moins min_passes et au plus max_passes par pixel, cf Film::converged()
+    const int min_passes= 4;
+    const int max_passes= 256;
+
+    Film film(image.width(), image.height(), min_passes);
+#ifdef RAY_STATS
+    // noeuds visites et triangles testes par pixel, cf cost.png
+    std::vector<float> pixel_cost(image.width() * image.height(), 0);
+    // allocations pendant le calcul des pixels, et nombre de pixels calcules, toutes passes confondues
+    long long pixel_allocations= 0;
+    long long pixel_samples= 0;
+#endif
 
-    srand(time(0));
-    std::random_device seed;
-    std::default_random_engine random(seed());
-    std::uniform_real_distribution<float> u01(0.f, 1.f);
-    
+auto startA= std::chrono::high_resolution_clock::now();
 
-    // std::vector<RayHit> rays;
-    // c'est parti, parcours tous les pixels de l'image
-    #pragma omp parallel for schedule(dynamic, 1)
-    for(int y= 0; y < image.height(); y++)
-    for(int x= 0; x < image.width(); x++)
+    // graine des nombres aleatoires, l'image est identique pour une graine, quel que soit le nombre de threads
+    const uint32_t seed= options.seed;
+    // echantillons de sobol, cf sampler.h et sampler_bench.cpp
+    const SobolSequence sequence(seed);
+
+    // reprend un rendu interrompu, cf write_checkpoint() : etat du film, puis passe suivante, graine et options de l'image
+    const char *checkpoint_filename= options.checkpoint_filename;
+    const float checkpoint_interval= 60;    // en secondes
+    auto last_checkpoint= startA;
+
+    int pass= 0;
+    // le seuil est compare au bit pres, et la scene est identifiee par les noms du mesh et de l'orbiter
+    int threshold_bits;
+    memcpy(&threshold_bits, &threshold, sizeof(threshold_bits));
+    int scene_hash= checkpoint_hash(options.orbiter_filename, checkpoint_hash(options.mesh_filename));
+    std::vector<int> state= { pass, int(seed), N, direct ? 1 : global ? 2 : 0, int(light_tree), threshold_bits, scene_hash };
+    if(checkpoint_filename)
     {
-        // generer le rayon
-        Point origine= inv(Point(x + .5f, y + .5f, 0));
-        Point extremite= inv(Point(x + .5f, y + .5f, 1));
-        Ray ray(origine, extremite);
-
-        // rays.emplace_back(origine, extremite, x, y);
-        
-    #if 1 // CODE SANS BVH
-        // calculer les intersections avec tous les triangles
-        Hit hit;
-        for(int i= 0; i < int(triangles.size()); i++)
+        std::vector<int> resume;
+        if(read_checkpoint(film, resume, checkpoint_filename) == 0)
         {
-            if(Hit h= triangles[i].intersect(ray, hit.t))
-                // ne conserve que l'intersection la plus proche de l'origine du rayon
-                hit= h;
+            if(resume.size() == state.size() && std::equal(resume.begin() +1, resume.end(), state.begin() +1))
+            {
+                pass= resume[0];
+                printf("resume at pass %d, %d/%d pixels converged\n", pass +1, film.converged(threshold), image.width() * image.height());
+            }
+            else
+            {
+                printf("[error] checkpoint '%s': different seed, options or scene, restart...\n", checkpoint_filename);
+                film= Film(image.width(), image.height(), min_passes);
+            }
         }
+    }
+
+    for(; pass < max_passes; pass++)
+    {
+    auto start_pass= std::chrono::high_resolution_clock::now();
+    // repartit les tuiles entre les threads
+    TileScheduler scheduler(packets.tiles_x(), packets.tiles_y(), order);
+
+    // c'est parti, parcours toutes les tuiles de l'image
+    #pragma omp parallel
+    {
+    ShadingContext context;
+    const int thread= TileScheduler::thread_id();
+    // pixels de la tuile, accumules une fois la tuile terminee
+    std::vector<Color> framebuffer(packets.tile * packets.tile);
+    std::vector<int> sampled(packets.tile * packets.tile);
+
+#ifdef RAY_STATS
+    long long allocations= 0;
+    long long samples= 0;
+#endif
+
+    int tile;
+    bool stolen;
+    while(scheduler.next(thread, tile, stolen))
+    {
+    auto start= std::chrono::high_resolution_clock::now();
+    std::fill(framebuffer.begin(), framebuffer.end(), Color());
+    std::fill(sampled.begin(), sampled.end(), 0);
+    const int x0= packets.x(tile, 0, 0);
+    const int y0= packets.y(tile, 0, 0);
+
+    // tuile terminee, tous ses pixels ont converge
+    if(film.converged(x0, y0, x0 + packets.tile, y0 + packets.tile, threshold))
+    {
+        scheduler.done(tile, thread, stolen, 0);
+        continue;
+    }
 
+    for(int p= 0; p < packets.packets(); p++)
+    {
+    #ifdef RAY_STATS
+        // allocations du paquet et de ses pixels
+        long long packet_allocations= thread_allocations;
+    #endif
+        // generer les rayons
+        RayPacket packet;
+        packets.generate(tile, p, packet);
+
+        // calculer les intersections les plus proches de l'origine des rayons
+        HitPacket hits;
+    #ifdef RAY_STATS
+        long long packet_cost= ray_stats().cost();
+    #endif
+        intersect(scene.bvh, packet, hits);
+    #ifdef RAY_STATS
+        // le parcours du paquet est partage par ses pixels
+        packet_cost= ray_stats().cost() - packet_cost;
+    #endif
+
+    for(int k= 0; k < RayPacket::SIZE; k++)
+    {
+        int x= packets.x(tile, p, k);
+        int y= packets.y(tile, p, k);
+        if(x >= image.width() || y >= image.height())
+            continue;
+
+        // pixel converge, les echantillons sont utilises par les autres pixels
+        if(film.converged(x, y, threshold))
+            continue;
+
+        sampled[(y - y0) * packets.tile + (x - x0)]= 1;
+    #ifdef RAY_STATS
+        samples++;
+    #endif
+        Color& color= framebuffer[(y - y0) * packets.tile + (x - x0)];
+        Hit hit= hits.hit(k);
+    #ifdef RAY_STATS
+        long long cost= ray_stats().cost();
+    #endif
         if(hit)
         {
-            // EXO 2 materiaux diffus //
-            // image(x, y) = diffuse[hit.triangle_id];
+            // echantillons du pixel, sans etat partage entre les threads
+            PixelSampler<SobolSequence> sampler(sequence, y * image.width() + x, pass * N);
 
-            Vector n= normal(mesh, hit);
-            const Material &mat = mesh.triangle_material(hit.triangle_id);
-            Point p = triangles[hit.triangle_id].p*(1 - hit.u - hit.v) +
-                      (triangles[hit.triangle_id].p + triangles[hit.triangle_id].e1)*hit.u +
-                      (triangles[hit.triangle_id].p + triangles[hit.triangle_id].e2)*hit.v;
+            // EXO 2 materiaux diffus //
+            // color = scene.diffuse[hit.triangle_id];
+
+            Vector n= normal(scene.mesh, hit);
+            const Material &mat = scene.mesh.triangle_material(hit.triangle_id);
+            const Triangle &triangle = scene.triangle(hit.triangle_id);
+            Point p = triangle.p*(1 - hit.u - hit.v) +
+                      (triangle.p + triangle.e1)*hit.u +
+                      (triangle.p + triangle.e2)*hit.v;
             Point o = p + 0.001 * n;
 
             // EXO 4 ombre et eclairage direct //
-            // image(x, y) = shadeFlat(o, hit, triangles, sources, diffuse);
+            // color = shadeFlat(o, hit, scene);
 
 
             // EXO 5 pénombre et eclairage direct //
-            //image(x, y) = shade(16, u01, random, o, n, mesh, triangles, sources, diffuse, mat);
+            if(direct)
+                color = shade(N, sampler, o, n, mat, scene, context);
 
 
             // PARTIE 2 OCULTATION AMBIANTE 
-            image(x, y) = occultationAmb(16, u01, random, o, n, triangles);
+            else if(!global)
+                color = occultationAmb(N, sampler, o, n, scene);
+
+
+            // PARTIE 3 ECLAIRAGE GLOBAL, chemins //
+            else
+                color = path(N, sampler, packet.ray(k), hit, scene);
         }
+    #ifdef RAY_STATS
+        pixel_cost[y * image.width() + x]+= ray_stats().cost() - cost + float(packet_cost) / RayPacket::SIZE;
     #endif
     }
+    #ifdef RAY_STATS
+        allocations+= thread_allocations - packet_allocations;
+    #endif
+    }
+
+    // accumule la tuile, les tuiles ne se recouvrent pas
+    for(int y= y0; y < std::min(y0 + packets.tile, image.height()); y++)
+    for(int x= x0; x < std::min(x0 + packets.tile, image.width()); x++)
+        if(sampled[(y - y0) * packets.tile + (x - x0)])
+            film.add(x, y, framebuffer[(y - y0) * packets.tile + (x - x0)]);
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    scheduler.done(tile, thread, stolen, std::chrono::duration<float, std::milli>(stop - start).count());
+    }
+
+#ifdef RAY_STATS
+    #pragma omp atomic
+    pixel_allocations+= allocations;
+    #pragma omp atomic
+    pixel_samples+= samples;
+#endif
+    }
+
+    auto stop_pass= std::chrono::high_resolution_clock::now();
+    float elapsed= std::chrono::duration<float>(stop_pass - startA).count();
+    int converged= film.converged(threshold);
+    printf("pass %d %dms: %d spp, %d/%d pixels converged\n", pass +1, int(std::chrono::duration_cast<std::chrono::milliseconds>(stop_pass - start_pass).count()),
+        (pass +1) * N, converged, image.width() * image.height());
+    if(pass == 0)
+        scheduler.print();
 
-/*    BVH bvh;
+    // images intermediaires, apres 1, 2, 4, 8, etc. passes, cf --snapshots
+    if(options.snapshots && ((pass +1) & pass) == 0)
     {
-        auto start= std::chrono::high_resolution_clock::now();
-        
-        // intersection
-        const int n= int(rays.size());
-        #pragma omp parallel for schedule(dynamic, 1024)
-        for(int i= 0; i < n; i++)
-            ;//bvh.intersect_fast(rays[i]);
-        
-        auto stop= std::chrono::high_resolution_clock::now();
-        int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-        printf("bvh fast mt %dms\n", cpu);
+        char filename[1024];
+        sprintf(filename, "snapshot-%04d.hdr", pass +1);
+        write_image_hdr(film.image(), filename);
     }
 
-    for(int i= 0; i < rays.size(); i++)
+    bool finished= (converged == image.width() * image.height() || elapsed >= budget || pass +1 == max_passes);
+
+    // sauve regulierement l'etat du rendu, et a la fin, pour le reprendre, ou le continuer avec plus de temps
+    if(checkpoint_filename && (finished || std::chrono::duration<float>(stop_pass - last_checkpoint).count() >= checkpoint_interval))
     {
-        if(rays[i])
-        {
-            image(x, y) = ;
-        }
-    }*/
+        state[0]= pass +1;
+        if(write_checkpoint(film, state, checkpoint_filename) == 0)
+            printf("checkpoint '%s', pass %d\n", checkpoint_filename, pass +1);
+        last_checkpoint= stop_pass;
+    }
+
+    if(finished)
+    {
+        pass++;
+        break;
+    }
+    }
 
     auto stopA= std::chrono::high_resolution_clock::now();
     int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stopA - startA).count();
-    printf("%dms\n", cpu);
-    
+    printf("trace %dms, %d passes, %d spp max\n", cpu, pass, pass * N);
+#ifdef RAY_STATS
+    ray_stats_total().print(cpu);
+    printf("pixels: %lld allocations, %.3f allocations per pixel pass, %lld pixel passes\n", pixel_allocations, float(pixel_allocations) / std::max(1LL, pixel_samples), pixel_samples);
+    if(options.heatmap)
+    {
+        write_image(cost_heatmap(pixel_cost, image.width(), image.height()), "cost.png");
+        write_image_hdr(cost_heatmap(pixel_cost, image.width(), image.height()), "cost.hdr");
+    }
+#endif
+
+    // nombre d'echantillons par pixel
+    {
+        long total= 0;
+        int most= 0;
+        for(int i= 0; i < int(film.count.size()); i++)
+        {
+            total+= film.count[i];
+            most= std::max(most, film.count[i]);
+        }
+        printf("adaptive sampling: %.1f spp mean, %d spp max, %.1f%% of uniform sampling\n", float(total) * N / film.count.size(), most * N,
+            100.f * total / (float(most) * film.count.size()));
+        if(options.heatmap)
+        {
+            write_image(film.heatmap(max_passes), "spp.png");
+            write_image_hdr(film.heatmap(max_passes), "spp.hdr");
+        }
+    }
+
+    image= film.image();
     write_image(image, "render.png");
     write_image_hdr(image, "shadow.hdr");
     return 0;
@@ -50,12 +50,29 @@ struct BBox
     BBox( ) : pmin(), pmax() {}
     
     BBox( const Point& p ) : pmin(p), pmax(p) {}
-    BBox( const BBox& box ) : pmin(box.pmin), pmax(box.pmax) {}
     
     BBox& insert( const Point& p ) { pmin= min(pmin, p); pmax= max(pmax, p); return *this; }
     BBox& insert( const BBox& box ) { pmin= min(pmin, box.pmin); pmax= max(pmax, box.pmax); return *this; }
     
     float centroid( const int axis ) const { return (pmin(axis) + pmax(axis)) / 2; }
+    Point centroid( ) const { return center(pmin, pmax); }
+    
+    // aire de la surface de l'englobant, 0 pour un englobant vide
+    float area( ) const
+    {
+        Vector d= Vector(pmin, pmax);
+        if(d.x < 0 || d.y < 0 || d.z < 0) return 0;
+        return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+    
+    // englobant vide, insert() le remplace par le premier point / englobant
+    static BBox empty( )
+    {
+        BBox box;
+        box.pmin= Point(FLT_MAX, FLT_MAX, FLT_MAX);
+        box.pmax= Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        return box;
+    }
     
     BBoxHit intersect( const RayHit& ray ) const
     {
@@ -161,21 +178,40 @@ Node make_leaf( const BBox& bounds, const int begin, const int end )
 }
 
 
-struct triangle_less1
+// repartition des triangles dans les intervalles / bins, le long d'un axe
+struct triangle_bin
 {
     int axis;
-    float cut;
+    int bins;
+    float cmin;     // debut de l'intervalle, sur l'axe
+    float scale;    // bins / longueur de l'intervalle
     
-    triangle_less1( const int _axis, const float _cut ) : axis(_axis), cut(_cut) {}
+    triangle_bin( const int _axis, const int _bins, const float _cmin, const float _cmax ) : axis(_axis), bins(_bins), cmin(_cmin), scale(_bins / (_cmax - _cmin)) {}
     
-    bool operator() ( const Triangle& triangle ) const
+    int operator() ( const float centroid ) const
+    {
+        int b= int((centroid - cmin) * scale);
+        return std::max(0, std::min(b, bins -1));
+    }
+    
+    int operator() ( const Triangle& triangle ) const
     {
         // re-construit l'englobant du triangle
         BBox bounds= triangle.bounds();
-        return bounds.centroid(axis) < cut;
+        return (*this)(bounds.centroid(axis));
     }
 };
 
+struct triangle_less_bin
+{
+    triangle_bin bin;
+    int split;
+    
+    triangle_less_bin( const triangle_bin& _bin, const int _split ) : bin(_bin), split(_split) {}
+    
+    bool operator() ( const Triangle& triangle ) const { return bin(triangle) < split; }
+};
+
 
 struct BVH
 {
@@ -185,6 +221,11 @@ struct BVH
     
     int direct_tests;
     
+    int bins;           // nombre d'intervalles testes par axe pour evaluer le cout SAH d'un decoupage
+    int leaf_size;      // nombre max de triangles dans une feuille
+    
+    BVH( const int _bins= 16, const int _leaf_size= 4 ) : nodes(), triangles(), root(-1), direct_tests(0), bins(_bins), leaf_size(_leaf_size) {}
+    
     // construit un bvh pour l'ensemble de triangles
     int build( const BBox& _bounds, const std::vector<Triangle>& _triangles )
     {
@@ -214,46 +255,25 @@ protected:
     // construction d'un noeud
     int build( const BBox& bounds, const int begin, const int end )
     {
-        if(end - begin < 2)
+        // cherche le meilleur decoupage des triangles, ou construit une feuille
+        BBox bounds_left, bounds_right;
+        int m= split(bounds, begin, end, bounds_left, bounds_right);
+        if(m < 0)
         {
             // inserer une feuille et renvoyer son indice
             int index= nodes.size();
             nodes.push_back(make_leaf(bounds, begin, end));
             return index;
         }
-        
-        // axe le plus etire de l'englobant
-        Vector d= Vector(bounds.pmin, bounds.pmax);
-        int axis;
-        if(d.x > d.y && d.x > d.z)  // x plus grand que y et z ?
-            axis= 0;
-        else if(d.y > d.z)          // y plus grand que z ? (et que x implicitement)
-            axis= 1;
-        else                        // x et y ne sont pas les plus grands...
-            axis= 2;
-
-        // coupe l'englobant au milieu
-        float cut= bounds.centroid(axis);
-        
-        // repartit les triangles 
-        Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less1(axis, cut));
-        int m= std::distance(triangles.data(), pm);
-        
-        // la repartition des triangles peut echouer, et tous les triangles sont dans la meme partie... 
-        // forcer quand meme un decoupage en 2 ensembles 
-        if(m == begin || m == end)
-            m= (begin + end) / 2;
         assert(m != begin);
         assert(m != end);
         
         // construire le fils gauche
         // les triangles se trouvent dans [begin .. m)
-        BBox bounds_left= triangle_bounds(begin, m);
         int left= build(bounds_left, begin, m);
         
         // on recommence pour le fils droit
         // les triangles se trouvent dans [m .. end)
-        BBox bounds_right= triangle_bounds(m, end);
         int right= build(bounds_right, m, end);
         
         int index= nodes.size();
@@ -261,6 +281,139 @@ protected:
         return index;
     }
     
+    /* repartit les triangles [begin .. end) en 2 ensembles, renvoie l'indice du premier triangle du 2ieme ensemble et les englobants des 2 ensembles,
+        ou -1 si une feuille est moins chere que le meilleur decoupage.
+        
+        cf "on fast construction of SAH based bounding volume hierarchies", I. Wald, 2007
+        les triangles sont repartis dans des intervalles / bins le long de chaque axe, en fonction du centre de leur englobant,
+        le cout SAH des decoupages entre 2 intervalles est evalue en balayant les intervalles dans les 2 sens.
+     */
+    int split( const BBox& bounds, const int begin, const int end, BBox& bounds_left, BBox& bounds_right )
+    {
+        const int n= end - begin;
+        if(n <= 1)
+            return -1;
+        
+        // englobant des centres des triangles
+        BBox cbounds= BBox::empty();
+        for(int i= begin; i < end; i++)
+            cbounds.insert(triangles[i].bounds().centroid());
+        
+        const int MAX_BINS= 64;
+        const int nbins= std::max(2, std::min(bins, MAX_BINS));
+        
+        // repartit les triangles dans les intervalles des 3 axes
+        BBox bin_bounds[3][MAX_BINS];
+        int bin_count[3][MAX_BINS];
+        for(int axis= 0; axis < 3; axis++)
+        for(int b= 0; b < nbins; b++)
+        {
+            bin_bounds[axis][b]= BBox::empty();
+            bin_count[axis][b]= 0;
+        }
+        
+        bool valid[3];
+        triangle_bin bin[3]= {
+            triangle_bin(0, nbins, cbounds.pmin.x, cbounds.pmax.x),
+            triangle_bin(1, nbins, cbounds.pmin.y, cbounds.pmax.y),
+            triangle_bin(2, nbins, cbounds.pmin.z, cbounds.pmax.z) };
+        for(int axis= 0; axis < 3; axis++)
+            // tous les centres sont au meme endroit, pas de decoupage possible sur cet axe
+            valid[axis]= cbounds.pmax(axis) > cbounds.pmin(axis);
+        
+        for(int i= begin; i < end; i++)
+        {
+            BBox box= triangles[i].bounds();
+            Point c= box.centroid();
+            for(int axis= 0; axis < 3; axis++)
+            {
+                if(!valid[axis]) continue;
+                
+                int b= bin[axis](c(axis));
+                bin_bounds[axis][b].insert(box);
+                bin_count[axis][b]++;
+            }
+        }
+        
+        float best_cost= FLT_MAX;
+        int best_axis= -1;
+        int best_split= -1;
+        for(int axis= 0; axis < 3; axis++)
+        {
+            if(!valid[axis]) continue;
+            
+            // balaye les intervalles de droite a gauche, aire et nombre de triangles a droite de chaque decoupage
+            float right_area[MAX_BINS];
+            int right_count[MAX_BINS];
+            BBox right= BBox::empty();
+            int count= 0;
+            for(int b= nbins -1; b > 0; b--)
+            {
+                right.insert(bin_bounds[axis][b]);
+                count+= bin_count[axis][b];
+                right_area[b]= right.area();
+                right_count[b]= count;
+            }
+            
+            // puis de gauche a droite, et evalue le cout de chaque decoupage
+            BBox left= BBox::empty();
+            count= 0;
+            for(int b= 1; b < nbins; b++)
+            {
+                left.insert(bin_bounds[axis][b -1]);
+                count+= bin_count[axis][b -1];
+                if(count == 0 || right_count[b] == 0)
+                    continue;
+                
+                float cost= left.area() * count + right_area[b] * right_count[b];
+                if(cost < best_cost)
+                {
+                    best_cost= cost;
+                    best_axis= axis;
+                    best_split= b;
+                }
+            }
+        }
+        
+        if(best_axis < 0)
+        {
+            // pas de decoupage possible, tous les centres sont confondus...
+            // forcer quand meme un decoupage en 2 ensembles, si la feuille est trop grosse
+            if(n <= leaf_size)
+                return -1;
+            
+            int m= (begin + end) / 2;
+            bounds_left= triangle_bounds(begin, m);
+            bounds_right= triangle_bounds(m, end);
+            return m;
+        }
+        
+        // cout du decoupage, relatif a l'aire du noeud, un test rayon/englobant et un test rayon/triangle coutent 1
+        float area= bounds.area();
+        float leaf_cost= float(n);
+        float split_cost= 1 + (area > 0 ? best_cost / area : n);
+        if(n <= leaf_size && leaf_cost <= split_cost)
+            return -1;
+        
+        // englobants des 2 ensembles
+        bounds_left= BBox::empty();
+        bounds_right= BBox::empty();
+        for(int b= 0; b < nbins; b++)
+        {
+            if(b < best_split)
+                bounds_left.insert(bin_bounds[best_axis][b]);
+            else
+                bounds_right.insert(bin_bounds[best_axis][b]);
+        }
+        
+        // repartit les triangles
+        Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less_bin(bin[best_axis], best_split));
+        int m= std::distance(triangles.data(), pm);
+        assert(m != begin);
+        assert(m != end);
+        return m;
+    }
+    
     BBox triangle_bounds( const int begin, const int end )
     {
         BBox bbox= triangles[begin].bounds();